@@ -426,6 +426,7 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     luaC_checkGC(L);
     o = index2value(L, idx);  /* previous call may reallocate the stack */
   }
+  luaS_seal(L, tsvalue(o));
   lua_unlock(L);
   if (len != NULL)
     return getlstr(tsvalue(o), *len);
@@ -567,6 +568,22 @@ LUA_API const char *lua_pushexternalstring (lua_State *L,
 }
 
 
+LUA_API void lua_pushsubstring (lua_State *L, int idx, size_t i, size_t len) {
+  TValue *o;
+  TString *ts;
+  lua_lock(L);
+  o = index2value(L, idx);
+  api_check(L, ttisstring(o), "string expected");
+  api_check(L, i <= tsslen(tsvalue(o)) && len <= tsslen(tsvalue(o)) - i,
+                "invalid substring");
+  ts = luaS_sub(L, tsvalue(o), i, len);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
   if (s == NULL)
@@ -1167,6 +1184,11 @@ LUA_API int lua_status (lua_State *L) {
 /*
 ** Garbage-collection function
 */
+
+/* current mode of the collector, as returned by 'lua_gc' */
+#define gcmode(g)  ((g)->gcadapt.on ? LUA_GCADAPT \
+                  : (g)->gckind == KGC_INC ? LUA_GCINC : LUA_GCGEN)
+
 LUA_API int lua_gc (lua_State *L, int what, ...) {
   va_list argp;
   int res = 0;
@@ -1217,22 +1239,53 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       break;
     }
     case LUA_GCGEN: {
-      res = (g->gckind == KGC_INC) ? LUA_GCINC : LUA_GCGEN;
+      res = gcmode(g);
+      g->gcadapt.on = 0;
       luaC_changemode(L, KGC_GENMINOR);
       break;
     }
     case LUA_GCINC: {
-      res = (g->gckind == KGC_INC) ? LUA_GCINC : LUA_GCGEN;
+      res = gcmode(g);
+      g->gcadapt.on = 0;
       luaC_changemode(L, KGC_INC);
       break;
     }
+    case LUA_GCADAPT: {
+      int pause = va_arg(argp, int);
+      int overhead = va_arg(argp, int);
+      res = gcmode(g);
+      luaC_adaptive(L, pause, overhead);
+      break;
+    }
+    case LUA_GCIDLE: {
+      lu_byte oldstp = g->gcstp;
+      int usec = va_arg(argp, int);
+      g->gcstp = 0;  /* allow GC to run (other bits must be zero here) */
+      res = luaC_idle(L, usec);
+      g->gcstp = oldstp;  /* restore previous state */
+      break;
+    }
+    case LUA_GCSTATS: {
+      lua_GCStats *st = va_arg(argp, lua_GCStats *);
+      luaC_getstats(L, st);
+      break;
+    }
     case LUA_GCPARAM: {
       int param = va_arg(argp, int);
       int value = va_arg(argp, int);
       api_check(L, 0 <= param && param < LUA_GCPN, "invalid parameter");
-      res = cast_int(luaO_applyparam(g->gcparams[param], 100));
-      if (value >= 0)
-        g->gcparams[param] = luaO_codeparam(cast_uint(value));
+      if (param == LUA_GCPWORKERS)  /* not a percentage */
+        res = luaC_setworkers(L, value);
+      else if (param == LUA_GCPSTEPTIME) {  /* not a percentage either */
+        res = g->gcsteptime;
+        if (value >= 0)
+          g->gcsteptime = value;
+      }
+      else {
+        res = cast_int(luaO_applyparam(g->gcparams[param], 100));
+        if (value >= 0)
+          g->gcparams[param] = luaO_codeparam(cast_uint(value));
+      }
       break;
     }
     default: res = -1;  /* invalid option */
@@ -1264,13 +1317,13 @@ LUA_API int lua_error (lua_State *L) {
 }
 
 
-LUA_API int lua_next (lua_State *L, int idx) {
+static int auxnext (lua_State *L, int idx, unsigned *cursor) {
   Table *t;
   int more;
   lua_lock(L);
   api_checkpop(L, 1);
   t = gettable(L, idx);
-  more = luaH_next(L, t, L->top.p - 1);
+  more = luaH_next(L, t, L->top.p - 1, cursor);
   if (more)
     api_incr_top(L);
   else  /* no more elements */
@@ -1280,6 +1333,19 @@ LUA_API int lua_next (lua_State *L, int idx) {
 }
 
 
+LUA_API int lua_next (lua_State *L, int idx) {
+  return auxnext(L, idx, &L->nextcursor);
+}
+
+
+LUA_API int lua_nextc (lua_State *L, int idx, lua_Unsigned *cursor) {
+  unsigned c = (*cursor <= UINT_MAX) ? cast_uint(*cursor) : 0;
+  int more = auxnext(L, idx, &c);
+  *cursor = c;
+  return more;
+}
+
+
 LUA_API void lua_toclose (lua_State *L, int idx) {
   StkId o;
   lua_lock(L);
@@ -1328,12 +1394,20 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  luaC_setsweeper(L, 0);  /* new function may not be thread safe */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
 }
 
 
+LUA_API void lua_setallocsafe (lua_State *L, int safe) {
+  lua_lock(L);
+  luaC_setsweeper(L, safe);
+  lua_unlock(L);
+}
+
+
 void lua_setwarnf (lua_State *L, lua_WarnFunction f, void *ud) {
   lua_lock(L);
   G(L)->ud_warn = ud;
@@ -1460,6 +1534,38 @@ LUA_API void *lua_upvalueid (lua_State *L, int fidx, int n) {
 }
 
 
+/*
+** Get counter 'n' of the Lua function at index 'fidx': counter 0 counts
+** calls to the function, and each counter 'n > 0' counts iterations of
+** the n-th loop in the function. (See 'luaF_count'.)
+*/
+LUA_API int lua_getcounter (lua_State *L, int fidx, int n,
+                            lua_Unsigned *count, int *line) {
+  TValue *fi;
+  Proto *p;
+  int pc;
+  int res = 0;
+  lua_lock(L);
+  fi = index2value(L, fidx);
+  api_check(L, ttisfunction(fi), "function expected");
+  if (ttisLclosure(fi) && (p = clLvalue(fi)->p)->counters != NULL &&
+      0 <= n && n <= p->sizeloops) {  /* has such a counter? */
+    if (n == 0) {  /* calls? */
+      pc = -1;
+      *line = p->linedefined;
+    }
+    else {
+      pc = p->loops[n - 1];
+      *line = luaG_getfuncline(p, pc);
+    }
+    *count = p->counters[pc + 1];
+    res = 1;
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_upvaluejoin (lua_State *L, int fidx1, int n1,
                                             int fidx2, int n2) {
   LClosure *f1;
@@ -1186,6 +1186,7 @@ LUALIB_API lua_State *(luaL_newstate) (void) {
   if (l_likely(L)) {
     lua_atpanic(L, &panic);
     lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
+    lua_setallocsafe(L, 1);  /* 'free' is thread safe */
   }
   return L;
 }
@@ -11,6 +11,7 @@
 
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -188,7 +189,8 @@ static int pushmode (lua_State *L, int oldmode) {
     luaL_pushfail(L);  /* invalid call to 'lua_gc' */
   else
     lua_pushstring(L, (oldmode == LUA_GCINC) ? "incremental"
-                                             : "generational");
+                    : (oldmode == LUA_GCGEN) ? "generational"
+                                             : "adaptive");
   return 1;
 }
 
@@ -198,13 +200,71 @@ static int pushmode (lua_State *L, int oldmode) {
 */
 #define checkvalres(res) { if (res == -1) break; }
 
+/* sets 'field' of table on top to array 'a' with 'n' elements */
+static void setarray (lua_State *L, const char *field,
+                      const lua_Unsigned *a, int n) {
+  int i;
+  lua_createtable(L, n, 0);
+  for (i = 0; i < n; i++) {
+    lua_pushinteger(L, (lua_Integer)a[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, field);
+}
+
+
+/* sets 'field' of table on top to a table indexed by object types */
+static void settypes (lua_State *L, const char *field, const size_t *a) {
+  static const int types[] = {LUA_TSTRING, LUA_TTABLE, LUA_TFUNCTION,
+                              LUA_TUSERDATA, LUA_TTHREAD};
+  int i;
+  lua_createtable(L, 0, 6);
+  for (i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++) {
+    lua_pushinteger(L, (lua_Integer)a[types[i]]);
+    lua_setfield(L, -2, lua_typename(L, types[i]));
+  }
+  lua_pushinteger(L, (lua_Integer)a[LUA_NUMTYPES]);  /* internal types */
+  lua_setfield(L, -2, "other");
+  lua_setfield(L, -2, field);
+}
+
+
+static int pushstats (lua_State *L) {
+  static const char *const phases[] = {"propagate", "atomic", "sweep",
+                                       "callfin"};
+  lua_GCStats st;
+  int i;
+  if (lua_gc(L, LUA_GCSTATS, &st) == -1) {
+    luaL_pushfail(L);  /* invalid call (inside a finalizer) */
+    return 1;
+  }
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, (lua_Integer)st.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushinteger(L, (lua_Integer)st.marked);
+  lua_setfield(L, -2, "marked");
+  lua_pushinteger(L, (lua_Integer)st.freed);
+  lua_setfield(L, -2, "freed");
+  lua_createtable(L, 0, LUA_GCPHN);
+  for (i = 0; i < LUA_GCPHN; i++) {
+    lua_pushinteger(L, (lua_Integer)st.time[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_setfield(L, -2, "time");
+  setarray(L, "pauses", st.pauses, LUA_GCNPAUSES);
+  settypes(L, "count", st.count);
+  settypes(L, "bytes", st.bytes);
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "isrunning", "generational", "incremental",
-    "param", NULL};
+    "param", "idle", "adaptive", "stats", NULL};
   static const char optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,
-    LUA_GCPARAM};
+    LUA_GCPARAM, LUA_GCIDLE, LUA_GCADAPT, LUA_GCSTATS};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -221,6 +281,13 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCIDLE: {
+      lua_Integer usec = luaL_checkinteger(L, 2);
+      int res = lua_gc(L, o, (int)((usec > INT_MAX) ? INT_MAX : usec));
+      checkvalres(res);
+      lua_pushboolean(L, res);
+      return 1;
+    }
     case LUA_GCISRUNNING: {
       int res = lua_gc(L, o);
       checkvalres(res);
@@ -233,13 +300,24 @@ static int luaB_collectgarbage (lua_State *L) {
     case LUA_GCINC: {
       return pushmode(L, lua_gc(L, o));
     }
+    case LUA_GCADAPT: {
+      lua_Integer pause = luaL_optinteger(L, 2, 0);
+      lua_Integer overhead = luaL_optinteger(L, 3, 0);
+      return pushmode(L, lua_gc(L, o,
+                   (int)((pause > INT_MAX) ? INT_MAX : pause),
+                   (int)((overhead > INT_MAX) ? INT_MAX : overhead)));
+    }
+    case LUA_GCSTATS: {
+      return pushstats(L);
+    }
     case LUA_GCPARAM: {
       static const char *const params[] = {
         "minormul", "majorminor", "minormajor",
-        "pause", "stepmul", "stepsize", NULL};
+        "pause", "stepmul", "stepsize", "steptime", "workers", NULL};
       static const char pnum[] = {
         LUA_GCPMINORMUL, LUA_GCPMAJORMINOR, LUA_GCPMINORMAJOR,
-        LUA_GCPPAUSE, LUA_GCPSTEPMUL, LUA_GCPSTEPSIZE};
+        LUA_GCPPAUSE, LUA_GCPSTEPMUL, LUA_GCPSTEPSIZE, LUA_GCPSTEPTIME,
+        LUA_GCPWORKERS};
       int p = pnum[luaL_checkoption(L, 2, NULL, params)];
       lua_Integer value = luaL_optinteger(L, 3, -1);
       lua_pushinteger(L, lua_gc(L, o, p, (int)value));
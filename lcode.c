@@ -1921,7 +1921,8 @@ static int finaltarget (Instruction *code, int i) {
 
 /*
 ** Do a final pass over the code of a function, doing small peephole
-** optimizations and adjustments.
+** optimizations and adjustments. Superinstructions are fused last,
+** once the code is in its final form.
 */
 #include "lopnames.h"
 void luaK_finish (FuncState *fs) {
@@ -1959,4 +1960,5 @@ void luaK_finish (FuncState *fs) {
       default: break;
     }
   }
+  luaP_fuse(p->code, fs->pc);
 }
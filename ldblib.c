@@ -420,6 +420,42 @@ static int db_gethook (lua_State *L) {
 }
 
 
+static int db_cachestats (lua_State *L) {
+  size_t hits, misses;
+  lua_getcachestats(L, &hits, &misses);
+  lua_pushinteger(L, l_castU2S(hits));
+  lua_pushinteger(L, l_castU2S(misses));
+  return 2;
+}
+
+
+/*
+** Return a table with the execution counters of a Lua function: field
+** 'calls' has its number of calls, and each entry 'i' describes its
+** i-th loop, with fields 'line' and 'count'.
+*/
+static int db_getcounters (lua_State *L) {
+  lua_Unsigned count;
+  int line, n;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  if (!lua_getcounter(L, 1, 0, &count, &line)) {
+    luaL_pushfail(L);  /* no counters */
+    return 1;
+  }
+  lua_newtable(L);
+  lua_pushinteger(L, l_castU2S(count));
+  lua_setfield(L, -2, "calls");
+  for (n = 1; lua_getcounter(L, 1, n, &count, &line); n++) {
+    lua_createtable(L, 0, 2);
+    settabsi(L, "line", line);
+    lua_pushinteger(L, l_castU2S(count));
+    lua_setfield(L, -2, "count");
+    lua_rawseti(L, -2, n);
+  }
+  return 1;
+}
+
+
 static int db_debug (lua_State *L) {
   for (;;) {
     char buffer[250];
@@ -450,7 +486,9 @@ static int db_traceback (lua_State *L) {
 
 
 static const luaL_Reg dblib[] = {
+  {"cachestats", db_cachestats},
   {"debug", db_debug},
+  {"getcounters", db_getcounters},
   {"getuservalue", db_getuservalue},
   {"gethook", db_gethook},
   {"getinfo", db_getinfo},
@@ -159,6 +159,25 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+/*
+** Get the number of hits and misses of the inline caches used by the
+** interpreter for accesses to fields. Without LUA_USE_CACHESTATS, the
+** interpreter does not count them, and both numbers are zero.
+*/
+LUA_API void lua_getcachestats (lua_State *L, size_t *hits,
+                                              size_t *misses) {
+#if defined(LUA_USE_CACHESTATS)
+  global_State *g = G(L);
+  if (hits) *hits = cast_sizet(g->ichits);
+  if (misses) *misses = cast_sizet(g->icmisses);
+#else
+  UNUSED(L);
+  if (hits) *hits = 0;
+  if (misses) *misses = 0;
+#endif
+}
+
+
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
@@ -248,6 +267,7 @@ LUA_API const char *lua_setlocal (lua_State *L, const lua_Debug *ar, int n) {
   name = luaG_findlocal(L, ar->i_ci, n, &pos);
   if (name) {
     api_checkpop(L, 1);
+    L->gcclean = 0;  /* may change any part of the stack */
     setobjs2s(L, pos, L->top.p - 1);
     L->top.p--;  /* pop value */
   }
@@ -448,7 +468,7 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
     lastpc--;  /* previous instruction was not actually executed */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = luaP_genop(GET_OPCODE(i));
     int a = GETARG_A(i);
     int change;  /* true if current instruction changed 'reg' */
     switch (op) {
@@ -512,7 +532,7 @@ static const char *basicgetobjname (const Proto *p, int *ppc, int reg,
   *ppc = pc = findsetreg(p, pc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = luaP_genop(GET_OPCODE(i));
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -573,7 +593,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
     return kind;
   else if (lastpc != -1) {  /* could find instruction? */
     Instruction i = p->code[lastpc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = luaP_genop(GET_OPCODE(i));
     switch (op) {
       case OP_GETTABUP: {
         int k = GETARG_C(i);  /* key index */
@@ -616,7 +636,7 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
                                      int pc, const char **name) {
   TMS tm = (TMS)0;  /* (initial value avoids warnings) */
   Instruction i = p->code[pc];  /* calling instruction */
-  switch (GET_OPCODE(i)) {
+  switch (luaP_genop(GET_OPCODE(i))) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
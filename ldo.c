@@ -680,6 +680,7 @@ int luaD_pretailcall (lua_State *L, CallInfo *ci, StkId func,
       lua_assert(ci->top.p <= L->stack_last.p);
       ci->u.l.savedpc = p->code;  /* starting point */
       ci->callstatus |= CIST_TAIL;
+      luaF_count(p, 0);
       L->top.p = func + narg1;  /* set top */
       return -1;
     }
@@ -721,6 +722,7 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
       checkstackp(L, fsize, func);
       L->ci = ci = prepCallInfo(L, func, status, func + 1 + fsize);
       ci->u.l.savedpc = p->code;  /* starting point */
+      luaF_count(p, 0);
       for (; narg < nfixparams; narg++)
         setnilvalue(s2v(L->top.p++));  /* complete missing arguments */
       lua_assert(ci->top.p <= L->stack_last.p);
@@ -967,6 +969,7 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs,
   L->nCcalls = (from) ? getCcalls(from) : 0;
   if (getCcalls(L) >= LUAI_MAXCCALLS)
     return resume_error(L, "C stack overflow", nargs);
+  L->gcclean = 0;  /* running code can change the whole stack */
   L->nCcalls++;
   luai_userstateresume(L, nargs);
   api_checkpop(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
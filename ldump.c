@@ -18,6 +18,7 @@
 #include "lapi.h"
 #include "lgc.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "ltable.h"
 #include "lundump.h"
@@ -44,6 +45,10 @@ typedef struct {
 #define dumpLiteral(D, s)	dumpBlock(D,s,sizeof(s) - sizeof(char))
 
 
+/* size (in instructions) of the buffer used to dump code */
+#define DCODEBS		128
+
+
 /*
 ** Dump the block of memory pointed by 'b' with given 'size'.
 ** 'b' should not be NULL, except for the last call signaling the end
@@ -168,11 +173,25 @@ static void dumpString (DumpState *D, TString *ts) {
 }
 
 
+/*
+** Dump the code of a function. Quickened opcodes are dumped as their
+** generic versions, going through a buffer.
+*/
 static void dumpCode (DumpState *D, const Proto *f) {
+  Instruction buff[DCODEBS];
+  int i = 0;
   dumpInt(D, f->sizecode);
   dumpAlign(D, sizeof(f->code[0]));
   lua_assert(f->code != NULL);
-  dumpVector(D, f->code, cast_uint(f->sizecode));
+  while (i < f->sizecode) {
+    int n = 0;
+    do {
+      Instruction inst = f->code[i++];
+      SET_OPCODE(inst, luaP_genop(GET_OPCODE(inst)));
+      buff[n++] = inst;
+    } while (n < DCODEBS && i < f->sizecode);
+    dumpVector(D, buff, cast_uint(n));
+  }
 }
 
 
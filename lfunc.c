@@ -18,8 +18,10 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -249,6 +251,12 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->sizecode = 0;
+  f->icache = NULL;
+  f->jit = NULL;
+  f->jitcount = LUAI_JITHOT;
+  f->counters = NULL;
+  f->loops = NULL;
+  f->sizeloops = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
   f->abslineinfo = NULL;
@@ -273,6 +281,11 @@ lu_mem luaF_protosize (Proto *p) {
             + cast_uint(p->sizek) * sizeof(TValue)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
             + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
+  if (p->icache != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(unsigned int);
+  if (p->counters != NULL)
+    sz += cast_uint(p->sizecode + 1) * sizeof(lua_Unsigned)
+        + cast_uint(p->sizeloops) * sizeof(int);
   if (!(p->flag & PF_FIXED)) {
     sz += cast_uint(p->sizecode) * sizeof(Instruction);
     sz += cast_uint(p->sizelineinfo) * sizeof(lu_byte);
@@ -282,12 +295,75 @@ lu_mem luaF_protosize (Proto *p) {
 }
 
 
+/*
+** Create the inline caches for a prototype, once its code is complete,
+** with all entries empty. Prototypes with fixed code (loaded from fixed
+** buffers) do not get caches, to keep their memory footprint minimal.
+*/
+void luaF_initcache (lua_State *L, Proto *f) {
+  int i;
+  lua_assert(f->icache == NULL);
+  if (f->flag & PF_FIXED)
+    return;  /* no caches */
+  f->icache = luaM_newvectorchecked(L, f->sizecode, unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+}
+
+
+#if defined(LUA_USE_COUNTERS)
+
+/* check whether instruction 'i' jumps back to the start of a loop */
+#define isloopjump(i)  \
+  (GET_OPCODE(i) == OP_FORLOOP || GET_OPCODE(i) == OP_TFORLOOP ||  \
+   (GET_OPCODE(i) == OP_JMP && GETARG_sJ(i) < 0))
+
+
+/*
+** Create the execution counters for a prototype, once its code is
+** complete, with all counters zeroed. (See 'luaF_count'.) Also
+** collect in 'loops' the pcs of the instructions that jump back to the
+** start of a loop, so that the n-th loop is found directly. As with
+** inline caches, prototypes with fixed code do not get counters.
+*/
+void luaF_initcounters (lua_State *L, Proto *f) {
+  int i, n = 0;
+  lua_assert(f->counters == NULL && f->loops == NULL);
+  if (f->flag & PF_FIXED)
+    return;  /* no counters */
+  f->counters = luaM_newvectorchecked(L, f->sizecode + 1, lua_Unsigned);
+  for (i = 0; i <= f->sizecode; i++)
+    f->counters[i] = 0;
+  for (i = 0; i < f->sizecode; i++) {
+    if (isloopjump(f->code[i]))
+      n++;
+  }
+  f->loops = luaM_newvectorchecked(L, n, int);
+  f->sizeloops = n;
+  for (i = 0, n = 0; i < f->sizecode; i++) {
+    if (isloopjump(f->code[i]))
+      f->loops[n++] = i;
+  }
+}
+
+#endif
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
   if (!(f->flag & PF_FIXED)) {
     luaM_freearray(L, f->code, cast_sizet(f->sizecode));
     luaM_freearray(L, f->lineinfo, cast_sizet(f->sizelineinfo));
     luaM_freearray(L, f->abslineinfo, cast_sizet(f->sizeabslineinfo));
   }
+#if defined(LUA_USE_JIT)
+  if (f->jit != NULL)
+    luaJ_free(L, f);
+#endif
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, cast_sizet(f->sizecode));
+  if (f->counters != NULL)
+    luaM_freearray(L, f->counters, cast_sizet(f->sizecode + 1));
+  luaM_freearray(L, f->loops, cast_sizet(f->sizeloops));
   luaM_freearray(L, f->p, cast_sizet(f->sizep));
   luaM_freearray(L, f->k, cast_sizet(f->sizek));
   luaM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
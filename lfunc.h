@@ -47,6 +47,21 @@
 #define CLOSEKTOP	(LUA_ERRERR + 1)
 
 
+/*
+** With LUA_USE_COUNTERS, prototypes keep execution counters: counter 0
+** counts calls to the function, and counter 'pc + 1' counts the times
+** the instruction at 'pc' jumped back to the start of a loop. 'loops'
+** lists those instructions, so 'loops[n - 1]' is the pc of loop 'n'.
+*/
+#if defined(LUA_USE_COUNTERS)
+#define luaF_count(f,n)  \
+	{ if ((f)->counters != NULL) (f)->counters[n]++; }
+#else
+#define luaF_count(f,n)		((void)0)
+#define luaF_initcounters(L,f)	((void)0)
+#endif
+
+
 LUAI_FUNC Proto *luaF_newproto (lua_State *L);
 LUAI_FUNC CClosure *luaF_newCclosure (lua_State *L, int nupvals);
 LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nupvals);
@@ -57,9 +72,13 @@ LUAI_FUNC void luaF_closeupval (lua_State *L, StkId level);
 LUAI_FUNC StkId luaF_close (lua_State *L, StkId level, TStatus status, int yy);
 LUAI_FUNC void luaF_unlinkupval (UpVal *uv);
 LUAI_FUNC lu_mem luaF_protosize (Proto *p);
+LUAI_FUNC void luaF_initcache (lua_State *L, Proto *f);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
+#if defined(LUA_USE_COUNTERS)
+LUAI_FUNC void luaF_initcounters (lua_State *L, Proto *f);
+#endif
 
 
 #endif
@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 #include <string.h>
+#include <time.h>
 
 
 #include "lua.h"
@@ -93,6 +94,12 @@
 
 
 static void reallymarkobject (global_State *g, GCObject *o);
+static void wakeentries (struct EphDeps *ed, GCObject *o);
+static void chargetime (global_State *g, int phase);
+static void setgcstate (global_State *g, lu_byte state);
+static void endcycle (global_State *g);
+static lua_Unsigned startwork (global_State *g);
+static void endwork (global_State *g, lua_Unsigned start, int pause);
 static void atomic (lua_State *L);
 static void entersweep (lua_State *L);
 
@@ -154,6 +161,10 @@ static l_mem objsize (GCObject *o) {
       res = sizeof(UpVal);
       break;
     }
+    case LUA_VSHAPE: {
+      res = luaH_sizeshape(gco2sh(o));
+      break;
+    }
     default: res = 0; lua_assert(0);
   }
   return cast(l_mem, res);
@@ -230,6 +241,26 @@ static int iscleared (global_State *g, const GCObject *o) {
 }
 
 
+/*
+** Marking a shape also marks its key and its ancestors (see
+** 'reallymarkobject'). So, a barrier from an old object to shape 's'
+** turns them all black and, like 's', they must become OLD0 too.
+** Otherwise, other old objects could refer to them without barriers,
+** as they are not white, while they are still young. The walk stops at
+** an old ancestor, as everything above it is old already.
+*/
+static void ageshapes (global_State *g, Shape *s) {
+  for (;;) {
+    if (!isold(s->key))
+      setage(s->key, G_OLD0);
+    s = s->parent;
+    if (s == NULL || s == &g->rootshape || isold(s))
+      break;
+    setage(s, G_OLD0);
+  }
+}
+
+
 /*
 ** Barrier that moves collector forward, that is, marks the white object
 ** 'v' being pointed by the black object 'o'.  In the generational
@@ -251,6 +282,8 @@ void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
     if (isold(o)) {
       lua_assert(!isold(v));  /* white object could not be old */
       setage(v, G_OLD0);  /* restore generational invariant */
+      if (v->tt == LUA_VSHAPE)
+        ageshapes(g, gco2sh(v));
     }
   }
   else {  /* sweep phase */
@@ -262,14 +295,62 @@ void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
 
 
 /*
-** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** Minimum size (array plus hash parts) for an old table to use the
+** remembered set instead of being touched (see 'luaC_barrierback_').
 */
-void luaC_barrierback_ (lua_State *L, GCObject *o) {
+#if !defined(LUAI_GCREMMIN)
+#define LUAI_GCREMMIN	128
+#endif
+
+
+/*
+** Try to keep a young object 'v' stored into an old table 'o' in the
+** remembered set. Weak tables are not remembered, as that would keep
+** their entries strongly; small ones are not worth it.
+*/
+static int remember (global_State *g, GCObject *o, GCObject *v) {
+  if (o->tt == LUA_VTABLE && g->nremset < GCREMSET_N) {
+    Table *h = gco2t(o);
+    if (h->asize + sizenode(h) >= LUAI_GCREMMIN &&
+        gfasttm(g, h->metatable, TM_MODE) == NULL) {
+      if (g->nremset == 0 || g->remset[g->nremset - 1] != v)
+        g->remset[g->nremset++] = v;
+      return 1;
+    }
+  }
+  return 0;  /* use a regular barrier */
+}
+
+
+/*
+** barrier that moves collector backward, that is, mark the black object
+** pointing to a white object as gray again. In minor collections, a
+** large old table does not go back to the gray lists, as it would have
+** to be traversed again in the next cycle (and in the following one,
+** as 'touched2'); instead, the new object is kept in the remembered
+** set, whose elements are marked by the next two young collections.
+** (After them, the object is either old or dead.)
+*/
+void luaC_barrierback_ (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
   lua_assert(isblack(o) && !isdead(g, o));
   lua_assert((g->gckind != KGC_GENMINOR)
           || (isold(o) && getage(o) != G_TOUCHED1));
+  if (g->gckind == KGC_GENMINOR && getage(o) == G_OLD && remember(g, o, v))
+    return;  /* 'o' stays black and old */
+  luaC_touch_(L, o);
+}
+
+
+/*
+** Paint black object 'o' gray again, so that the collector traverses
+** it again. This is the backward barrier for several new references
+** at once, which may not be white: Objects marked through another
+** path (e.g., keys of a shape) are black, but may still be young.
+*/
+void luaC_touch_ (lua_State *L, GCObject *o) {
+  global_State *g = G(L);
+  lua_assert(isblack(o) && !isdead(g, o));
   if (getage(o) == G_TOUCHED2)  /* already in gray list? */
     set2gray(o);  /* make it gray to become touched1 */
   else  /* link it in 'grayagain' and paint it gray */
@@ -324,6 +405,25 @@ GCObject *luaC_newobj (lua_State *L, lu_byte tt, size_t sz) {
 */
 
 
+/*
+** Mark the parent of view 'ts'. If the parent is much larger than the
+** view and still unmarked, leave the decision to the atomic phase
+** ('checkviews'): if nothing else marks the parent, the view gets a
+** copy of its contents. (Emergency collections cannot allocate that
+** copy.)
+*/
+static void markview (global_State *g, TString *ts) {
+  TString *p = gparent(ts);
+  if (iswhite(p) && !g->gcemergency &&
+      ts->u.lnglen <= p->u.lnglen / STRVIEWFACTOR) {
+    ts->f.vnext = g->views;  /* link it in list 'views' */
+    g->views = ts;
+  }
+  else
+    markobject(g, p);
+}
+
+
 /*
 ** Mark an object.  Userdata with no user values, strings, and closed
 ** upvalues are visited and turned black here.  Open upvalues are
@@ -338,9 +438,14 @@ GCObject *luaC_newobj (lua_State *L, lu_byte tt, size_t sz) {
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
   g->GCmarked += objsize(o);
+  if (l_unlikely(g->ephdeps != NULL))  /* converging ephemerons? */
+    wakeentries(g->ephdeps, o);  /* entries with key 'o' can go on */
   switch (o->tt) {
-    case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
+      if (isviewstr(gco2ts(o)))  /* a view? */
+        markview(g, gco2ts(o));
+    }  /* FALLTHROUGH */
+    case LUA_VSHRSTR: {
       set2black(o);  /* nothing to visit */
       break;
     }
@@ -353,6 +458,13 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       markvalue(g, uv->v.p);  /* mark its content */
       break;
     }
+    case LUA_VSHAPE: {
+      Shape *sh = gco2sh(o);
+      set2black(sh);  /* shapes are visited here */
+      markobject(g, sh->key);
+      markobjectN(g, sh->parent);
+      break;
+    }
     case LUA_VUSERDATA: {
       Udata *u = gco2u(o);
       if (u->nuvalue == 0) {  /* no user values? */
@@ -429,6 +541,7 @@ static void remarkupvals (global_State *g) {
 static void cleargraylists (global_State *g) {
   g->gray = g->grayagain = NULL;
   g->weak = g->allweak = g->ephemeron = NULL;
+  g->views = NULL;
 }
 
 
@@ -438,6 +551,7 @@ static void cleargraylists (global_State *g) {
 ** during a cycle.
 */
 static void restartcollection (global_State *g) {
+  g->gccycle++;
   cleargraylists(g);
   g->GCmarked = 0;
   markobject(g, mainthread(g));
@@ -488,7 +602,12 @@ static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
-  int hasclears = (h->asize > 0);
+  int hasclears = (h->asize > 0 && arrmaygc(h));
+  if (isshaped(h)) {  /* check its slots */
+    unsigned i;
+    for (i = 0; !hasclears && i < shapeof(h)->nkeys; i++)
+      hasclears = iscleared(g, gcvalueN(&h->slots[i]));
+  }
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -509,19 +628,49 @@ static void traverseweakvalue (global_State *g, Table *h) {
 
 
 /*
-** Traverse the array part of a table.
+** Traverse the slots of a table with a shape. (Its keys are marked
+** through the shape.)
+*/
+static int traverseslots (global_State *g, Table *h) {
+  int marked = 0;  /* true if some object is marked in this traversal */
+  if (isshaped(h)) {
+    unsigned n = shapeof(h)->nkeys;
+    unsigned i;
+    for (i = 0; i < n; i++) {
+      if (valiswhite(&h->slots[i])) {
+        marked = 1;
+        reallymarkobject(g, gcvalue(&h->slots[i]));
+      }
+    }
+  }
+  return marked;
+}
+
+
+/*
+** Traverse the array part of a table, if it may have collectable
+** values. If it has none, clear its bit, so that next traversals can
+** skip it.
 */
 static int traversearray (global_State *g, Table *h) {
   unsigned asize = h->asize;
   int marked = 0;  /* true if some object is marked in this traversal */
+  int hasgc = 0;  /* true if array has some collectable value */
   unsigned i;
+  if (!arrmaygc(h))
+    return 0;  /* nothing to mark */
   for (i = 0; i < asize; i++) {
     GCObject *o = gcvalarr(h, i);
-    if (o != NULL && iswhite(o)) {
-      marked = 1;
-      reallymarkobject(g, o);
+    if (o != NULL) {
+      hasgc = 1;
+      if (iswhite(o)) {
+        marked = 1;
+        reallymarkobject(g, o);
+      }
     }
   }
+  if (!hasgc)
+    cleararrgc(h);
   return marked;
 }
 
@@ -544,8 +693,10 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
   unsigned int i;
   unsigned int nsize = sizenode(h);
   int marked = traversearray(g, h);  /* traverse array part */
+  /* string keys in slots are never cleared, so their values are strong */
+  marked |= traverseslots(g, h);
   /* traverse hash part; if 'inv', traverse descending
-     (see 'convergeephemerons') */
+     (see 'iterateephemerons') */
   for (i = 0; i < nsize; i++) {
     Node *n = inv ? gnode(h, nsize - 1 - i) : gnode(h, i);
     if (isempty(gval(n)))  /* entry is empty? */
@@ -573,17 +724,30 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 }
 
 
+/*
+** Traverse a strong table. As with the array part, the hash part is
+** skipped if it cannot have collectable keys or values, and its bit is
+** cleared if the traversal finds none. (Empty entries have their keys
+** cleared, so they do not count.)
+*/
 static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
   traversearray(g, h);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    if (isempty(gval(n)))  /* entry is empty? */
-      clearkey(n);  /* clear its key */
-    else {
-      lua_assert(!keyisnil(n));
-      markkey(g, n);
-      markvalue(g, gval(n));
+  traverseslots(g, h);
+  if (hashmaygc(h)) {
+    Node *n, *limit = gnodelast(h);
+    int hasgc = 0;  /* true if hash part has some collectable key/value */
+    for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+      if (isempty(gval(n)))  /* entry is empty? */
+        clearkey(n);  /* clear its key */
+      else {
+        lua_assert(!keyisnil(n));
+        hasgc |= (keyiscollectable(n) || iscollectable(gval(n)));
+        markkey(g, n);
+        markvalue(g, gval(n));
+      }
     }
+    if (!hasgc)
+      clearhashgc(h);
   }
   genlink(g, obj2gco(h));
 }
@@ -597,9 +761,10 @@ static int getmode (global_State *g, Table *h) {
   if (mode == NULL || !ttisstring(mode))
     return 0;  /* ignore non-string modes */
   else {
-    const char *smode = getstr(tsvalue(mode));
-    const char *weakkey = strchr(smode, 'k');
-    const char *weakvalue = strchr(smode, 'v');
+    size_t len;  /* (buffer strings may not end with a '\0') */
+    const char *smode = getlstr(tsvalue(mode), len);
+    const void *weakkey = memchr(smode, 'k', len);
+    const void *weakvalue = memchr(smode, 'v', len);
     return ((weakkey != NULL) << 1) | (weakvalue != NULL);
   }
 }
@@ -607,6 +772,8 @@ static int getmode (global_State *g, Table *h) {
 
 static l_mem traversetable (global_State *g, Table *h) {
   markobjectN(g, h->metatable);
+  if (isshaped(h))
+    markobject(g, shapeof(h));  /* its shape keeps its keys */
   switch (getmode(g, h)) {
     case 0:  /* not weak */
       traversestrongtable(g, h);
@@ -624,7 +791,8 @@ static l_mem traversetable (global_State *g, Table *h) {
         linkgclist(h, g->allweak);  /* must clear collected entries */
       break;
   }
-  return cast(l_mem, 1 + 2*sizenode(h) + h->asize);
+  return cast(l_mem, 1 + 2*sizenode(h) + h->asize +
+                    (isshaped(h) ? sizeslots(h) : 0));
 }
 
 
@@ -680,6 +848,35 @@ static l_mem traverseLclosure (global_State *g, LClosure *cl) {
 }
 
 
+/*
+** A suspended coroutine keeps a watermark, 'gcclean': the part of its
+** stack below the frame where it yielded cannot change until it runs
+** again, except through its open upvalues. ('lua_resume',
+** 'lua_setlocal', and 'luaE_resetthread' clear the watermark.) Its
+** stack is shrunk and its dead part cleared when the watermark is set,
+** so that later only the current frame can get new dead values (from
+** API calls over the suspended coroutine). The final traversal in an
+** incremental cycle can skip the clean part if it was marked earlier
+** in that same cycle. Minor collections can skip it after two
+** collections since the watermark was set: by then, all objects there
+** are old.
+*/
+static int canskipstack (global_State *g, lua_State *th) {
+  if (th->gcclean == 0)
+    return 0;  /* stack may have changed */
+  else if (g->gckind == KGC_GENMINOR)
+    return (g->gccycle - th->gcstamp >= 2);
+  else
+    return (th->gcstamp == g->gccycle);
+}
+
+
+static void clearstack (StkId from, StkId to) {
+  for (; from < to; from++)
+    setnilvalue(s2v(from));  /* clear dead stack slice */
+}
+
+
 /*
 ** Traverse a thread, marking the elements in the stack up to its top
 ** and cleaning the rest of the stack in the final traversal. That
@@ -695,28 +892,48 @@ static l_mem traverseLclosure (global_State *g, LClosure *cl) {
 static l_mem traversethread (global_State *g, lua_State *th) {
   UpVal *uv;
   StkId o = th->stack.p;
+  int clean = 0;  /* true if skipping the clean part of the stack */
+  l_mem work;
   if (isold(th) || g->gcstate == GCSpropagate)
     linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
   if (o == NULL)
     return 0;  /* stack not completely built yet */
   lua_assert(g->gcstate == GCSatomic ||
              th->openupval == NULL || isintwups(th));
+  if (g->gcstate == GCSatomic && canskipstack(g, th)) {
+    clean = 1;
+    o = restorestack(th, th->gcclean);  /* skip the clean part */
+    lua_assert(o <= th->top.p);
+    for (uv = th->openupval; uv != NULL; uv = uv->u.open.next) {
+      if (uv->v.p < s2v(o))  /* upvalue in the clean part? */
+        markvalue(g, uv->v.p);  /* its value may have changed */
+    }
+  }
+  else if (th->status == LUA_YIELD &&
+           (th->gcclean == 0 || g->gckind != KGC_GENMINOR)) {
+    th->gcclean = savestack(th, th->ci->func.p + 1);  /* set watermark */
+    th->gcstamp = g->gccycle;
+  }
+  work = 1 + (th->top.p - o);
   for (; o < th->top.p; o++)  /* mark live elements in the stack */
     markvalue(g, s2v(o));
   for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
     markobject(g, uv);  /* open upvalues cannot be collected */
-  if (g->gcstate == GCSatomic) {  /* final traversal? */
+  if (clean)  /* only the current frame may have dead values */
+    clearstack(th->top.p, th->ci->top.p);
+  else if (g->gcstate == GCSatomic || th->gcclean != 0) {
     if (!g->gcemergency)
       luaD_shrinkstack(th); /* do not change stack in emergency cycle */
-    for (o = th->top.p; o < th->stack_last.p + EXTRA_STACK; o++)
-      setnilvalue(s2v(o));  /* clear dead stack slice */
+    clearstack(th->top.p, th->stack_last.p + EXTRA_STACK);
+  }
+  if (g->gcstate == GCSatomic) {  /* final traversal? */
     /* 'remarkupvals' may have removed thread from 'twups' list */
     if (!isintwups(th) && th->openupval != NULL) {
       th->twups = g->twups;  /* link it back to the list */
       g->twups = th;
     }
   }
-  return 1 + (th->top.p - th->stack.p);
+  return work;
 }
 
 
@@ -740,21 +957,567 @@ static l_mem propagatemark (global_State *g) {
 }
 
 
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if defined(LUA_USE_PARALLELGC)
+
+#include <pthread.h>
+
+
+/*
+** With parallel marking, 'propagateall' shares the traversal of gray
+** objects among several markers: the running thread plus the helper
+** threads in 'g->gcpool'. Each marker keeps its own gray list and
+** takes a white object by changing its color with an atomic operation,
+** so each object is traversed by only one marker. Markers traverse only
+** objects whose traversal does not touch shared collector state:
+** strong tables, closures, prototypes, and userdata. They defer the
+** other objects (threads and tables that may be weak) to the running
+** thread, which traverses them sequentially after the parallel round.
+** The program is stopped while marking, so only the 'marked' fields of
+** objects change during a round. A marker without work waits until
+** another marker shares its gray list; markers check whether someone
+** is waiting before traversing each object. A round ends when all
+** markers are waiting.
+*/
+
+
+/*
+** Units of work traversed sequentially in 'propagateall' before it
+** starts a parallel round. (Rounds for little work would cost more
+** than they save. Moreover, objects deferred by a round must be
+** traversed sequentially before the next one.)
+*/
+#if !defined(LUAI_GCPARWORK)
+#define LUAI_GCPARWORK	(1 << 14)
+#endif
+
+
+/* atomic access to fields that markers read while others change them */
+#define atomicget(v)	__atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define atomicset(v,x)	__atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+
+#define setmarked(o,m)	atomicset((o)->marked, cast_byte(m))
+
+#define parwhite(o)	(atomicget((o)->marked) & WHITEBITS)
+
+/* make a gray object black (only its marker can change it) */
+#define parblack(o)	setmarked(o, (o)->marked | bitmask(BLACKBIT))
+
+
+typedef struct GCMarker {
+  struct GCPool *pool;
+  GCObject *gray;  /* gray objects to be traversed by this marker */
+  GCObject *deferred;  /* gray objects left for the running thread */
+  GCObject *grayagain;  /* objects to go to 'g->grayagain' */
+  TString *views;  /* views to go to 'g->views' */
+  l_mem marked;  /* number of bytes marked by this marker */
+  pthread_t thread;  /* helper thread (not used by the running thread) */
+} GCMarker;
+
+
+typedef struct GCPool {
+  global_State *g;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;  /* signals new shared work, rounds, and the end */
+  pthread_cond_t done;  /* signals that helpers finished their round */
+  int n;  /* number of markers (including the running thread) */
+  int nidle;  /* markers waiting for work in the current round */
+  int nshared;  /* number of lists in 'shared' */
+  int nrunning;  /* helpers still working in the current round */
+  unsigned int round;  /* number of current round */
+  int quit;  /* true when helpers must finish */
+  GCObject *shared[LUAI_MAXGCWORKERS];  /* gray lists given away */
+  GCMarker m[1];  /* markers; 'm[0]' is the running thread */
+} GCPool;
+
+#define sizegcpool(n)	(offsetof(GCPool, m) + cast_sizet(n) * sizeof(GCMarker))
+
+
+#define parmarkvalue(m,o)  \
+  { if (iscollectable(o) && parwhite(gcvalue(o))) parmark(m, gcvalue(o)); }
+
+#define parmarkkey(m,n)  \
+  { if (keyiscollectable(n) && parwhite(gckey(n))) parmark(m, gckey(n)); }
+
+#define parmarkobject(m,t)  \
+  { if (parwhite(t)) parmark(m, obj2gco(t)); }
+
+#define parmarkobjectN(m,t)	{ if (t) parmarkobject(m,t); }
+
+
+static void parmark (GCMarker *m, GCObject *o);
+
+
+/*
+** Take white object 'o' for the calling marker, turning it black or
+** gray. Returns false if the object is not white anymore (another
+** marker took it).
+*/
+static int claim (GCObject *o, int black) {
+  lu_byte old = atomicget(o->marked);
+  lu_byte nw;
+  do {
+    if (!(old & WHITEBITS))
+      return 0;
+    nw = cast_byte(old & ~WHITEBITS);
+    if (black)
+      nw = cast_byte(nw | bitmask(BLACKBIT));
+  } while (!__atomic_compare_exchange_n(&o->marked, &old, nw, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+
+/*
+** Parallel version of 'markview'.
+*/
+static void parmarkview (GCMarker *m, TString *ts) {
+  TString *p = gparent(ts);
+  if (parwhite(p) && !m->pool->g->gcemergency &&
+      ts->u.lnglen <= p->u.lnglen / STRVIEWFACTOR) {
+    ts->f.vnext = m->views;
+    m->views = ts;
+  }
+  else
+    parmarkobject(m, p);
+}
+
+
+/*
+** Parallel version of 'reallymarkobject'.
+*/
+static void parmark (GCMarker *m, GCObject *o) {
+  switch (o->tt) {
+    case LUA_VSHRSTR: case LUA_VLNGSTR: {
+      if (!claim(o, 1))
+        return;
+      if (isviewstr(gco2ts(o)))
+        parmarkview(m, gco2ts(o));
+      break;
+    }
+    case LUA_VUPVAL: {
+      UpVal *uv = gco2upv(o);
+      if (!claim(o, !upisopen(uv)))  /* open upvalues are kept gray */
+        return;
+      parmarkvalue(m, uv->v.p);
+      break;
+    }
+    case LUA_VSHAPE: {
+      Shape *sh = gco2sh(o);
+      if (!claim(o, 1))
+        return;
+      parmarkobject(m, sh->key);
+      parmarkobjectN(m, sh->parent);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      if (u->nuvalue == 0) {
+        if (!claim(o, 1))
+          return;
+        parmarkobjectN(m, u->metatable);
+        break;
+      }
+    }  /* FALLTHROUGH */
+    default: {
+      GCObject **pnext = getgclist(o);
+      if (!claim(o, 0))
+        return;
+      *pnext = m->gray;  /* link it in marker's gray list */
+      m->gray = o;
+      break;
+    }
+  }
+  m->marked += objsize(o);
+}
+
+
+/*
+** Parallel version of 'genlink'.
+*/
+static void pargenlink (GCMarker *m, GCObject *o) {
+  if (getage(o) == G_TOUCHED1) {
+    *getgclist(o) = m->grayagain;
+    m->grayagain = o;
+    setmarked(o, o->marked & ~maskcolors);  /* gray */
+  }
+  else if (getage(o) == G_TOUCHED2)
+    setmarked(o, (o->marked & ~AGEBITS) | G_OLD);
+}
+
+
+/*
+** Check whether table 'h' is surely not weak. (Unlike 'getmode', this
+** does not change the cache of metamethods of its metatable.)
+*/
+static int isstrong (global_State *g, Table *h) {
+  Table *mt = h->metatable;
+  return (checknoTM(mt, TM_MODE) ||
+          notm(luaH_Hgetshortstr(mt, g->tmname[TM_MODE])));
+}
+
+
+static void partraversetable (GCMarker *m, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned i;
+  parmarkobjectN(m, h->metatable);
+  if (isshaped(h)) {
+    unsigned nkeys = shapeof(h)->nkeys;
+    parmarkobject(m, shapeof(h));
+    for (i = 0; i < nkeys; i++)
+      parmarkvalue(m, &h->slots[i]);
+  }
+  for (i = 0; arrmaygc(h) && i < h->asize; i++) {
+    GCObject *o = gcvalarr(h, i);
+    if (o != NULL && parwhite(o))
+      parmark(m, o);
+  }
+  for (n = gnode(h, 0); hashmaygc(h) && n < limit; n++) {
+    if (isempty(gval(n)))  /* entry is empty? */
+      clearkey(n);  /* clear its key */
+    else {
+      parmarkkey(m, n);
+      parmarkvalue(m, gval(n));
+    }
+  }
+  pargenlink(m, obj2gco(h));
+}
+
+
+static void partraverseudata (GCMarker *m, Udata *u) {
+  int i;
+  parmarkobjectN(m, u->metatable);
+  for (i = 0; i < u->nuvalue; i++)
+    parmarkvalue(m, &u->uv[i].uv);
+  pargenlink(m, obj2gco(u));
+}
+
+
+static void partraverseproto (GCMarker *m, Proto *f) {
+  int i;
+  parmarkobjectN(m, f->source);
+  for (i = 0; i < f->sizek; i++)
+    parmarkvalue(m, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++)
+    parmarkobjectN(m, f->upvalues[i].name);
+  for (i = 0; i < f->sizep; i++)
+    parmarkobjectN(m, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++)
+    parmarkobjectN(m, f->locvars[i].varname);
+}
+
+
+static void partraverseCclosure (GCMarker *m, CClosure *cl) {
+  int i;
+  for (i = 0; i < cl->nupvalues; i++)
+    parmarkvalue(m, &cl->upvalue[i]);
+}
+
+
+static void partraverseLclosure (GCMarker *m, LClosure *cl) {
+  int i;
+  parmarkobjectN(m, cl->p);
+  for (i = 0; i < cl->nupvalues; i++)
+    parmarkobjectN(m, cl->upvals[i]);
+}
+
+
+/*
+** Traverse gray object 'o', turning it black, or defer it to the
+** running thread, keeping it gray.
+*/
+static void partraverse (GCMarker *m, GCObject *o) {
+  switch (o->tt) {
+    case LUA_VTABLE: {
+      if (!isstrong(m->pool->g, gco2t(o)))
+        break;  /* defer it */
+      parblack(o);
+      partraversetable(m, gco2t(o));
+      return;
+    }
+    case LUA_VUSERDATA:
+      parblack(o); partraverseudata(m, gco2u(o)); return;
+    case LUA_VLCL:
+      parblack(o); partraverseLclosure(m, gco2lcl(o)); return;
+    case LUA_VCCL:
+      parblack(o); partraverseCclosure(m, gco2ccl(o)); return;
+    case LUA_VPROTO:
+      parblack(o); partraverseproto(m, gco2p(o)); return;
+    default: break;  /* threads are always deferred */
+  }
+  *getgclist(o) = m->deferred;
+  m->deferred = o;
+}
+
+
+/*
+** Give the gray list of marker 'm' to the pool if there are more
+** markers waiting for work than lists to give them.
+*/
+static void sharework (GCMarker *m) {
+  GCPool *p = m->pool;
+  if (atomicget(p->nidle) > atomicget(p->nshared)) {
+    pthread_mutex_lock(&p->lock);
+    if (p->nidle > p->nshared) {  /* still needed? */
+      p->shared[p->nshared] = m->gray;
+      atomicset(p->nshared, p->nshared + 1);
+      m->gray = NULL;
+      pthread_cond_broadcast(&p->wake);
+    }
+    pthread_mutex_unlock(&p->lock);
+  }
+}
+
+
+/*
+** Wait for a shared gray list. Returns false when all markers are
+** waiting, that is, at the end of the round.
+*/
+static int getwork (GCMarker *m) {
+  GCPool *p = m->pool;
+  int found;
+  pthread_mutex_lock(&p->lock);
+  atomicset(p->nidle, p->nidle + 1);
+  while (p->nshared == 0 && p->nidle < p->n)
+    pthread_cond_wait(&p->wake, &p->lock);
+  if (p->nshared > 0) {
+    atomicset(p->nshared, p->nshared - 1);
+    m->gray = p->shared[p->nshared];
+    atomicset(p->nidle, p->nidle - 1);
+    found = 1;
+  }
+  else {  /* everybody is waiting; round is over */
+    pthread_cond_broadcast(&p->wake);
+    found = 0;
+  }
+  pthread_mutex_unlock(&p->lock);
+  return found;
+}
+
+
+static void markloop (GCMarker *m) {
+  do {
+    while (m->gray != NULL) {
+      GCObject *o = m->gray;
+      m->gray = *getgclist(o);
+      if (m->gray != NULL)
+        sharework(m);
+      partraverse(m, o);
+    }
+  } while (getwork(m));
+}
+
+
+static void *helper (void *ud) {
+  GCMarker *m = cast(GCMarker *, ud);
+  GCPool *p = m->pool;
+  unsigned int round = 0;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->round == round && !p->quit)
+      pthread_cond_wait(&p->wake, &p->lock);
+    if (p->quit)
+      break;
+    round = p->round;
+    pthread_mutex_unlock(&p->lock);
+    markloop(m);
+    pthread_mutex_lock(&p->lock);
+    if (--p->nrunning == 0)
+      pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+
+/*
+** Move all objects from gray list 'l' to gray list 'list'.
+*/
+static void movegclist (GCObject *l, GCObject **list) {
+  while (l != NULL) {
+    GCObject **pnext = getgclist(l);
+    GCObject *next = *pnext;
+    *pnext = *list;
+    *list = l;
+    l = next;
+  }
+}
+
+
+/*
+** Run a parallel round, marking everything reachable from the gray
+** list except through deferred objects, which go back to that list.
+*/
+static void parallelmark (global_State *g) {
+  GCPool *p = g->gcpool;
+  int i;
+  pthread_mutex_lock(&p->lock);
+  p->shared[0] = g->gray;
+  p->nshared = 1;
+  p->nidle = 0;
+  p->nrunning = p->n - 1;
+  p->round++;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  g->gray = NULL;
+  markloop(&p->m[0]);
+  pthread_mutex_lock(&p->lock);
+  while (p->nrunning > 0)  /* wait for the helpers */
+    pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 0; i < p->n; i++) {  /* collect the results of all markers */
+    GCMarker *m = &p->m[i];
+    lua_assert(m->gray == NULL);
+    movegclist(m->deferred, &g->gray);
+    movegclist(m->grayagain, &g->grayagain);
+    while (m->views != NULL) {
+      TString *ts = m->views;
+      m->views = ts->f.vnext;
+      ts->f.vnext = g->views;
+      g->views = ts;
+    }
+    g->GCmarked += m->marked;
+    m->deferred = m->grayagain = NULL;
+    m->marked = 0;
+  }
+}
+
+
+/*
+** Finish the helpers of pool 'p' (those already created) and free it.
+** ('size' is the number of markers allocated in the pool.)
+*/
+static void freepool (lua_State *L, GCPool *p, int size) {
+  int i;
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 1; i < p->n; i++)
+    pthread_join(p->m[i].thread, NULL);
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->wake);
+  pthread_mutex_destroy(&p->lock);
+  luaM_freemem(L, p, sizegcpool(size));
+}
+
+
+/*
+** Create a pool with 'n' markers. Returns NULL if it cannot get the
+** memory or the threads.
+*/
+static GCPool *newpool (lua_State *L, int n) {
+  GCPool *p = cast(GCPool *, luaM_realloc_(L, NULL, 0, sizegcpool(n)));
+  int i;
+  if (p == NULL)
+    return NULL;
+  p->g = G(L);
+  p->n = 1;  /* only the running thread (for now) */
+  p->nidle = p->nshared = p->nrunning = 0;
+  p->round = 0;
+  p->quit = 0;
+  for (i = 0; i < n; i++) {
+    GCMarker *m = &p->m[i];
+    m->pool = p;
+    m->gray = m->deferred = m->grayagain = NULL;
+    m->views = NULL;
+    m->marked = 0;
+  }
+  if (pthread_mutex_init(&p->lock, NULL) != 0) {
+    luaM_freemem(L, p, sizegcpool(n));
+    return NULL;
+  }
+  pthread_cond_init(&p->wake, NULL);
+  pthread_cond_init(&p->done, NULL);
+  for (; p->n < n; p->n++) {  /* create the helpers */
+    if (pthread_create(&p->m[p->n].thread, NULL, helper, &p->m[p->n]) != 0) {
+      freepool(L, p, n);
+      return NULL;
+    }
+  }
+  return p;
+}
+
+
+/*
+** Set the number of markers to 'n', if 'n' is positive, and return
+** the previous number. (If it cannot create the helpers, the running
+** thread marks alone.)
+*/
+int luaC_setworkers (lua_State *L, int n) {
+  global_State *g = G(L);
+  int old = (g->gcpool != NULL) ? g->gcpool->n : 1;
+  if (n > LUAI_MAXGCWORKERS)
+    n = LUAI_MAXGCWORKERS;
+  if (n > 0 && n != old) {
+    if (g->gcpool != NULL) {
+      freepool(L, g->gcpool, old);
+      g->gcpool = NULL;
+    }
+    if (n > 1)
+      g->gcpool = newpool(L, n);
+  }
+  return old;
+}
+
+
+#else
+
+int luaC_setworkers (lua_State *L, int n) {
+  UNUSED(L); UNUSED(n);
+  return 1;  /* only the running thread marks objects */
+}
+
+#endif
+
+
 static void propagateall (global_State *g) {
+#if defined(LUA_USE_PARALLELGC)
+  l_mem work = 0;
+  while (g->gray) {
+    if (g->gcpool != NULL && work > LUAI_GCPARWORK) {
+      parallelmark(g);
+      work = 0;
+    }
+    else
+      work += propagatemark(g);
+  }
+#else
   while (g->gray)
     propagatemark(g);
+#endif
 }
 
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Ephemeron propagation
+** =======================================================
+*/
+
 
 /*
 ** Traverse all ephemeron tables propagating marks from keys to values.
 ** Repeat until it converges, that is, nothing new is marked. 'dir'
 ** inverts the direction of the traversals, trying to speed up
-** convergence on chains in the same table.
+** convergence on chains in the same table. This is the fallback of
+** 'convergeephemerons', used when there is no memory for the records
+** of blocked entries.
 */
-static void convergeephemerons (global_State *g) {
+static void iterateephemerons (global_State *g) {
   int changed;
   int dir = 0;
+  propagateall(g);
   do {
     GCObject *w;
     GCObject *next = g->ephemeron;  /* get ephemeron list */
@@ -769,8 +1532,187 @@ static void convergeephemerons (global_State *g) {
         changed = 1;  /* will have to revisit all ephemeron tables */
       }
     }
-    dir = !dir;  /* invert direction next time */
-  } while (changed);  /* repeat until no more changes */
+    dir = !dir;  /* invert direction next time */
+  } while (changed);  /* repeat until no more changes */
+}
+
+
+/*
+** Records of ephemeron entries blocked by white keys. Each entry
+** "white key -> white value" gets a record in 'dep', which goes into
+** the chain (starting at 'bucket') of records with keys with the same
+** hash. While 'g->ephdeps' points to this structure, each object
+** marked by 'reallymarkobject' wakes the records with it as key: they
+** leave their chain and go to the list 'woken', whose values will be
+** marked. So, after its table is traversed, an entry is visited only
+** once more, instead of once for each pass over all ephemeron tables.
+** 'dep' and 'bucket' live in a single block with space for 2^lsize
+** records and 2^lsize chains.
+*/
+typedef struct EphDep {
+  GCObject *key;  /* key blocking the entry (NULL after woken) */
+  Node *n;  /* blocked entry */
+  int next;  /* next record in its chain or in 'woken' (-1 if none) */
+} EphDep;
+
+typedef struct EphDeps {
+  EphDep *dep;  /* records */
+  int *bucket;  /* first record in each chain (-1 if none) */
+  int ndep;  /* number of records in use */
+  int lsize;  /* log2 of the size of 'dep' and 'bucket' (or -1) */
+  int woken;  /* list of woken records (-1 if empty) */
+} EphDeps;
+
+
+/* minimum and maximum log2 of the size of the records */
+#define MINLDEPS	6
+#define MAXLDEPS	24
+
+#define depsize(ls)	(cast_sizet(1) << (ls))
+#define depblock(ls)	(depsize(ls) * (sizeof(EphDep) + sizeof(int)))
+
+/* Fibonacci hashing of object addresses */
+#define ephhash(ed,o)  \
+	cast_int((cast(l_uint32, point2uint(o)) * 2654435769u) >> \
+	         (32 - (ed)->lsize))
+
+
+static void wakeentries (EphDeps *ed, GCObject *o) {
+  int *p;
+  if (ed->lsize < 0)
+    return;  /* no records yet */
+  p = &ed->bucket[ephhash(ed, o)];
+  while (*p >= 0) {
+    EphDep *d = &ed->dep[*p];
+    if (d->key == o) {  /* entry blocked by 'o'? */
+      int i = *p;
+      *p = d->next;  /* remove record from its chain */
+      d->key = NULL;
+      d->next = ed->woken;  /* insert it in list 'woken' */
+      ed->woken = i;
+    }
+    else
+      p = &d->next;
+  }
+}
+
+
+static void linkdep (EphDeps *ed, int i) {
+  int *b = &ed->bucket[ephhash(ed, ed->dep[i].key)];
+  ed->dep[i].next = *b;
+  *b = i;
+}
+
+
+/*
+** Double the space for records and rebuild the chains. Returns 0 if
+** it cannot allocate the new block. ('gcstopem' is on, so there are no
+** emergency collections here.)
+*/
+static int growdeps (lua_State *L, EphDeps *ed) {
+  int ls = (ed->lsize < 0) ? MINLDEPS : ed->lsize + 1;
+  size_t osize = (ed->lsize < 0) ? 0 : depblock(ed->lsize);
+  void *block;
+  int i;
+  if (ls > MAXLDEPS)
+    return 0;  /* too many records */
+  block = luaM_realloc_(L, ed->dep, osize, depblock(ls));
+  if (block == NULL)
+    return 0;
+  /* records keep their positions; chains are rebuilt after them */
+  ed->dep = cast(EphDep *, block);
+  ed->bucket = cast(int *, ed->dep + depsize(ls));
+  ed->lsize = ls;
+  for (i = 0; i < cast_int(depsize(ls)); i++)
+    ed->bucket[i] = -1;
+  for (i = 0; i < ed->ndep; i++) {
+    if (ed->dep[i].key != NULL)  /* record still blocked? */
+      linkdep(ed, i);
+  }
+  return 1;
+}
+
+
+/*
+** Record the white->white entries of an (already traversed) ephemeron
+** table. Values whose keys were marked after that traversal are marked
+** now. Returns 0 if there is no memory for the records.
+*/
+static int recorddeps (lua_State *L, EphDeps *ed, Table *h) {
+  global_State *g = G(L);
+  Node *n, *limit = gnodelast(h);
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (!isempty(gval(n)) && valiswhite(gval(n))) {
+      if (iscleared(g, gckeyN(n))) {  /* key is still white? */
+        if (ed->lsize < 0 || ed->ndep == cast_int(depsize(ed->lsize))) {
+          if (!growdeps(L, ed))
+            return 0;
+        }
+        ed->dep[ed->ndep].key = gckeyN(n);
+        ed->dep[ed->ndep].n = n;
+        linkdep(ed, ed->ndep++);
+      }
+      else
+        reallymarkobject(g, gcvalue(gval(n)));
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Propagate marks from keys to values in all ephemeron tables until
+** nothing new is marked. Each table in the list 'ephemeron' has its
+** blocked entries recorded and goes to list 'done'; then, the loop
+** marks the values of woken entries and propagates marks (which may
+** wake other entries or add new tables to 'ephemeron'). Marks are
+** propagated sequentially, as helper threads do not wake entries. The
+** tables end in the list 'ephemeron', to be cleared.
+*/
+static void convergeephemerons (lua_State *L) {
+  global_State *g = G(L);
+  EphDeps ed;
+  GCObject *done = NULL;  /* tables with their entries recorded */
+  lu_byte oldstopem = g->gcstopem;
+  ed.dep = NULL; ed.bucket = NULL;
+  ed.ndep = 0; ed.lsize = -1; ed.woken = -1;
+  if (g->ephemeron == NULL)
+    return;  /* nothing to be done */
+  g->gcstopem = 1;  /* no emergency collections while recording */
+  g->ephdeps = &ed;
+  for (;;) {
+    if (ed.woken >= 0) {  /* some woken entry? */
+      EphDep *d = &ed.dep[ed.woken];
+      ed.woken = d->next;
+      if (valiswhite(gval(d->n)))  /* value not marked yet? */
+        reallymarkobject(g, gcvalue(gval(d->n)));
+    }
+    else if (g->gray != NULL)
+      propagatemark(g);
+    else if (g->ephemeron != NULL) {  /* some new table? */
+      Table *h = gco2t(g->ephemeron);
+      if (!recorddeps(L, &ed, h))
+        break;  /* not enough memory; 'h' stays in 'ephemeron' */
+      g->ephemeron = h->gclist;  /* move 'h' to list 'done' */
+      h->gclist = done;
+      done = obj2gco(h);
+    }
+    else
+      break;  /* converged */
+  }
+  g->ephdeps = NULL;
+  if (g->ephemeron != NULL) {  /* could not finish? */
+    GCObject **p = &g->ephemeron;
+    while (*p != NULL)  /* go to the end of the list */
+      p = &gco2t(*p)->gclist;
+    *p = done;  /* join both lists */
+    iterateephemerons(g);  /* finish with the slow method */
+  }
+  else
+    g->ephemeron = done;
+  if (ed.lsize >= 0)
+    luaM_free_(L, ed.dep, depblock(ed.lsize));
+  g->gcstopem = oldstopem;
 }
 
 /* }====================================================== */
@@ -810,12 +1752,19 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
     unsigned int i;
-    unsigned int asize = h->asize;
+    unsigned int asize = arrmaygc(h) ? h->asize : 0;
     for (i = 0; i < asize; i++) {
       GCObject *o = gcvalarr(h, i);
       if (iscleared(g, o))  /* value was collected? */
         *getArrTag(h, i) = LUA_VEMPTY;  /* remove entry */
     }
+    if (isshaped(h)) {
+      unsigned nkeys = shapeof(h)->nkeys;
+      for (i = 0; i < nkeys; i++) {
+        if (iscleared(g, gcvalueN(&h->slots[i])))  /* unmarked value? */
+          setempty(&h->slots[i]);  /* remove entry */
+      }
+    }
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
         setempty(gval(n));  /* remove entry */
@@ -834,7 +1783,9 @@ static void freeupval (lua_State *L, UpVal *uv) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
-  assert_code(l_mem newmem = gettotalbytes(G(L)) - objsize(o));
+  l_mem size = objsize(o);
+  assert_code(l_mem newmem = gettotalbytes(G(L)) - size);
+  G(L)->gcstats.freeing += size;
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
@@ -855,6 +1806,9 @@ static void freeobj (lua_State *L, GCObject *o) {
     case LUA_VTABLE:
       luaH_free(L, gco2t(o));
       break;
+    case LUA_VSHAPE:
+      luaH_freeshape(L, gco2sh(o));
+      break;
     case LUA_VTHREAD:
       luaE_freethread(L, gco2th(o));
       break;
@@ -872,7 +1826,12 @@ static void freeobj (lua_State *L, GCObject *o) {
     case LUA_VLNGSTR: {
       TString *ts = gco2ts(o);
       if (ts->shrlen == LSTRMEM)  /* must free external string? */
-        (*ts->falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
+        (*ts->f.falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
+      else if (isbufstr(ts)) {  /* string in a shared buffer? */
+        size_t freed = luaS_releasebuf(L, ts);
+        assert_code(newmem -= cast(l_mem, freed));
+        cast_void(freed);
+      }
       luaM_freemem(L, ts, luaS_sizelngstr(ts->u.lnglen, ts->shrlen));
       break;
     }
@@ -923,6 +1882,181 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Background sweeping
+** =======================================================
+*/
+
+#if defined(LUA_USE_PARALLELGC)
+
+/*
+** While a sweep step runs, 'g->gcdefer' is true and 'luaM_free_' links
+** the blocks it should free into the list 'g->deadblocks', instead of
+** calling the allocation function. At the end of the step, the
+** collector hands that list to the sweeper, a thread that calls the
+** allocation function to free those blocks. So, the running thread
+** still unlinks the dead objects and keeps the accounting of memory,
+** but it does not pay for the release of their memory. There is a
+** sweeper only while the allocation function is thread safe (see
+** 'lua_setallocsafe').
+*/
+typedef struct GCSweeper {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;  /* signals new blocks or the end of the sweeper */
+  pthread_cond_t idle;  /* signals that all blocks were freed */
+  DeadBlock *blocks;  /* blocks waiting to be freed */
+  int busy;  /* true while the sweeper is freeing a list of blocks */
+  int quit;  /* true when the sweeper must finish */
+  lua_Alloc frealloc;  /* allocation function (when sweeper was created) */
+  void *ud;  /* its auxiliary data */
+  pthread_t thread;
+} GCSweeper;
+
+
+static void *sweeper (void *ud) {
+  GCSweeper *s = cast(GCSweeper *, ud);
+  pthread_mutex_lock(&s->lock);
+  for (;;) {
+    DeadBlock *d;
+    while (s->blocks == NULL && !s->quit)
+      pthread_cond_wait(&s->wake, &s->lock);
+    if (s->blocks == NULL)  /* finishing and nothing else to free? */
+      break;
+    d = s->blocks;
+    s->blocks = NULL;
+    s->busy = 1;
+    pthread_mutex_unlock(&s->lock);
+    while (d != NULL) {
+      DeadBlock *next = d->next;
+      (*s->frealloc)(s->ud, d, d->size, 0);
+      d = next;
+    }
+    pthread_mutex_lock(&s->lock);
+    s->busy = 0;
+    pthread_cond_broadcast(&s->idle);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+
+/* start to defer the release of dead blocks, if there is a sweeper */
+static void deferfrees (global_State *g) {
+  g->gcdefer = (g->gcsweeper != NULL && !g->gcemergency);
+}
+
+
+/*
+** Stop deferring the release of dead blocks and hand the blocks
+** already collected to the sweeper.
+*/
+static void handblocks (global_State *g) {
+  DeadBlock *l = g->deadblocks;
+  g->gcdefer = 0;
+  if (l != NULL) {
+    GCSweeper *s = g->gcsweeper;
+    DeadBlock *last = l;
+    while (last->next != NULL)  /* go to the end of the list */
+      last = last->next;
+    g->deadblocks = NULL;
+    pthread_mutex_lock(&s->lock);
+    last->next = s->blocks;
+    s->blocks = l;
+    pthread_cond_signal(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+
+/* wait until the sweeper has freed all blocks handed to it */
+static void waitsweeper (global_State *g) {
+  GCSweeper *s = g->gcsweeper;
+  if (s != NULL) {
+    pthread_mutex_lock(&s->lock);
+    while (s->blocks != NULL || s->busy)
+      pthread_cond_wait(&s->idle, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+
+/* finish the sweeper (after it frees all its blocks) and free it */
+static void stopsweeper (lua_State *L, GCSweeper *s) {
+  pthread_mutex_lock(&s->lock);
+  s->quit = 1;
+  pthread_cond_signal(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+  pthread_join(s->thread, NULL);
+  pthread_cond_destroy(&s->idle);
+  pthread_cond_destroy(&s->wake);
+  pthread_mutex_destroy(&s->lock);
+  luaM_free(L, s);
+}
+
+
+/*
+** Create a sweeper. Returns NULL if it cannot get the memory or the
+** thread.
+*/
+static GCSweeper *newsweeper (lua_State *L) {
+  global_State *g = G(L);
+  GCSweeper *s = cast(GCSweeper *,
+                      luaM_realloc_(L, NULL, 0, sizeof(GCSweeper)));
+  if (s == NULL)
+    return NULL;
+  s->blocks = NULL;
+  s->busy = s->quit = 0;
+  s->frealloc = g->frealloc;
+  s->ud = g->ud;
+  if (pthread_mutex_init(&s->lock, NULL) != 0) {
+    luaM_free(L, s);
+    return NULL;
+  }
+  pthread_cond_init(&s->wake, NULL);
+  pthread_cond_init(&s->idle, NULL);
+  if (pthread_create(&s->thread, NULL, sweeper, s) != 0) {
+    pthread_cond_destroy(&s->idle);
+    pthread_cond_destroy(&s->wake);
+    pthread_mutex_destroy(&s->lock);
+    luaM_free(L, s);
+    return NULL;
+  }
+  return s;
+}
+
+
+/*
+** Create ('on' true) or finish ('on' false) the sweeper. (If it cannot
+** create the sweeper, the running thread frees all dead objects.)
+*/
+void luaC_setsweeper (lua_State *L, int on) {
+  global_State *g = G(L);
+  if (on && g->gcsweeper == NULL)
+    g->gcsweeper = newsweeper(L);
+  else if (!on && g->gcsweeper != NULL) {
+    GCSweeper *s = g->gcsweeper;
+    g->gcsweeper = NULL;
+    stopsweeper(L, s);
+  }
+}
+
+
+#else
+
+#define deferfrees(g)	((void)0)
+#define handblocks(g)	((void)0)
+#define waitsweeper(g)	((void)0)
+
+void luaC_setsweeper (lua_State *L, int on) {
+  UNUSED(L); UNUSED(on);  /* dead objects are always freed in place */
+}
+
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Finalization
@@ -930,13 +2064,14 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 */
 
 /*
-** If possible, shrink string table.
+** If possible, shrink string table and the heap of small blocks.
 */
 static void checkSizes (lua_State *L, global_State *g) {
   if (!g->gcemergency) {
     if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
       luaS_resize(L, g->strt.size / 2);
   }
+  luaM_shrinkheap(L);  /* does not allocate, so also in emergencies */
 }
 
 
@@ -1286,15 +2421,35 @@ static void markold (global_State *g, GCObject *from, GCObject *to) {
 }
 
 
+/*
+** Mark the objects in the remembered set. Then, remove the ones that
+** were already there in the previous young collection, keeping the
+** ones added in this cycle for the next collection.
+*/
+static void markremset (global_State *g) {
+  int i;
+  int nnew = g->nremset - g->nremold;
+  for (i = 0; i < g->nremset; i++) {
+    if (iswhite(g->remset[i]))
+      reallymarkobject(g, g->remset[i]);
+  }
+  for (i = 0; i < nnew; i++)
+    g->remset[i] = g->remset[g->nremold + i];
+  g->nremset = g->nremold = nnew;
+}
+
+
 /*
 ** Finish a young-generation collection.
 */
 static void finishgencycle (lua_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
-  g->gcstate = GCSpropagate;  /* skip restart */
-  if (!g->gcemergency)
+  setgcstate(g, GCSpropagate);  /* skip restart */
+  if (!g->gcemergency) {
     callallpendingfinalizers(L);
+    chargetime(g, LUA_GCPHCALLFIN);  /* not part of the new cycle */
+  }
 }
 
 
@@ -1308,6 +2463,7 @@ static void minor2inc (lua_State *L, global_State *g, lu_byte kind) {
   g->gckind = kind;
   g->reallyold = g->old1 = g->survival = NULL;
   g->finobjrold = g->finobjold1 = g->finobjsur = NULL;
+  g->nremset = g->nremold = 0;  /* remembered set is useless now */
   entersweep(L);  /* continue as an incremental cycle */
   /* set a debt equal to the step size */
   luaE_setdebt(g, applygcparam(g, STEPSIZE, 100));
@@ -1338,17 +2494,21 @@ static void youngcollection (lua_State *L, global_State *g) {
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
   lua_assert(g->gcstate == GCSpropagate);
+  g->gccycle++;
   if (g->firstold1) {  /* are there regular OLD1 objects? */
     markold(g, g->firstold1, g->reallyold);  /* mark them */
     g->firstold1 = NULL;  /* no more OLD1 objects (for now) */
   }
   markold(g, g->finobj, g->finobjrold);
   markold(g, g->tobefnz, NULL);
+  markremset(g);
 
   atomic(L);  /* will lose 'g->marked' */
+  g->gcstats.marked -= marked;  /* count only this collection */
 
   /* sweep nursery and get a pointer to its last live element */
-  g->gcstate = GCSswpallgc;
+  setgcstate(g, GCSswpallgc);
+  deferfrees(g);
   psurvival = sweepgen(L, g, &g->allgc, g->survival, &g->firstold1, &addedold1);
   /* sweep 'survival' */
   sweepgen(L, g, psurvival, g->old1, &g->firstold1, &addedold1);
@@ -1366,9 +2526,11 @@ static void youngcollection (lua_State *L, global_State *g) {
   g->finobjsur = g->finobj;  /* all news are survivals */
 
   sweepgen(L, g, &g->tobefnz, NULL, &dummy, &addedold1);
+  handblocks(g);
 
   /* keep total number of added old1 bytes */
   g->GCmarked = marked + addedold1;
+  endcycle(g);
 
   /* decide whether to shift to major mode */
   if (checkminormajor(g)) {
@@ -1389,21 +2551,25 @@ static void youngcollection (lua_State *L, global_State *g) {
 static void atomic2gen (lua_State *L, global_State *g) {
   cleargraylists(g);
   /* sweep all elements making them old */
-  g->gcstate = GCSswpallgc;
+  setgcstate(g, GCSswpallgc);
+  deferfrees(g);
   sweep2old(L, &g->allgc);
   /* everything alive now is old */
   g->reallyold = g->old1 = g->survival = g->allgc;
   g->firstold1 = NULL;  /* there are no OLD1 objects anywhere */
+  g->nremset = g->nremold = 0;  /* nor young objects in old tables */
 
   /* repeat for 'finobj' lists */
   sweep2old(L, &g->finobj);
   g->finobjrold = g->finobjold1 = g->finobjsur = g->finobj;
 
   sweep2old(L, &g->tobefnz);
+  handblocks(g);
 
   g->gckind = KGC_GENMINOR;
   g->GCmajorminor = g->GCmarked;  /* "base" for number of bytes */
   g->GCmarked = 0;  /* to count the number of added old1 bytes */
+  endcycle(g);
   finishgencycle(L, g);
 }
 
@@ -1442,12 +2608,14 @@ void luaC_changemode (lua_State *L, int newmode) {
   if (g->gckind == KGC_GENMAJOR)  /* doing major collections? */
     g->gckind = KGC_INC;  /* already incremental but in name */
   if (newmode != g->gckind) {  /* does it need to change? */
+    lua_Unsigned start = startwork(g);
     if (newmode == KGC_INC)  /* entering incremental mode? */
       minor2inc(L, g, KGC_INC);  /* entering incremental mode */
     else {
       lua_assert(newmode == KGC_GENMINOR);
       entergen(L, g);
     }
+    endwork(g, start, 1);
   }
 }
 
@@ -1503,7 +2671,7 @@ static int checkmajorminor (lua_State *L, global_State *g) {
 */
 static void entersweep (lua_State *L) {
   global_State *g = G(L);
-  g->gcstate = GCSswpallgc;
+  setgcstate(g, GCSswpallgc);
   lua_assert(g->sweepgc == NULL);
   g->sweepgc = sweeptolive(L, &g->allgc);
 }
@@ -1529,6 +2697,8 @@ static void deletelist (lua_State *L, GCObject *p, GCObject *limit) {
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
   g->gcstp = GCSTPCLS;  /* no extra finalizers after here */
+  luaC_setworkers(L, 1);  /* no more helper threads */
+  luaC_setsweeper(L, 0);
   luaC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
@@ -1540,6 +2710,27 @@ void luaC_freeallobjects (lua_State *L) {
 }
 
 
+/*
+** Traverse the list of views with large parents that were unmarked
+** when the views were marked. Parents still unmarked are reachable
+** only through views, so compact these views. Otherwise (or if the
+** compaction fails), mark the parent.
+*/
+static void checkviews (lua_State *L, global_State *g) {
+  TString *ts = g->views;
+  g->views = NULL;
+  while (ts != NULL) {
+    TString *next = ts->f.vnext;
+    if (isviewstr(ts)) {  /* still a view? (could have been sealed) */
+      TString *p = gparent(ts);
+      if (!iswhite(p) || g->gcemergency || !luaS_compactview(L, ts))
+        markobject(g, p);
+    }
+    ts = next;
+  }
+}
+
+
 static void atomic (lua_State *L) {
   global_State *g = G(L);
   GCObject *origweak, *origall;
@@ -1547,7 +2738,7 @@ static void atomic (lua_State *L) {
   g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(mainthread(g)));
-  g->gcstate = GCSatomic;
+  setgcstate(g, GCSatomic);
   markobject(g, L);  /* mark running thread */
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
@@ -1558,7 +2749,7 @@ static void atomic (lua_State *L) {
   propagateall(g);  /* propagate changes */
   g->gray = grayagain;
   propagateall(g);  /* traverse 'grayagain' list */
-  convergeephemerons(g);
+  convergeephemerons(L);
   /* at this point, all strongly accessible objects are marked. */
   /* Clear values from weak tables, before checking finalizers */
   clearbyvalues(g, g->weak, NULL);
@@ -1567,7 +2758,7 @@ static void atomic (lua_State *L) {
   separatetobefnz(g, 0);  /* separate objects to be finalized */
   markbeingfnz(g);  /* mark objects that will be finalized */
   propagateall(g);  /* remark, to propagate 'resurrection' */
-  convergeephemerons(g);
+  convergeephemerons(L);
   /* at this point, all resurrected objects are marked. */
   /* remove dead objects from weak tables */
   clearbykeys(g, g->ephemeron);  /* clear keys from all ephemeron */
@@ -1575,8 +2766,10 @@ static void atomic (lua_State *L) {
   /* clear values from resurrected weak tables */
   clearbyvalues(g, g->weak, origweak);
   clearbyvalues(g, g->allweak, origall);
+  checkviews(L, g);
   luaS_clearcache(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
+  g->gcstats.marked = g->GCmarked;
   lua_assert(g->gray == NULL);
 }
 
@@ -1587,10 +2780,14 @@ static void atomic (lua_State *L) {
 */
 static void sweepstep (lua_State *L, global_State *g,
                        lu_byte nextstate, GCObject **nextlist, int fast) {
-  if (g->sweepgc)
+  if (g->sweepgc) {
+    deferfrees(g);
     g->sweepgc = sweeplist(L, g->sweepgc, fast ? MAX_LMEM : GCSWEEPMAX);
+    luaS_movestrtab(L, fast ? INT_MAX : GCSWEEPMAX);  /* help resizing */
+    handblocks(g);
+  }
   else {  /* enter next state */
-    g->gcstate = nextstate;
+    setgcstate(g, nextstate);
     g->sweepgc = nextlist;
   }
 }
@@ -1622,13 +2819,13 @@ static l_mem singlestep (lua_State *L, int fast) {
   switch (g->gcstate) {
     case GCSpause: {
       restartcollection(g);
-      g->gcstate = GCSpropagate;
+      setgcstate(g, GCSpropagate);
       stepresult = 1;
       break;
     }
     case GCSpropagate: {
       if (fast || g->gray == NULL) {
-        g->gcstate = GCSenteratomic;  /* finish propagate phase */
+        setgcstate(g, GCSenteratomic);  /* finish propagate phase */
         stepresult = 1;
       }
       else
@@ -1662,7 +2859,7 @@ static l_mem singlestep (lua_State *L, int fast) {
     }
     case GCSswpend: {  /* finish sweeps */
       checkSizes(L, g);
-      g->gcstate = GCScallfin;
+      setgcstate(g, GCScallfin);
       stepresult = GCSWEEPMAX;
       break;
     }
@@ -1673,7 +2870,8 @@ static l_mem singlestep (lua_State *L, int fast) {
         stepresult = CWUFIN;
       }
       else {  /* emergency mode or no more finalizers */
-        g->gcstate = GCSpause;  /* finish collection */
+        setgcstate(g, GCSpause);  /* finish collection */
+        endcycle(g);
         stepresult = step2pause;
       }
       break;
@@ -1699,27 +2897,228 @@ void luaC_runtilstate (lua_State *L, int state, int fast) {
 
 
 
+/*
+** Clock for time-budgeted steps, in microseconds. It uses a monotonic
+** clock when available; otherwise, it uses the processor time given
+** by ISO C 'clock'.
+*/
+#if !defined(luai_gcclock)
+
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+
+static lua_Unsigned monoclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lua_Unsigned, ts.tv_sec) * 1000000u +
+         cast(lua_Unsigned, ts.tv_nsec / 1000);
+}
+
+#define luai_gcclock()		monoclock()
+
+#else
+
+#define luai_gcclock()  \
+	cast(lua_Unsigned, cast(double, clock()) * 1e6 / CLOCKS_PER_SEC)
+
+#endif
+
+#endif
+
+
+/*
+** Number of units of work between readings of the clock in
+** time-budgeted steps. (Single steps are too small to read the clock
+** after each one.)
+*/
+#if !defined(LUAI_GCCLOCKWORK)
+#define LUAI_GCCLOCKWORK	1000
+#endif
+
+
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+/*
+** While the collector does some work for the program (see 'startwork'),
+** each change of state charges the time since the previous reading of
+** the clock to the phase of the state being left. Outside that work,
+** changes of state do not read the clock.
+*/
+
+/* phase of the collector charged for the time spent in a state */
+static int statephase (lu_byte state) {
+  if (state == GCSatomic)
+    return LUA_GCPHATOMIC;
+  else if (GCSswpallgc <= state && state <= GCSswpend)
+    return LUA_GCPHSWEEP;
+  else if (state == GCScallfin)
+    return LUA_GCPHCALLFIN;
+  else  /* GCSpropagate, GCSenteratomic, or GCSpause */
+    return LUA_GCPHPROPAGATE;
+}
+
+
+static void chargetime (global_State *g, int phase) {
+  GCStats *st = &g->gcstats;
+  if (st->timing) {
+    lua_Unsigned now = luai_gcclock();
+    st->time[phase] += now - st->last;
+    st->last = now;
+  }
+}
+
+
+static void setgcstate (global_State *g, lu_byte state) {
+  chargetime(g, statephase(g->gcstate));
+  g->gcstate = state;
+}
+
+
+/* a cycle (or a young collection) finished; close its counters */
+static void endcycle (global_State *g) {
+  GCStats *st = &g->gcstats;
+  st->cycles++;
+  st->freed = st->freeing;
+  st->freeing = 0;
+}
+
+
+/*
+** Start timing some work of the collector. (There is no nesting: an
+** emergency collection inside a finalizer restarts the timing, and
+** the time of the outer work before it is lost. This keeps the timing
+** consistent even when an error interrupts the work.)
+*/
+static lua_Unsigned startwork (global_State *g) {
+  GCStats *st = &g->gcstats;
+  st->last = luai_gcclock();
+  st->timing = 1;
+  return st->last;
+}
+
+
+/*
+** Finish timing some work started at 'start'. If 'pause', count that
+** work in the histogram of pauses, where bucket 'i' counts the pauses
+** from 2^i up to 2^(i+1) microseconds. (The first bucket also counts
+** shorter pauses and the last one counts all longer pauses.)
+*/
+static void endwork (global_State *g, lua_Unsigned start, int pause) {
+  GCStats *st = &g->gcstats;
+  chargetime(g, statephase(g->gcstate));
+  st->timing = 0;
+  if (pause) {
+    lua_Unsigned usec = st->last - start;
+    int i;
+    if (usec == 0)
+      i = 0;
+    else if (usec >= (cast(lua_Unsigned, 1) << (LUA_GCNPAUSES - 1)))
+      i = LUA_GCNPAUSES - 1;
+    else
+      i = luaO_ceillog2(cast_uint(usec) + 1) - 1;
+    st->pauses[i]++;
+  }
+}
+
+
+static void countlist (global_State *g, GCObject *o, lua_GCStats *s) {
+  for (; o != NULL; o = o->next) {
+    if (!isdead(g, o)) {
+      int t = novariant(o->tt);
+      if (t > LUA_NUMTYPES)  /* internal type? */
+        t = LUA_NUMTYPES;  /* count it as "other" */
+      s->count[t]++;
+      s->bytes[t] += cast_sizet(objsize(o));
+    }
+  }
+}
+
+
+/*
+** Fill 's' with the statistics of the collector. The composition of
+** the heap is computed here, by a walk over all objects, so that the
+** collector pays nothing for it when nobody asks.
+*/
+void luaC_getstats (lua_State *L, lua_GCStats *s) {
+  global_State *g = G(L);
+  GCStats *st = &g->gcstats;
+  int i;
+  s->cycles = st->cycles;
+  for (i = 0; i < LUA_GCPHN; i++)
+    s->time[i] = st->time[i];
+  for (i = 0; i < LUA_GCNPAUSES; i++)
+    s->pauses[i] = st->pauses[i];
+  s->marked = cast_sizet(st->marked);
+  s->freed = cast_sizet(st->freed);
+  for (i = 0; i <= LUA_NUMTYPES; i++)
+    s->count[i] = s->bytes[i] = 0;
+  countlist(g, g->allgc, s);
+  countlist(g, g->finobj, s);
+  countlist(g, g->tobefnz, s);
+  countlist(g, g->fixedgc, s);
+}
+
+/* }====================================================== */
+
+
+/*
+** Runs single steps until 'usec' microseconds have passed or the
+** cycle ends. Returns the result of the last single step. (The atomic
+** step cannot be interrupted, so the clock is always read after it.)
+*/
+static l_mem runfor (lua_State *L, l_mem usec) {
+  lua_Unsigned start = luai_gcclock();
+  l_mem work = 0;  /* work done since last reading of the clock */
+  l_mem stres;
+  for (;;) {
+    stres = singlestep(L, 0);
+    if (stres == step2minor || stres == step2pause)
+      break;  /* end of cycle */
+    work += (stres == atomicstep) ? LUAI_GCCLOCKWORK : stres;
+    if (work >= LUAI_GCCLOCKWORK) {
+      if (luai_gcclock() - start >= cast(lua_Unsigned, usec))
+        break;  /* no more time */
+      work = 0;
+    }
+  }
+  return stres;
+}
+
+
 /*
 ** Performs a basic incremental step. The step size is
 ** converted from bytes to "units of work"; then the function loops
 ** running single steps until adding that many units of work or
-** finishing a cycle (pause state). Finally, it sets the debt that
-** controls when next step will be performed.
+** finishing a cycle (pause state). If the collector has a time budget
+** for each step, the loop runs until that time ends, instead.
+** Finally, it sets the debt that controls when next step will be
+** performed.
 */
 static void incstep (lua_State *L, global_State *g) {
   l_mem stepsize = applygcparam(g, STEPSIZE, 100);
-  l_mem work2do = applygcparam(g, STEPMUL, stepsize / cast_int(sizeof(void*)));
-  l_mem stres;
-  int fast = (work2do == 0);  /* special case: do a full collection */
-  do {  /* repeat until enough work */
-    stres = singlestep(L, fast);  /* perform one single step */
-    if (stres == step2minor)  /* returned to minor collections? */
+  l_mem steptime = g->gcsteptime;
+  if (steptime > 0) {  /* time-budgeted step? */
+    if (runfor(L, steptime) == step2minor)  /* returned to minor mode? */
       return;  /* nothing else to be done here */
-    else if (stres == step2pause || (stres == atomicstep && !fast))
-      break;  /* end of cycle or atomic */
-    else
-      work2do -= stres;
-  } while (fast || work2do > 0);
+  }
+  else {
+    l_mem work2do = applygcparam(g, STEPMUL,
+                                 stepsize / cast_int(sizeof(void*)));
+    l_mem stres;
+    int fast = (work2do == 0);  /* special case: do a full collection */
+    do {  /* repeat until enough work */
+      stres = singlestep(L, fast);  /* perform one single step */
+      if (stres == step2minor)  /* returned to minor collections? */
+        return;  /* nothing else to be done here */
+      else if (stres == step2pause || (stres == atomicstep && !fast))
+        break;  /* end of cycle or atomic */
+      else
+        work2do -= stres;
+    } while (fast || work2do > 0);
+  }
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
   else
@@ -1731,6 +3130,265 @@ static void incstep (lua_State *L, global_State *g) {
 #define luai_tracegc(L,f)		((void)0)
 #endif
 
+static void gcstep (lua_State *L, global_State *g) {
+  switch (g->gckind) {
+    case KGC_INC: case KGC_GENMAJOR:
+      incstep(L, g);
+      break;
+    case KGC_GENMINOR:
+      youngcollection(L, g);
+      setminordebt(g);
+      break;
+  }
+}
+
+
+/*
+** {======================================================
+** Adaptive mode
+** =======================================================
+*/
+
+/*
+** In adaptive mode, each GC step is timed. After each collection
+** cycle (each minor collection, in minor mode) that ends at least
+** LUAI_ADAPTWINDOW microseconds after the last decision, the
+** controller looks at that "window" and adjusts the collector to the
+** targets: the longest step ('targetpause') and the percentage of time
+** spent in the collector ('maxoverhead').
+** - In minor mode, a high survival rate of young objects (more than
+** LUAI_ADAPTSURVIVAL% of the bytes allocated between minor collections)
+** means that generational mode does not pay off, so the collector goes
+** to incremental mode. Too long minor collections make it decrease the
+** minor multiplier (smaller nurseries) or, if that is already at its
+** minimum, go to incremental mode. Too much time in the collector
+** (with short steps) makes it increase the minor multiplier.
+** - In incremental mode and in major collections, the overhead
+** controls the pause (more memory for less time in the collector)
+** and the longest step controls the step multiplier. After
+** LUAI_ADAPTPROBE windows in incremental mode, the collector tries
+** generational mode again, by doing major collections, which go to
+** minor mode when they collect enough garbage (see 'checkmajorminor').
+** Each decision is reported through the warning system.
+*/
+
+#if !defined(LUAI_ADAPTWINDOW)
+#define LUAI_ADAPTWINDOW	20000
+#endif
+
+#if !defined(LUAI_ADAPTSURVIVAL)
+#define LUAI_ADAPTSURVIVAL	50
+#endif
+
+#if !defined(LUAI_ADAPTPROBE)
+#define LUAI_ADAPTPROBE		16
+#endif
+
+/* limits for the parameters changed by the controller */
+#define MINMINORMUL	5
+#define MAXMINORMUL	100
+#define MINPAUSE	120
+#define MAXPAUSE	1000
+#define MINSTEPMUL	100
+#define MAXSTEPMUL	LUAI_GCMUL
+
+
+/*
+** Reports a decision as "adaptive GC: <what> [<value>] (<why> <n><unit>)".
+** A negative 'value' is omitted.
+*/
+static void warnint (lua_State *L, lua_Integer i) {
+  char buff[LUA_N2SBUFFSZ];
+  TValue v;
+  setivalue(&v, i);
+  buff[luaO_tostringbuff(&v, buff)] = '\0';
+  luaE_warning(L, buff, 1);
+}
+
+
+static void adaptwarn (lua_State *L, const char *what, int value,
+                       const char *why, lua_Unsigned n, const char *unit) {
+  luaE_warning(L, "adaptive GC: ", 1);
+  luaE_warning(L, what, 1);
+  if (value >= 0) {
+    luaE_warning(L, " ", 1);
+    warnint(L, value);
+  }
+  luaE_warning(L, " (", 1);
+  luaE_warning(L, why, 1);
+  luaE_warning(L, " ", 1);
+  warnint(L, l_castU2S(n));
+  luaE_warning(L, unit, 1);
+  luaE_warning(L, ")", 0);
+}
+
+
+/*
+** Changes parameter 'p' to 'v', inside the limits. Returns the new
+** value, or -1 if it did not change.
+*/
+static int adaptparam (global_State *g, int p, int v, int min, int max) {
+  int old = cast_int(luaO_applyparam(g->gcparams[p], 100));
+  if (v < min) v = min;
+  else if (v > max) v = max;
+  if (v == old)
+    return -1;
+  g->gcparams[p] = luaO_codeparam(cast_uint(v));
+  return v;
+}
+
+
+static void resetwindow (global_State *g) {
+  GCAdapt *ad = &g->gcadapt;
+  ad->start = luai_gcclock();
+  ad->gctime = ad->maxpause = 0;
+  ad->minoralloc = ad->minorfreed = 0;
+  ad->cycle = g->gccycle;
+}
+
+
+/*
+** Leaves minor collections for the incremental mode, right after a
+** young collection. As in 'youngcollection', 'GCmarked' (which counts
+** added old bytes in minor mode) must not set the first pause.
+*/
+static void adapt2inc (lua_State *L, global_State *g) {
+  g->gcadapt.nwindows = 0;
+  minor2inc(L, g, KGC_INC);
+  g->GCmarked = 0;
+}
+
+
+static void adaptminor (lua_State *L, global_State *g, lua_Unsigned pause,
+                        lua_Unsigned overhead) {
+  GCAdapt *ad = &g->gcadapt;
+  lua_Unsigned target = cast(lua_Unsigned, ad->targetpause);
+  int mul = cast_int(applygcparam(g, MINORMUL, 100));
+  int v;
+  if (ad->minoralloc > 0) {
+    l_mem survived = ad->minoralloc - ad->minorfreed;
+    lua_Unsigned survival = (survived <= 0) ? 0
+               : cast(lua_Unsigned, survived * 100 / ad->minoralloc);
+    if (survival > LUAI_ADAPTSURVIVAL) {  /* objects do not die young? */
+      adaptwarn(L, "incremental mode", -1, "survival", survival, "%");
+      adapt2inc(L, g);
+      return;
+    }
+  }
+  if (pause > target) {  /* minor collections too long? */
+    if ((v = adaptparam(g, LUA_GCPMINORMUL, mul * 3 / 4,
+                        MINMINORMUL, MAXMINORMUL)) >= 0)
+      adaptwarn(L, "minormul", v, "pause", pause, "us");
+    else {  /* nursery cannot be smaller */
+      adaptwarn(L, "incremental mode", -1, "pause", pause, "us");
+      adapt2inc(L, g);
+    }
+  }
+  else if (overhead > cast(lua_Unsigned, ad->maxoverhead) &&
+           pause < target / 2) {
+    if ((v = adaptparam(g, LUA_GCPMINORMUL, mul * 5 / 4,
+                        MINMINORMUL, MAXMINORMUL)) >= 0)
+      adaptwarn(L, "minormul", v, "overhead", overhead, "%");
+  }
+}
+
+
+static void adaptinc (lua_State *L, global_State *g, lua_Unsigned pause,
+                      lua_Unsigned overhead) {
+  GCAdapt *ad = &g->gcadapt;
+  lua_Unsigned target = cast(lua_Unsigned, ad->targetpause);
+  lua_Unsigned maxover = cast(lua_Unsigned, ad->maxoverhead);
+  int gcpause = cast_int(applygcparam(g, PAUSE, 100));
+  int stepmul = cast_int(applygcparam(g, STEPMUL, 100));
+  int v;
+  if (overhead > maxover) {  /* too much time in the collector? */
+    if ((v = adaptparam(g, LUA_GCPPAUSE, gcpause * 5 / 4,
+                        MINPAUSE, MAXPAUSE)) >= 0)
+      adaptwarn(L, "pause", v, "overhead", overhead, "%");
+  }
+  else if (overhead < maxover / 2) {  /* can use less memory? */
+    if ((v = adaptparam(g, LUA_GCPPAUSE, gcpause * 4 / 5,
+                        MINPAUSE, MAXPAUSE)) >= 0)
+      adaptwarn(L, "pause", v, "overhead", overhead, "%");
+  }
+  if (pause > target) {  /* steps too long? */
+    if ((v = adaptparam(g, LUA_GCPSTEPMUL, stepmul * 3 / 4,
+                        MINSTEPMUL, MAXSTEPMUL)) >= 0)
+      adaptwarn(L, "stepmul", v, "pause", pause, "us");
+  }
+  else if (pause < target / 4) {  /* steps can do more work? */
+    if ((v = adaptparam(g, LUA_GCPSTEPMUL, stepmul * 5 / 4,
+                        MINSTEPMUL, MAXSTEPMUL)) >= 0)
+      adaptwarn(L, "stepmul", v, "pause", pause, "us");
+  }
+  if (g->gckind == KGC_INC && ++ad->nwindows >= LUAI_ADAPTPROBE) {
+    ad->nwindows = 0;
+    adaptwarn(L, "trying generational mode", -1, "overhead", overhead, "%");
+    g->gckind = KGC_GENMAJOR;  /* next atomic phases may go to minor mode */
+  }
+}
+
+
+/*
+** Performs a GC step timing it and, at the end of a window, adjusts
+** the collector. Steps of incremental cycles that do the atomic phase
+** do not count as pauses, as the parameters cannot shorten them.
+** (Warnings are issued only after the step, when the collector is not
+** in the middle of anything.)
+*/
+static void adaptstep (lua_State *L, global_State *g) {
+  GCAdapt *ad = &g->gcadapt;
+  int minor = (g->gckind == KGC_GENMINOR);
+  int marking = (!minor && g->gcstate <= GCSenteratomic);
+  int didatomic;
+  l_mem before = gettotalbytes(g);
+  lua_Unsigned start = luai_gcclock();
+  lua_Unsigned now;
+  gcstep(L, g);
+  now = luai_gcclock();
+  ad->gctime += now - start;
+  didatomic = marking &&
+              (g->gcstate > GCSatomic || g->gckind == KGC_GENMINOR);
+  if (!didatomic && now - start > ad->maxpause)
+    ad->maxpause = now - start;
+  if (minor && before > ad->base) {  /* measure survival of young bytes */
+    l_mem after = gettotalbytes(g);
+    ad->minoralloc += before - ad->base;
+    if (before > after)
+      ad->minorfreed += before - after;
+  }
+  ad->base = gettotalbytes(g);
+  if (g->gccycle != ad->cycle && now - ad->start >= LUAI_ADAPTWINDOW) {
+    lua_Unsigned elapsed = now - ad->start;
+    lua_Unsigned overhead = (elapsed == 0) ? 0 : ad->gctime * 100 / elapsed;
+    if (g->gckind == KGC_GENMINOR)
+      adaptminor(L, g, ad->maxpause, overhead);
+    else
+      adaptinc(L, g, ad->maxpause, overhead);
+    resetwindow(g);
+  }
+}
+
+
+/*
+** Puts the collector in adaptive mode, with the given targets (or the
+** default ones, for non-positive values). The collector continues in
+** its current mode.
+*/
+void luaC_adaptive (lua_State *L, int pause, int overhead) {
+  global_State *g = G(L);
+  GCAdapt *ad = &g->gcadapt;
+  ad->targetpause = (pause > 0) ? pause : LUAI_ADAPTPAUSE;
+  ad->maxoverhead = (overhead > 0) ? overhead : LUAI_ADAPTOVERHEAD;
+  ad->nwindows = 0;
+  ad->base = gettotalbytes(g);
+  ad->on = 1;
+  resetwindow(g);
+}
+
+/* }====================================================== */
+
+
 /*
 ** Performs a basic GC step if collector is running. (If collector was
 ** stopped by the user, set a reasonable debt to avoid it being called
@@ -1744,18 +3402,51 @@ void luaC_step (lua_State *L) {
       luaE_setdebt(g, 20000);
   }
   else {
+    lua_Unsigned start = startwork(g);
     luai_tracegc(L, 1);  /* for internal debugging */
-    switch (g->gckind) {
-      case KGC_INC: case KGC_GENMAJOR:
-        incstep(L, g);
-        break;
-      case KGC_GENMINOR:
-        youngcollection(L, g);
-        setminordebt(g);
-        break;
-    }
+    if (g->gcadapt.on)
+      adaptstep(L, g);
+    else
+      gcstep(L, g);
     luai_tracegc(L, 0);  /* for internal debugging */
+    endwork(g, start, 1);
+  }
+}
+
+
+/*
+** Gives 'usec' microseconds of idle time to the collector. In
+** incremental mode (and in major collections), runs single steps until
+** that time ends or the cycle finishes; a paused collector starts a new
+** cycle. In minor mode, does a minor collection (these collections are
+** not incremental). Returns true if it finished a cycle.
+*/
+int luaC_idle (lua_State *L, int usec) {
+  global_State *g = G(L);
+  int res = 0;
+  lua_Unsigned start;
+  if (!gcrunning(g) || usec <= 0)
+    return 0;
+  start = startwork(g);
+  switch (g->gckind) {
+    case KGC_INC: case KGC_GENMAJOR: {
+      l_mem stres = runfor(L, usec);
+      if (stres == step2pause) {  /* finished a cycle? */
+        setpause(g);
+        res = 1;
+      }
+      else if (stres == step2minor)  /* finished a major collection? */
+        res = 1;
+      break;
+    }
+    case KGC_GENMINOR: {
+      youngcollection(L, g);
+      setminordebt(g);
+      break;
+    }
   }
+  endwork(g, start, 0);  /* time given by the program is not a pause */
+  return res;
 }
 
 
@@ -1784,6 +3475,7 @@ static void fullinc (lua_State *L, global_State *g) {
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
+  lua_Unsigned start = startwork(g);
   lua_assert(!g->gcemergency);
   g->gcemergency = cast_byte(isemergency);  /* set flag */
   switch (g->gckind) {
@@ -1795,7 +3487,9 @@ void luaC_fullgc (lua_State *L, int isemergency) {
       g->gckind = KGC_GENMAJOR;
       break;
   }
+  waitsweeper(g);  /* all dead objects must be really freed */
   g->gcemergency = 0;
+  endwork(g, start, 1);
 }
 
 /* }====================================================== */
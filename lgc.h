@@ -200,6 +200,51 @@
 /* How many bytes to allocate before next GC step */
 #define LUAI_GCSTEPSIZE	(200 * sizeof(Table))
 
+/*
+** Time budget (in microseconds) of each GC step; 0 means that steps
+** are measured in units of work (see LUAI_GCMUL)
+*/
+#define LUAI_GCSTEPTIME	0
+
+
+/* adaptive */
+
+/* Default target for the longest GC step, in microseconds */
+#define LUAI_ADAPTPAUSE		1000
+
+/* Default maximum percentage of time spent in the collector */
+#define LUAI_ADAPTOVERHEAD	10
+
+
+/*
+** Parallel marking (see lgc.c) needs POSIX threads and the atomic
+** builtins of gcc (or compatible compilers).
+*/
+#if defined(LUA_USE_PARALLELGC)
+#if !defined(LUA_USE_POSIX) || !defined(__GNUC__)
+#undef LUA_USE_PARALLELGC
+#endif
+#endif
+
+/* Maximum number of threads marking objects in parallel */
+#if !defined(LUAI_MAXGCWORKERS)
+#define LUAI_MAXGCWORKERS	64
+#endif
+
+
+/*
+** A block of memory of a dead object, waiting to be freed by the
+** background sweeper. (The list of these blocks lives in the blocks
+** themselves.)
+*/
+typedef struct DeadBlock {
+  struct DeadBlock *next;
+  size_t size;
+} DeadBlock;
+
+/* check whether the release of a block of size 's' can be deferred */
+#define luaC_candefer(g,s)	((g)->gcdefer && (s) >= sizeof(DeadBlock))
+
 
 #define setgcparam(g,p,v)  (g->gcparams[LUA_GCP##p] = luaO_codeparam(v))
 #define applygcparam(g,p,x)  luaO_applyparam(g->gcparams[LUA_GCP##p], x)
@@ -246,23 +291,33 @@
 	iscollectable(v) ? luaC_objbarrier(L,p,gcvalue(v)) : cast_void(0))
 
 #define luaC_objbarrierback(L,p,o) (  \
-	(isblack(p) && iswhite(o)) ? luaC_barrierback_(L,p) : cast_void(0))
+	(isblack(p) && iswhite(o)) ? \
+	luaC_barrierback_(L,p,obj2gco(o)) : cast_void(0))
 
 #define luaC_barrierback(L,p,v) (  \
 	iscollectable(v) ? luaC_objbarrierback(L, p, gcvalue(v)) : cast_void(0))
 
+#define luaC_touch(L,p)  \
+	(isblack(p) ? luaC_touch_(L,obj2gco(p)) : cast_void(0))
+
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
+LUAI_FUNC int luaC_idle (lua_State *L, int usec);
+LUAI_FUNC void luaC_adaptive (lua_State *L, int pause, int overhead);
+LUAI_FUNC void luaC_getstats (lua_State *L, lua_GCStats *s);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int state, int fast);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, lu_byte tt, size_t sz);
 LUAI_FUNC GCObject *luaC_newobjdt (lua_State *L, lu_byte tt, size_t sz,
                                                  size_t offset);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
-LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
+LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o, GCObject *v);
+LUAI_FUNC void luaC_touch_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC int luaC_setworkers (lua_State *L, int n);
+LUAI_FUNC void luaC_setsweeper (lua_State *L, int on);
 
 
 #endif
@@ -0,0 +1,697 @@
+/*
+** $Id: ljit.c $
+** Baseline JIT compiler
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ljit.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+
+
+#if defined(LUA_USE_JIT)
+
+#include <sys/mman.h>
+
+
+/*
+** The baseline compiler translates each instruction of a hot function
+** into a fixed template of x86-64 machine code. Templates handle only
+** the common cases (e.g., arithmetic over two integers or two floats);
+** in all other cases, the native code "exits", returning to the
+** interpreter the index of the instruction it could not handle, so
+** that the interpreter can resume from there. Instructions without a
+** template always exit. The native code never calls other functions,
+** never allocates memory, and never raises errors; so, it does not
+** need to keep 'savedpc' nor 'L->top'. A backward jump also exits
+** when there are hooks (or a signal), to let the interpreter handle
+** them.
+**
+** Register usage in native code: 'rbx' holds 'base', 'rbp' holds 'k',
+** and 'r13' holds 'L'; 'rax', 'rcx', 'xmm0', and 'xmm1' are scratch.
+*/
+
+
+/*
+** Native code of a function. 'pos' has two arrays with one element
+** per instruction: the entry point for the instruction (0 if the
+** instruction has no template) and its position in the code.
+*/
+typedef struct JitCode {
+  lu_byte *mcode;  /* machine code (NULL if compilation failed) */
+  size_t size;  /* size of 'mcode' */
+  unsigned int pos[1];  /* entries and labels */
+} JitCode;
+
+#define sizejitcode(n)  \
+	(offsetof(JitCode, pos) + 2 * cast_sizet(n) * sizeof(unsigned int))
+
+
+/*
+** Signature of the native code: 'start' is the entry point where the
+** execution must start. Returns the index of the instruction where
+** the interpreter must continue.
+*/
+typedef int (*JitFunction) (lua_State *L, StkId base, const TValue *k,
+                            const lu_byte *start);
+
+
+typedef struct JitState {
+  lu_byte *code;  /* buffer for the code (NULL while measuring it) */
+  unsigned int pos;  /* current position in the code */
+  unsigned int *entry;  /* entry point for each instruction */
+  unsigned int *label;  /* position of the code for each instruction */
+  unsigned int epilogue;  /* position of the epilogue */
+  unsigned int exits;  /* position of the exit for the first instruction */
+} JitState;
+
+
+/* registers */
+#define RAX	0
+#define RCX	1
+#define RBX	3
+#define RBP	5
+#define R13	5	/* (needs a REX.B prefix) */
+#define XMM0	0
+#define XMM1	1
+
+/* condition codes (a code XOR 1 gives its negation) */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+
+/* displacements for the value and the tag of registers and constants */
+#define regval(r)	cast_int(cast_sizet(r) * sizeof(StackValue))
+#define regtag(r)	(regval(r) + cast_int(offsetof(TValue, tt_)))
+#define kval(c)		cast_int(cast_sizet(c) * sizeof(TValue))
+#define ktag(c)		(kval(c) + cast_int(offsetof(TValue, tt_)))
+
+
+/* size of each exit: 'mov eax, imm32' plus 'jmp rel32' */
+#define EXITSIZE	10
+
+#define label(J,pc)	((J)->label[pc])
+#define exitpos(J,pc)	((J)->exits + EXITSIZE * cast_uint(pc))
+
+
+/* kinds of the second operand of arithmetic and comparisons */
+#define OPREG	0	/* register */
+#define OPK	1	/* constant */
+#define OPIMM	2	/* immediate integer */
+
+
+/*
+** {======================================================
+** Machine-code emission
+** =======================================================
+*/
+
+static void emitbyte (JitState *J, unsigned int b) {
+  if (J->code != NULL)
+    J->code[J->pos] = cast_byte(b & 0xffu);
+  J->pos++;
+}
+
+
+static void emitbytes (JitState *J, const char *s, int n) {
+  int i;
+  for (i = 0; i < n; i++)
+    emitbyte(J, cast_uint(cast_byte(s[i])));
+}
+
+
+static void emitint (JitState *J, unsigned int v) {
+  int i;
+  for (i = 0; i < 4; i++) {  /* little endian */
+    emitbyte(J, v);
+    v >>= 8;
+  }
+}
+
+
+/* relative displacement to 'target' from the end of the displacement */
+static void emitrel (JitState *J, unsigned int target) {
+  emitint(J, target - (J->pos + 4));
+}
+
+
+/* ModRM byte plus 32-bit displacement for operand [rm + disp] */
+static void emitmem (JitState *J, int reg, int rm, int disp) {
+  emitbyte(J, cast_uint(0x80 | (reg << 3) | rm));
+  emitint(J, cast_uint(disp));
+}
+
+
+/* mov reg, qword [rm + disp] */
+static void loadq (JitState *J, int reg, int rm, int disp) {
+  emitbytes(J, "\x48\x8B", 2);
+  emitmem(J, reg, rm, disp);
+}
+
+
+/* mov qword [rm + disp], reg */
+static void storeq (JitState *J, int reg, int rm, int disp) {
+  emitbytes(J, "\x48\x89", 2);
+  emitmem(J, reg, rm, disp);
+}
+
+
+/* movzx reg, byte [rm + disp] */
+static void loadb (JitState *J, int reg, int rm, int disp) {
+  emitbytes(J, "\x0F\xB6", 2);
+  emitmem(J, reg, rm, disp);
+}
+
+
+/* mov byte [rm + disp], reg (only 'al' or 'cl') */
+static void storeb (JitState *J, int reg, int rm, int disp) {
+  emitbyte(J, 0x88);
+  emitmem(J, reg, rm, disp);
+}
+
+
+/* mov byte [rbx + disp], imm8 */
+static void storebimm (JitState *J, int disp, int imm) {
+  emitbyte(J, 0xC6);
+  emitmem(J, 0, RBX, disp);
+  emitbyte(J, cast_uint(imm));
+}
+
+
+/* mov qword [rbx + disp], imm32 (sign extended) */
+static void storeqimm (JitState *J, int disp, int imm) {
+  emitbytes(J, "\x48\xC7", 2);
+  emitmem(J, 0, RBX, disp);
+  emitint(J, cast_uint(imm));
+}
+
+
+/* mov rcx, imm32 (sign extended) */
+static void loadrcximm (JitState *J, int imm) {
+  emitbytes(J, "\x48\xC7\xC1", 3);
+  emitint(J, cast_uint(imm));
+}
+
+
+/* cmp byte [rbx + disp], imm8 */
+static void cmptag (JitState *J, int disp, int tag) {
+  emitbyte(J, 0x80);
+  emitmem(J, 7, RBX, disp);
+  emitbyte(J, cast_uint(tag));
+}
+
+
+/* movsd xmm, qword [rm + disp] */
+static void loadsd (JitState *J, int xmm, int rm, int disp) {
+  emitbytes(J, "\xF2\x0F\x10", 3);
+  emitmem(J, xmm, rm, disp);
+}
+
+
+/* movsd qword [rbx + disp], xmm0 */
+static void storesd (JitState *J, int disp) {
+  emitbytes(J, "\xF2\x0F\x11", 3);
+  emitmem(J, XMM0, RBX, disp);
+}
+
+
+/* jmp rel32 */
+static void jump (JitState *J, unsigned int target) {
+  emitbyte(J, 0xE9);
+  emitrel(J, target);
+}
+
+
+/* jcc rel32 */
+static void jumpif (JitState *J, int cc, unsigned int target) {
+  emitbyte(J, 0x0F);
+  emitbyte(J, cast_uint(0x80 | cc));
+  emitrel(J, target);
+}
+
+
+/*
+** Conditional jump to a position not yet known, which must be fixed
+** later by 'patch'. Returns the position to be patched.
+*/
+static unsigned int jumpfwd (JitState *J, int cc) {
+  emitbyte(J, 0x0F);
+  emitbyte(J, cast_uint(0x80 | cc));
+  emitint(J, 0);
+  return J->pos;
+}
+
+
+/* fix jump ending at 'p' to jump to the current position */
+static void patch (JitState *J, unsigned int p) {
+  unsigned int rel = J->pos - p;
+  int i;
+  if (J->code != NULL) {
+    for (i = 0; i < 4; i++) {
+      J->code[p - 4 + cast_uint(i)] = cast_byte(rel & 0xffu);
+      rel >>= 8;
+    }
+  }
+}
+
+
+/* exit if register 'r' does not have type tag 'tag' */
+static void guardtag (JitState *J, int pc, int r, int tag) {
+  cmptag(J, regtag(r), tag);
+  jumpif(J, CC_NE, exitpos(J, pc));
+}
+
+
+/* exit to instruction 'target' if there are hooks (or a signal) */
+static void checkhook (JitState *J, int target) {
+  emitbytes(J, "\x41\x83", 2);  /* cmp dword [r13 + disp], 0 */
+  emitmem(J, 7, R13, cast_int(offsetof(lua_State, hookmask)));
+  emitbyte(J, 0);
+  jumpif(J, CC_NE, exitpos(J, target));
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+/* R[a] := value at [rm + vdisp] with tag at [rm + tdisp] */
+static void copyvalue (JitState *J, int a, int rm, int vdisp, int tdisp) {
+  loadq(J, RAX, rm, vdisp);
+  loadb(J, RCX, rm, tdisp);
+  storeq(J, RAX, RBX, regval(a));
+  storeb(J, RCX, RBX, regtag(a));
+}
+
+
+/* type tag of a second operand known at compile time, or -1 */
+static int optag (Proto *p, int kind, int c) {
+  switch (kind) {
+    case OPK: return ttypetag(&p->k[c]);
+    case OPIMM: return LUA_VNUMINT;
+    default: return -1;  /* unknown */
+  }
+}
+
+
+/* rcx := second operand (an integer) */
+static void loadint2 (JitState *J, int kind, int c) {
+  switch (kind) {
+    case OPREG: loadq(J, RCX, RBX, regval(c)); break;
+    case OPK: loadq(J, RCX, RBP, kval(c)); break;
+    default: loadrcximm(J, c); break;
+  }
+}
+
+
+/* xmm1 := second operand converted to a float */
+static void loadflt2 (JitState *J, Proto *p, int kind, int c) {
+  if (optag(p, kind, c) == LUA_VNUMINT) {
+    loadint2(J, kind, c);
+    emitbytes(J, "\xF2\x48\x0F\x2A\xC9", 5);  /* cvtsi2sd xmm1, rcx */
+  }
+  else
+    loadsd(J, XMM1, (kind == OPK) ? RBP : RBX,
+                    (kind == OPK) ? kval(c) : regval(c));
+}
+
+
+/*
+** Arithmetic: R[a] := R[b] op (second operand). An arithmetic
+** instruction is always followed by an OP_MMBIN* instruction, which
+** a successful operation skips. Integer operations are done only
+** over two integers; float operations are done over a float and a
+** float or, when the second operand is a constant or an immediate,
+** an integer. Everything else exits.
+*/
+static void emitarith (JitState *J, Proto *p, int pc, OpCode op,
+                       int a, int b, int kind, int c) {
+  int tc = optag(p, kind, c);
+  unsigned int notint = 0;
+  if (op != OP_DIV && tc != LUA_VNUMFLT) {  /* integer operation? */
+    cmptag(J, regtag(b), LUA_VNUMINT);
+    notint = jumpfwd(J, CC_NE);
+    if (kind == OPREG)
+      guardtag(J, pc, c, LUA_VNUMINT);
+    loadq(J, RAX, RBX, regval(b));
+    loadint2(J, kind, c);
+    switch (op) {
+      case OP_ADD: emitbytes(J, "\x48\x01\xC8", 3); break;  /* add rax, rcx */
+      case OP_SUB: emitbytes(J, "\x48\x29\xC8", 3); break;  /* sub rax, rcx */
+      default: emitbytes(J, "\x48\x0F\xAF\xC1", 4); break;  /* imul rax, rcx */
+    }
+    storeq(J, RAX, RBX, regval(a));
+    storebimm(J, regtag(a), LUA_VNUMINT);
+    jump(J, label(J, pc + 2));  /* skip OP_MMBIN* */
+    patch(J, notint);
+  }
+  guardtag(J, pc, b, LUA_VNUMFLT);
+  if (kind == OPREG)
+    guardtag(J, pc, c, LUA_VNUMFLT);
+  loadsd(J, XMM0, RBX, regval(b));
+  loadflt2(J, p, kind, c);
+  emitbytes(J, "\xF2\x0F", 2);
+  switch (op) {
+    case OP_ADD: emitbyte(J, 0x58); break;  /* addsd */
+    case OP_SUB: emitbyte(J, 0x5C); break;  /* subsd */
+    case OP_MUL: emitbyte(J, 0x59); break;  /* mulsd */
+    default: emitbyte(J, 0x5E); break;  /* divsd */
+  }
+  emitbyte(J, 0xC1);  /* xmm0, xmm1 */
+  storesd(J, regval(a));
+  storebimm(J, regtag(a), LUA_VNUMFLT);
+  jump(J, label(J, pc + 2));  /* skip OP_MMBIN* */
+}
+
+
+/*
+** A test instruction is always followed by a jump, which is executed
+** iff the condition is equal to 'k'; otherwise it is skipped. The
+** condition is given by flags with condition code 'cc'.
+*/
+static void emitcondjump (JitState *J, int pc, int cc, int k) {
+  jumpif(J, k ? cc : cc ^ 1, label(J, pc + 1));
+  jump(J, label(J, pc + 2));
+}
+
+
+/*
+** Comparison of R[a] with a second operand; 'icc' is the condition
+** code for integers, after 'cmp'. Floats are compared (only between
+** two registers) when 'fcc' is not 0; 'fcc' is the condition code
+** after 'ucomisd' with swapped operands, which is false for NaNs.
+*/
+static void emitcompare (JitState *J, int pc, int a, int kind, int c,
+                         int icc, int fcc, int k) {
+  unsigned int notint = 0;
+  cmptag(J, regtag(a), LUA_VNUMINT);
+  if (fcc != 0)
+    notint = jumpfwd(J, CC_NE);
+  else
+    jumpif(J, CC_NE, exitpos(J, pc));
+  if (kind == OPREG)
+    guardtag(J, pc, c, LUA_VNUMINT);
+  loadq(J, RAX, RBX, regval(a));
+  loadint2(J, kind, c);
+  emitbytes(J, "\x48\x39\xC8", 3);  /* cmp rax, rcx */
+  emitcondjump(J, pc, icc, k);
+  if (fcc != 0) {
+    lua_assert(kind == OPREG);
+    patch(J, notint);
+    guardtag(J, pc, a, LUA_VNUMFLT);
+    guardtag(J, pc, c, LUA_VNUMFLT);
+    loadsd(J, XMM0, RBX, regval(a));
+    loadsd(J, XMM1, RBX, regval(c));
+    emitbytes(J, "\x66\x0F\x2E\xC8", 4);  /* ucomisd xmm1, xmm0 */
+    emitcondjump(J, pc, fcc, k);
+  }
+}
+
+
+/* if not l_isfalse(R[a]) == k then pc++ else do next jump */
+static void emittest (JitState *J, int pc, int a, int k) {
+  unsigned int isfalse1, isfalse2;
+  loadb(J, RAX, RBX, regtag(a));
+  emitbyte(J, 0x3C);  /* cmp al, LUA_VFALSE */
+  emitbyte(J, LUA_VFALSE);
+  isfalse1 = jumpfwd(J, CC_E);
+  emitbyte(J, 0xA8);  /* test al, 0x0F (is it nil?) */
+  emitbyte(J, 0x0F);
+  isfalse2 = jumpfwd(J, CC_E);
+  jump(J, label(J, k ? pc + 1 : pc + 2));  /* value is true */
+  patch(J, isfalse1);
+  patch(J, isfalse2);
+  jump(J, label(J, k ? pc + 2 : pc + 1));  /* value is false */
+}
+
+
+/* jump to instruction 'target' */
+static void jumpto (JitState *J, int pc, int target) {
+  if (target <= pc)  /* backward jump? */
+    checkhook(J, target);
+  jump(J, label(J, target));
+}
+
+
+/* integer loop (see OP_FORLOOP in 'lvm.c') */
+static void emitforloop (JitState *J, int pc, int a, int target) {
+  guardtag(J, pc, a + 1, LUA_VNUMINT);
+  loadq(J, RAX, RBX, regval(a));  /* count */
+  emitbytes(J, "\x48\x85\xC0", 3);  /* test rax, rax */
+  jumpif(J, CC_E, label(J, pc + 1));  /* no more iterations */
+  emitbytes(J, "\x48\x83\xE8\x01", 4);  /* sub rax, 1 */
+  storeq(J, RAX, RBX, regval(a));
+  loadq(J, RAX, RBX, regval(a + 2));  /* control variable */
+  loadq(J, RCX, RBX, regval(a + 1));  /* step */
+  emitbytes(J, "\x48\x01\xC8", 3);  /* add rax, rcx */
+  storeq(J, RAX, RBX, regval(a + 2));
+  jumpto(J, pc, target);
+}
+
+
+/*
+** Emit the template for instruction 'pc'. Returns 0 if the instruction
+** has no template, in which case its code only exits.
+*/
+static int emitinstruction (JitState *J, Proto *p, int pc) {
+  Instruction i = p->code[pc];
+  int a = GETARG_A(i);
+  switch (luaP_genop(GET_OPCODE(i))) {
+    case OP_MOVE: {
+      copyvalue(J, a, RBX, regval(GETARG_B(i)), regtag(GETARG_B(i)));
+      break;
+    }
+    case OP_LOADI: {
+      storeqimm(J, regval(a), GETARG_sBx(i));
+      storebimm(J, regtag(a), LUA_VNUMINT);
+      break;
+    }
+    case OP_LOADF: {
+      lua_Number n = cast_num(GETARG_sBx(i));
+      unsigned long long bits;
+      lua_assert(sizeof(bits) == sizeof(n));
+      memcpy(&bits, &n, sizeof(n));
+      emitbytes(J, "\x48\xB8", 2);  /* mov rax, imm64 */
+      emitint(J, cast_uint(bits & 0xffffffffu));
+      emitint(J, cast_uint(bits >> 32));
+      storeq(J, RAX, RBX, regval(a));
+      storebimm(J, regtag(a), LUA_VNUMFLT);
+      break;
+    }
+    case OP_LOADK: {
+      copyvalue(J, a, RBP, kval(GETARG_Bx(i)), ktag(GETARG_Bx(i)));
+      break;
+    }
+    case OP_LOADFALSE: {
+      storebimm(J, regtag(a), LUA_VFALSE);
+      break;
+    }
+    case OP_LOADTRUE: {
+      storebimm(J, regtag(a), LUA_VTRUE);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        storebimm(J, regtag(a++), LUA_VNIL);
+      } while (b--);
+      break;
+    }
+    case OP_ADDI: {
+      emitarith(J, p, pc, OP_ADD, a, GETARG_B(i), OPIMM, GETARG_sC(i));
+      break;
+    }
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK: {
+      OpCode op = cast(OpCode, luaP_genop(GET_OPCODE(i)) - OP_ADDK + OP_ADD);
+      emitarith(J, p, pc, op, a, GETARG_B(i), OPK, GETARG_C(i));
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: {
+      emitarith(J, p, pc, luaP_genop(GET_OPCODE(i)), a, GETARG_B(i),
+                          OPREG, GETARG_C(i));
+      break;
+    }
+    case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
+      return 0;  /* skipped by arithmetic templates; no code */
+    }
+    case OP_JMP: {
+      jumpto(J, pc, pc + 1 + GETARG_sJ(i));
+      break;
+    }
+    case OP_EQ: {
+      emitcompare(J, pc, a, OPREG, GETARG_B(i), CC_E, 0, GETARG_k(i));
+      break;
+    }
+    case OP_LT: {
+      emitcompare(J, pc, a, OPREG, GETARG_B(i), CC_L, CC_A, GETARG_k(i));
+      break;
+    }
+    case OP_LE: {
+      emitcompare(J, pc, a, OPREG, GETARG_B(i), CC_LE, CC_AE, GETARG_k(i));
+      break;
+    }
+    case OP_EQI: {
+      emitcompare(J, pc, a, OPIMM, GETARG_sB(i), CC_E, 0, GETARG_k(i));
+      break;
+    }
+    case OP_LTI: {
+      emitcompare(J, pc, a, OPIMM, GETARG_sB(i), CC_L, 0, GETARG_k(i));
+      break;
+    }
+    case OP_LEI: {
+      emitcompare(J, pc, a, OPIMM, GETARG_sB(i), CC_LE, 0, GETARG_k(i));
+      break;
+    }
+    case OP_GTI: {
+      emitcompare(J, pc, a, OPIMM, GETARG_sB(i), CC_G, 0, GETARG_k(i));
+      break;
+    }
+    case OP_GEI: {
+      emitcompare(J, pc, a, OPIMM, GETARG_sB(i), CC_GE, 0, GETARG_k(i));
+      break;
+    }
+    case OP_TEST: {
+      emittest(J, pc, a, GETARG_k(i));
+      break;
+    }
+    case OP_FORLOOP: {
+      emitforloop(J, pc, a, pc + 1 - GETARG_Bx(i));
+      break;
+    }
+    default: {
+      jump(J, exitpos(J, pc));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** Emit the whole code for function 'p': a prologue, the templates for
+** all instructions, an epilogue, and the exits for all instructions.
+*/
+static void emitcode (JitState *J, Proto *p) {
+  int pc;
+  /* prologue: save callee-saved registers, set them, go to 'start' */
+  emitbytes(J, "\x53\x55\x41\x55", 4);  /* push rbx; push rbp; push r13 */
+  emitbytes(J, "\x48\x89\xF3", 3);  /* mov rbx, rsi (base) */
+  emitbytes(J, "\x48\x89\xD5", 3);  /* mov rbp, rdx (k) */
+  emitbytes(J, "\x49\x89\xFD", 3);  /* mov r13, rdi (L) */
+  emitbytes(J, "\xFF\xE1", 2);  /* jmp rcx (start) */
+  for (pc = 0; pc < p->sizecode; pc++) {
+    unsigned int pos = J->pos;
+    label(J, pc) = pos;
+    J->entry[pc] = emitinstruction(J, p, pc) ? pos : 0;
+  }
+  J->epilogue = J->pos;
+  emitbytes(J, "\x41\x5D\x5D\x5B\xC3", 5);  /* pop r13; pop rbp; pop rbx; ret */
+  J->exits = J->pos;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    emitbyte(J, 0xB8);  /* mov eax, pc */
+    emitint(J, cast_uint(pc));
+    jump(J, J->epilogue);
+  }
+}
+
+
+/*
+** Compile function 'p'. The compilation cannot raise errors and does
+** not use the garbage collector: it can be called in the middle of any
+** instruction. So, memory is allocated directly through 'frealloc'.
+** When there is not enough memory, the function remains without native
+** code, to be compiled later.
+*/
+void luaJ_compile (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  size_t size = sizejitcode(p->sizecode);
+  JitCode *j = cast(JitCode *, (*g->frealloc)(g->ud, NULL, 0, size));
+  JitState J;
+  lua_assert(p->jit == NULL);
+  if (j == NULL) {  /* not enough memory? */
+    p->jitcount = LUAI_JITHOT;  /* try again later */
+    return;
+  }
+  lua_assert(sizeof(L->hookmask) == 4);  /* see 'checkhook' */
+  memset(j->pos, 0, size - offsetof(JitCode, pos));
+  J.code = NULL;
+  J.pos = 0;
+  J.entry = j->pos;
+  J.label = j->pos + p->sizecode;
+  J.epilogue = J.exits = 0;
+  emitcode(&J, p);  /* first pass computes all positions */
+  j->size = J.pos;
+  j->mcode = cast(lu_byte *, mmap(NULL, j->size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (j->mcode == MAP_FAILED)
+    j->mcode = NULL;
+  else {
+    J.code = j->mcode;
+    J.pos = 0;
+    emitcode(&J, p);  /* second pass generates the code */
+    lua_assert(J.pos == j->size);
+    if (mprotect(j->mcode, j->size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(j->mcode, j->size);
+      j->mcode = NULL;
+    }
+  }
+  if (j->mcode == NULL)  /* could not create the code? */
+    memset(j->pos, 0, size - offsetof(JitCode, pos));  /* no entries */
+  p->jit = j;
+}
+
+
+/*
+** Run the native code of function 'p' from instruction 'pc' on, if
+** there is an entry for it. Returns the instruction where the
+** interpreter must continue.
+*/
+const Instruction *luaJ_run (lua_State *L, Proto *p, StkId base,
+                             const Instruction *pc) {
+  JitCode *j = p->jit;
+  unsigned int entry = j->pos[pc - p->code];
+  if (entry == 0)  /* no native code for this instruction? */
+    return pc;
+  else {
+    JitFunction f = (JitFunction)(void (*)(void))j->mcode;
+    return p->code + f(L, base, p->k, j->mcode + entry);
+  }
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  JitCode *j = p->jit;
+  if (j->mcode != NULL)
+    munmap(j->mcode, j->size);
+  (*g->frealloc)(g->ud, j, sizejitcode(p->sizecode), 0);
+  p->jit = NULL;
+}
+
+#endif
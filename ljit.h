@@ -0,0 +1,44 @@
+/*
+** $Id: ljit.h $
+** Baseline JIT compiler
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+
+
+/*
+** The baseline JIT compiler only generates code for x86-64 Linux, with
+** 64-bit integers and 'double' floats.
+*/
+#if defined(LUA_USE_JIT)
+#if !(defined(__x86_64__) && defined(__linux__)) || \
+    defined(LUA_32BITS) || LUA_FLOAT_TYPE != LUA_FLOAT_DOUBLE
+#undef LUA_USE_JIT
+#endif
+#endif
+
+
+/*
+** Number of activations (calls and returns from calls) plus loop
+** iterations of a function before it is compiled to native code
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	64
+#endif
+
+
+#if defined(LUA_USE_JIT)
+
+LUAI_FUNC void luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC const Instruction *luaJ_run (lua_State *L, Proto *p, StkId base,
+                                       const Instruction *pc);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#endif
+
+#endif
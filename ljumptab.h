@@ -5,11 +5,24 @@
 */
 
 
+#undef updatetrap
+#undef vmfetch
 #undef vmdispatch
 #undef vmcase
 #undef vmbreak
 
-#define vmdispatch(x)     goto *disptab[x];
+/*
+** While 'trap' is set, instructions are dispatched through 'traptab',
+** which sends all of them to 'L_trap'. So, the fast path does not need
+** to test 'trap'.
+*/
+#define vmtable()	((trap) ? traptab : disptab)
+
+#define updatetrap(ci)  (trap = ci->u.l.trap, disp = vmtable())
+
+#define vmfetch()	{ i = *(pc++); }
+
+#define vmdispatch(x)     goto *disp[x];
 
 #define vmcase(l)     L_##l:
 
@@ -109,6 +122,30 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_GETVARG,
 &&L_OP_ERRNNIL,
 &&L_OP_VARARGPREP,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_ADDINT,
+&&L_OP_ADDFLT,
+&&L_OP_SUBINT,
+&&L_OP_SUBFLT,
+&&L_OP_MULINT,
+&&L_OP_MULFLT,
+&&L_OP_LTINT,
+&&L_OP_LTFLT,
+&&L_OP_LEINT,
+&&L_OP_LEFLT,
+&&L_OP_MOVE2,
+&&L_OP_MOVECALL,
+&&L_OP_UPVALMOVE,
+&&L_OP_TABUPFIELD,
+&&L_OP_GETFIELD2,
+&&L_OP_SETFIELD2
 
 };
+
+
+static const void *const traptab[NUM_OPCODES] = {
+  [0 ... NUM_OPCODES - 1] = &&L_trap
+};
+
+
+const void *const *disp = disptab;  /* current dispatch table */
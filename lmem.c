@@ -11,6 +11,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -58,6 +59,373 @@
 #define cantryagain(g)	(completestate(g) && !g->gcstopem)
 
 
+/*
+** {==================================================================
+** Pages of small blocks
+** ===================================================================
+*/
+
+#if defined(LUA_USE_GCPAGES)
+
+/*
+** Blocks with up to LUAI_MAXSMALL bytes (most collectable objects)
+** live in pages of LUAI_PAGESIZE bytes. Each page is divided in slots
+** of one size class (a multiple of SLOTUNIT), and the free slots of
+** each class form a list, linked through the slots themselves. So,
+** allocating or freeing a small block is a list operation, and
+** objects of similar sizes stay together in memory. The allocation
+** function sees only whole pages. At the end of each cycle, the
+** collector calls 'luaM_shrinkheap' to give back pages without live
+** blocks. The memory accounting ('GCdebt') still counts the sizes of
+** the blocks, plus the memory of pages that no slot uses (their headers
+** and tails) and the memory for the bookkeeping of pages.
+** This layout only changes where blocks live. Objects keep their
+** header and stay in the collector lists (which also keep their ages
+** and the objects with finalizers), and marks stay in the objects; the
+** free maps of the pages are computed only when shrinking.
+*/
+
+/* alignment and granularity of slots */
+typedef union { LUAI_MAXALIGN; } SlotAlign;
+#define SLOTUNIT	sizeof(SlotAlign)
+
+/* number of size classes */
+#define NCLASSES	cast_int((LUAI_MAXSMALL + SLOTUNIT - 1) / SLOTUNIT)
+
+#define issmall(s)	((s) > 0 && (s) <= NCLASSES * SLOTUNIT)
+#define sizeclass(s)	cast_int(((s) - 1) / SLOTUNIT)
+#define classsize(c)	((cast_sizet(c) + 1) * SLOTUNIT)
+
+
+/* maximum number of slots in a page */
+#define MAXSLOTS	(LUAI_PAGESIZE / SLOTUNIT)
+
+/*
+** Header of a page. The free map is computed only when shrinking the
+** heap (see 'shrinkclass').
+*/
+typedef struct Page {
+  unsigned nfree;  /* number of free slots */
+  lu_byte freemap[(MAXSLOTS + 7) / 8];  /* which slots are free */
+#if defined(luai_freeslot)
+  lu_byte tags[MAXSLOTS];  /* tags of the slots (for the test library) */
+#endif
+} Page;
+
+/* offset of the first slot in a page */
+#define PAGEHEADER	(((sizeof(Page) + SLOTUNIT - 1) / SLOTUNIT) * SLOTUNIT)
+
+#define slotsperpage(c)  \
+	cast_int((LUAI_PAGESIZE - PAGEHEADER) / classsize(c))
+
+/* bytes of a page of class 'c' not used by its slots */
+#define pagewaste(c)  \
+	(LUAI_PAGESIZE - cast_sizet(slotsperpage(c)) * classsize(c))
+
+/* address of the i-th slot of page 'p' of class 'c' */
+#define pageslot(p,c,i)  \
+	(cast_charp(p) + PAGEHEADER + cast_sizet(i) * classsize(c))
+
+
+typedef struct Slot {
+  struct Slot *next;
+} Slot;
+
+
+typedef struct SlotClass {
+  Slot *free;  /* list of free slots */
+  size_t nfree;  /* number of free slots */
+  Page **pages;  /* pages of this class, sorted by address */
+  int npages;  /* number of pages */
+  int sizepages;  /* size of array 'pages' */
+} SlotClass;
+
+
+typedef struct SmallHeap {
+  SlotClass c[NCLASSES];
+} SmallHeap;
+
+
+/*
+** Hooks for the test library: it can make the allocation of a small
+** block fail, as the allocation function would, and it counts the
+** small blocks of each tag. To give back the tag of a freed block,
+** pages keep the tags of their slots when 'luai_freeslot' is defined.
+*/
+#if !defined(luai_newslot)
+#define luai_newslot(g,tag)	((void)(tag), 0)
+#endif
+
+
+static SmallHeap *getheap (global_State *g) {
+  if (l_unlikely(g->heap == NULL)) {  /* first small block? */
+    SmallHeap *h = cast(SmallHeap *, callfrealloc(g, NULL, LUAI_HEAPTAG,
+                                                  sizeof(SmallHeap)));
+    if (h != NULL) {
+      int c;
+      g->GCdebt -= cast(l_mem, sizeof(SmallHeap));
+      for (c = 0; c < NCLASSES; c++) {
+        SlotClass *sc = &h->c[c];
+        sc->free = NULL;
+        sc->nfree = 0;
+        sc->pages = NULL;
+        sc->npages = sc->sizepages = 0;
+      }
+    }
+    g->heap = h;
+  }
+  return g->heap;
+}
+
+
+/*
+** Index of the last page in class 'sc' with an address not larger
+** than 'b' (that is, the page containing 'b', if any), or -1.
+*/
+static int pageindex (SlotClass *sc, const void *b) {
+  int lo = -1;
+  int hi = sc->npages;  /* invariant: lo < result + 1 <= hi */
+  while (hi - lo > 1) {
+    int m = lo + (hi - lo) / 2;
+    if (cast(L_P2I, sc->pages[m]) <= cast(L_P2I, b))
+      lo = m;
+    else
+      hi = m;
+  }
+  return lo;
+}
+
+
+#if defined(luai_freeslot)
+
+/* normalized tag of a block, as counted by the test library */
+#define slottagof(tag)	cast_byte((tag) < LUA_NUMTYPES ? (tag) : 0)
+
+/* address of the tag of slot 's' of class 'c' */
+static lu_byte *slottag (SlotClass *sc, int c, const void *s) {
+  Page *p = sc->pages[pageindex(sc, s)];
+  return &p->tags[cast_sizet(cast_charp(s) - pageslot(p, c, 0)) /
+                  classsize(c)];
+}
+
+#define settag(sc,c,s,tag)	(*slottag(sc, c, s) = slottagof(tag))
+#define freetag(g,sc,c,s)	luai_freeslot(g, *slottag(sc, c, s))
+
+#else
+
+#define luai_freeslot(g,tag)	((void)0)
+#define slottagof(tag)		0
+#define settag(sc,c,s,tag)	((void)0)
+#define freetag(g,sc,c,s)	((void)0)
+
+#endif
+
+
+/*
+** Add a new page to class 'c', linking its slots in the list of free
+** slots. Returns 0 if it cannot get the memory.
+*/
+static int newpage (global_State *g, SlotClass *sc, int c) {
+  Page *p;
+  int i;
+  int n = slotsperpage(c);
+  if (sc->npages == sc->sizepages) {  /* array 'pages' is full? */
+    int newsize = (sc->sizepages == 0) ? 4 : sc->sizepages * 2;
+    size_t oldbytes = cast_sizet(sc->sizepages) * sizeof(Page *);
+    Page **np = cast(Page **, callfrealloc(g, NULL, LUAI_HEAPTAG,
+                                  cast_sizet(newsize) * sizeof(Page *)));
+    if (np == NULL)
+      return 0;
+    if (sc->pages != NULL) {  /* (new block, so that it gets the tag) */
+      memcpy(np, sc->pages, oldbytes);
+      callfrealloc(g, sc->pages, oldbytes, 0);
+    }
+    sc->pages = np;
+    sc->sizepages = newsize;
+    g->GCdebt -= cast(l_mem, cast_sizet(newsize) * sizeof(Page *) - oldbytes);
+  }
+  p = cast(Page *, callfrealloc(g, NULL, LUAI_HEAPTAG, LUAI_PAGESIZE));
+  if (p == NULL)
+    return 0;
+  g->GCdebt -= cast(l_mem, pagewaste(c));
+  i = pageindex(sc, p) + 1;  /* keep 'pages' sorted */
+  memmove(sc->pages + i + 1, sc->pages + i,
+          cast_sizet(sc->npages - i) * sizeof(Page *));
+  sc->pages[i] = p;
+  sc->npages++;
+  for (i = n - 1; i >= 0; i--) {  /* link slots in address order */
+    Slot *s = cast(Slot *, pageslot(p, c, i));
+    s->next = sc->free;
+    sc->free = s;
+  }
+  sc->nfree += cast_sizet(n);
+  return 1;
+}
+
+
+static void *newslot (global_State *g, size_t size, int tag) {
+  SmallHeap *h = getheap(g);
+  SlotClass *sc;
+  Slot *s;
+  if (h == NULL || luai_newslot(g, tag))
+    return NULL;
+  sc = &h->c[sizeclass(size)];
+  if (sc->free == NULL && !newpage(g, sc, sizeclass(size))) {
+    luai_freeslot(g, slottagof(tag));  /* undo count of the hook */
+    return NULL;
+  }
+  s = sc->free;
+  sc->free = s->next;
+  sc->nfree--;
+  settag(sc, sizeclass(size), s, tag);
+  return s;
+}
+
+
+static void freeslot (global_State *g, void *block, size_t size) {
+  SlotClass *sc = &g->heap->c[sizeclass(size)];
+  Slot *s = cast(Slot *, block);
+  freetag(g, sc, sizeclass(size), s);
+  s->next = sc->free;
+  sc->free = s;
+  sc->nfree++;
+}
+
+
+/*
+** Same interface as the allocation function, but using slots for
+** small blocks. (When 'block' is NULL, 'os' is a tag.)
+*/
+static void *heaprealloc (global_State *g, void *block, size_t os,
+                                                        size_t ns) {
+  if (block == NULL)  /* new block? */
+    return issmall(ns) ? newslot(g, ns, cast_int(os))
+                       : callfrealloc(g, NULL, os, ns);
+  else if (!issmall(os) && !issmall(ns))  /* no slots involved? */
+    return callfrealloc(g, block, os, ns);
+  else if (issmall(os) && issmall(ns) && sizeclass(os) == sizeclass(ns))
+    return block;  /* slot is still good */
+  else {  /* must move block */
+    void *newblock = NULL;
+    if (ns > 0) {
+      newblock = heaprealloc(g, NULL, 0, ns);
+      if (newblock == NULL)
+        return NULL;  /* keep the old block */
+      memcpy(newblock, block, (os < ns) ? os : ns);
+    }
+    if (issmall(os))
+      freeslot(g, block, os);
+    else
+      callfrealloc(g, block, os, 0);
+    return newblock;
+  }
+}
+
+
+/*
+** Give back the pages of class 'c' without live blocks, and rebuild
+** its list of free slots in address order (so that new objects fill
+** the first pages). Does not allocate memory, so it can run in
+** emergency collections.
+*/
+static void shrinkclass (global_State *g, SlotClass *sc, int c) {
+  int n = slotsperpage(c);
+  int i, j;
+  Slot *s;
+  Page *p = sc->pages[0];  /* page of the last free slot */
+  for (i = 0; i < sc->npages; i++) {  /* clear free maps */
+    sc->pages[i]->nfree = 0;
+    memset(sc->pages[i]->freemap, 0, cast_sizet(n + 7) / 8);
+  }
+  for (s = sc->free; s != NULL; s = s->next) {  /* fill free maps */
+    size_t k;
+    /* consecutive free slots are usually in the same page */
+    if (!(cast(L_P2I, p) <= cast(L_P2I, s) &&
+          cast(L_P2I, s) < cast(L_P2I, p) + LUAI_PAGESIZE))
+      p = sc->pages[pageindex(sc, s)];
+    k = cast_sizet(cast_charp(s) - pageslot(p, c, 0)) / classsize(c);
+    p->freemap[k / 8] |= cast_byte(1u << (k % 8));
+    p->nfree++;
+  }
+  for (i = j = 0; i < sc->npages; i++) {  /* free empty pages */
+    p = sc->pages[i];
+    if (p->nfree == cast_uint(n)) {  /* no live blocks? */
+      callfrealloc(g, p, LUAI_PAGESIZE, 0);
+      g->GCdebt += cast(l_mem, pagewaste(c));
+    }
+    else
+      sc->pages[j++] = p;
+  }
+  sc->npages = j;
+  sc->free = NULL;
+  sc->nfree = 0;
+  for (i = sc->npages - 1; i >= 0; i--) {  /* rebuild list of free slots */
+    int k;
+    p = sc->pages[i];
+    for (k = n - 1; k >= 0; k--) {
+      if (p->freemap[k / 8] & (1u << (k % 8))) {
+        Slot *fs = cast(Slot *, pageslot(p, c, k));
+        fs->next = sc->free;
+        sc->free = fs;
+        sc->nfree++;
+      }
+    }
+  }
+}
+
+
+/*
+** Shrink classes where at least a quarter of the slots (and at least
+** two pages worth of them) are free.
+*/
+void luaM_shrinkheap (lua_State *L) {
+  global_State *g = G(L);
+  if (g->heap != NULL) {
+    int c;
+    for (c = 0; c < NCLASSES; c++) {
+      SlotClass *sc = &g->heap->c[c];
+      size_t n = cast_sizet(slotsperpage(c));
+      if (sc->nfree >= 2 * n && sc->nfree >= cast_sizet(sc->npages) * n / 4)
+        shrinkclass(g, sc, c);
+    }
+  }
+}
+
+
+/* free all pages (when closing the state) */
+void luaM_freeheap (lua_State *L) {
+  global_State *g = G(L);
+  SmallHeap *h = g->heap;
+  if (h != NULL) {
+    int c;
+    for (c = 0; c < NCLASSES; c++) {
+      SlotClass *sc = &h->c[c];
+      int i;
+      for (i = 0; i < sc->npages; i++)
+        callfrealloc(g, sc->pages[i], LUAI_PAGESIZE, 0);
+      callfrealloc(g, sc->pages,
+                      cast_sizet(sc->sizepages) * sizeof(Page *), 0);
+      g->GCdebt += cast(l_mem, cast_sizet(sc->npages) * pagewaste(c) +
+                               cast_sizet(sc->sizepages) * sizeof(Page *));
+    }
+    callfrealloc(g, h, sizeof(SmallHeap), 0);
+    g->GCdebt += cast(l_mem, sizeof(SmallHeap));
+    g->heap = NULL;
+  }
+}
+
+#define callheap(g,block,os,ns)		heaprealloc(g, block, os, ns)
+
+#else
+
+#define issmall(s)	0
+#define callheap(g,block,os,ns)		callfrealloc(g, block, os, ns)
+
+#endif
+
+/* }================================================================== */
+
+
 
 
 #if defined(EMERGENCYGCTESTS)
@@ -70,10 +438,10 @@ static void *firsttry (global_State *g, void *block, size_t os, size_t ns) {
   if (ns > 0 && cantryagain(g))
     return NULL;  /* fail */
   else  /* normal allocation */
-    return callfrealloc(g, block, os, ns);
+    return callheap(g, block, os, ns);
 }
 #else
-#define firsttry(g,block,os,ns)    callfrealloc(g, block, os, ns)
+#define firsttry(g,block,os,ns)    callheap(g, block, os, ns)
 #endif
 
 
@@ -150,7 +518,15 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  callfrealloc(g, block, osize, 0);
+  /* small blocks go back to their pages; others may go to the sweeper */
+  if (!issmall(osize) && luaC_candefer(g, osize)) {
+    DeadBlock *d = cast(DeadBlock *, block);
+    d->next = g->deadblocks;
+    d->size = osize;
+    g->deadblocks = d;
+  }
+  else
+    callheap(g, block, osize, 0);
   g->GCdebt += cast(l_mem, osize);
 }
 
@@ -164,7 +540,7 @@ static void *tryagain (lua_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
-    return callfrealloc(g, block, osize, nsize);  /* try again */
+    return callheap(g, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
 }
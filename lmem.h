@@ -92,5 +92,35 @@ LUAI_FUNC void *luaM_shrinkvector_ (lua_State *L, void *block, int *nelem,
                                     int final_n, unsigned size_elem);
 LUAI_FUNC void *luaM_malloc_ (lua_State *L, size_t size, int tag);
 
+
+/*
+** With LUA_USE_GCPAGES, small blocks live in pages of blocks with the
+** same size (see lmem.c).
+*/
+#if defined(LUA_USE_GCPAGES)
+
+/* size of each page of small blocks */
+#if !defined(LUAI_PAGESIZE)
+#define LUAI_PAGESIZE	(16 * 1024)
+#endif
+
+/* maximum size of a small block */
+#if !defined(LUAI_MAXSMALL)
+#define LUAI_MAXSMALL	256
+#endif
+
+/* tag (see 'lua_Alloc') for the pages and the other blocks of the heap */
+#define LUAI_HEAPTAG	(LUA_NUMTYPES + 1)
+
+LUAI_FUNC void luaM_shrinkheap (lua_State *L);
+LUAI_FUNC void luaM_freeheap (lua_State *L);
+
+#else
+
+#define luaM_shrinkheap(L)	((void)0)
+#define luaM_freeheap(L)	((void)0)
+
+#endif
+
 #endif
 
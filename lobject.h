@@ -21,14 +21,15 @@
 */
 #define LUA_TUPVAL	LUA_NUMTYPES  /* upvalues */
 #define LUA_TPROTO	(LUA_NUMTYPES+1)  /* function prototypes */
-#define LUA_TDEADKEY	(LUA_NUMTYPES+2)  /* removed keys in tables */
+#define LUA_TSHAPE	(LUA_NUMTYPES+2)  /* table shapes */
+#define LUA_TDEADKEY	(LUA_NUMTYPES+3)  /* removed keys in tables */
 
 
 
 /*
 ** number of all possible types (including LUA_TNONE but excluding DEADKEY)
 */
-#define LUA_TOTALTYPES		(LUA_TPROTO + 2)
+#define LUA_TOTALTYPES		(LUA_TSHAPE + 2)
 
 
 /*
@@ -397,6 +398,8 @@ typedef struct GCObject {
 #define LSTRREG		-1  /* regular long string */
 #define LSTRFIX		-2  /* fixed external long string */
 #define LSTRMEM		-3  /* external long string with deallocation */
+#define LSTRBUF		-4  /* long string in a shared buffer ('Strbuf') */
+#define LSTRVIEW	-5  /* view of part of another long string */
 
 
 /*
@@ -412,8 +415,11 @@ typedef struct TString {
     struct TString *hnext;  /* linked list for hash table */
   } u;
   char *contents;  /* pointer to content in long strings */
-  lua_Alloc falloc;  /* deallocation function for external strings */
-  void *ud;  /* user data for external strings */
+  union {
+    lua_Alloc falloc;  /* deallocation function for external strings */
+    struct TString *vnext;  /* list of views, during a collection */
+  } f;
+  void *ud;  /* user data for external strings; parent for views */
 } TString;
 
 
@@ -604,10 +610,16 @@ typedef struct Proto {
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int sizeabslineinfo;  /* size of 'abslineinfo' */
+  int sizeloops;  /* size of 'loops' */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
+  int jitcount;  /* countdown to JIT compilation (see 'ljit.c') */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  unsigned int *icache;  /* inline caches for field accesses (one per pc) */
+  struct JitCode *jit;  /* native code for the function */
+  lua_Unsigned *counters;  /* execution counters (see 'luaF_initcounters') */
+  int *loops;  /* pcs of loop back jumps (see 'luaF_initcounters') */
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
@@ -769,15 +781,39 @@ typedef union Node {
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
-  lu_byte lsizenode;  /* log2 of number of slots of 'node' array */
+  lu_byte lsizenode;  /* log2 of number of slots of 'node' (plus 2 bits) */
   unsigned int asize;  /* number of slots in 'array' array */
   Value *array;  /* array part */
   Node *node;
+  TValue *slots;  /* values for the keys in a shape (see 'ltable.c') */
   struct Table *metatable;
   GCObject *gclist;
 } Table;
 
 
+/*
+** Shapes (hidden classes): Tables with the same few short-string keys,
+** added in the same order, share a shape that maps each key to a slot
+** index, and keep only the values, in 'slots'. Shapes form a tree: a
+** shape extends its parent with one more key, 'key'. A shape keeps its
+** parent alive, but not its children: A table keeps its shape alive,
+** and a shape not used by any table (or by a child) is collected.
+*/
+
+#define LUA_VSHAPE	makevariant(LUA_TSHAPE, 0)
+
+typedef struct Shape {
+  CommonHeader;
+  unsigned int nkeys;  /* number of keys */
+  unsigned int nchildren;  /* length of list 'child' */
+  struct Shape *parent;  /* shape with all keys but the last one */
+  struct Shape *child;  /* list of shapes that extend this one */
+  struct Shape *sibling;  /* next shape in the 'child' list of 'parent' */
+  struct ShapeKeys *keys;  /* all keys of the shape (and maybe more) */
+  TString *key;  /* last key */
+} Shape;
+
+
 /*
 ** Macros to manipulate keys inserted in nodes
 */
@@ -819,7 +855,13 @@ typedef struct Table {
 
 
 #define twoto(x)	(1u<<(x))
-#define sizenode(t)	(twoto((t)->lsizenode))
+
+/*
+** The two highest bits of 'lsizenode' are not part of the size of the
+** hash part; they are used by the collector (see 'ltable.h').
+*/
+#define MASKLSIZE	0x3F
+#define sizenode(t)	(twoto((t)->lsizenode & MASKLSIZE))
 
 
 /* size of buffer for 'luaO_utf8esc' function */
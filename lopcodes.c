@@ -13,6 +13,15 @@
 #include "lopcodes.h"
 
 
+/*
+** By default, frequent pairs of instructions are fused into
+** superinstructions. (See note about superinstructions in 'lopcodes.h'.)
+*/
+#if !defined(LUAI_FUSE)
+#define LUAI_FUSE	1
+#endif
+
+
 #define opmode(mm,ot,it,t,a,m)  \
     (((mm) << 7) | ((ot) << 6) | ((it) << 5) | ((t) << 4) | ((a) << 3) | (m))
 
@@ -106,6 +115,44 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, 0, 0, 0, iABx)		/* OP_ERRNNIL */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULFLT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTINT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTFLT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEINT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVE2 */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVECALL */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_UPVALMOVE */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_TABUPFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETFIELD2 */
+ ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_SETFIELD2 */
+};
+
+
+/* ORDER OP */
+
+LUAI_DDEF const lu_byte luaP_genops[NUM_OPCODES - OP_FIRSTQUICK] = {
+  OP_ADD	/* OP_ADDINT */
+ ,OP_ADD	/* OP_ADDFLT */
+ ,OP_SUB	/* OP_SUBINT */
+ ,OP_SUB	/* OP_SUBFLT */
+ ,OP_MUL	/* OP_MULINT */
+ ,OP_MUL	/* OP_MULFLT */
+ ,OP_LT		/* OP_LTINT */
+ ,OP_LT		/* OP_LTFLT */
+ ,OP_LE		/* OP_LEINT */
+ ,OP_LE		/* OP_LEFLT */
+ ,OP_MOVE	/* OP_MOVE2 */
+ ,OP_MOVE	/* OP_MOVECALL */
+ ,OP_GETUPVAL	/* OP_UPVALMOVE */
+ ,OP_GETTABUP	/* OP_TABUPFIELD */
+ ,OP_GETFIELD	/* OP_GETFIELD2 */
+ ,OP_SETFIELD	/* OP_SETFIELD2 */
 };
 
 
@@ -138,3 +185,60 @@ int luaP_isIT (Instruction i) {
   }
 }
 
+
+#if LUAI_FUSE
+
+/*
+** Opcode for an instruction with opcode 'o1' followed by an instruction
+** with opcode 'o2'. (The pairs were chosen from the frequencies of
+** consecutive opcodes in the test suite and in common benchmarks.)
+*/
+static OpCode fusedop (OpCode o1, OpCode o2) {
+  switch (o1) {
+    case OP_MOVE: {
+      if (o2 == OP_MOVE) return OP_MOVE2;
+      else if (o2 == OP_CALL) return OP_MOVECALL;
+      break;
+    }
+    case OP_GETUPVAL: {
+      if (o2 == OP_MOVE) return OP_UPVALMOVE;
+      break;
+    }
+    case OP_GETTABUP: {
+      if (o2 == OP_GETFIELD) return OP_TABUPFIELD;
+      break;
+    }
+    case OP_GETFIELD: {
+      if (o2 == OP_GETFIELD) return OP_GETFIELD2;
+      break;
+    }
+    case OP_SETFIELD: {
+      if (o2 == OP_SETFIELD) return OP_SETFIELD2;
+      break;
+    }
+    default: break;
+  }
+  return o1;  /* no superinstruction */
+}
+
+
+/*
+** Rewrite the 'n' instructions in 'code' (which must have only generic
+** opcodes) with superinstructions. Only the first instruction of each
+** pair changes, so a jump to the second one still executes it alone.
+*/
+void luaP_fuse (Instruction *code, int n) {
+  int pc;
+  for (pc = 0; pc < n - 1; pc++) {
+    OpCode o = fusedop(GET_OPCODE(code[pc]), GET_OPCODE(code[pc + 1]));
+    SET_OPCODE(code[pc], o);
+  }
+}
+
+#else
+
+void luaP_fuse (Instruction *code, int n) {
+  UNUSED(code); UNUSED(n);
+}
+
+#endif
@@ -344,11 +344,34 @@ OP_ERRNNIL,/*	A Bx	raise error if R[A] ~= nil (K[Bx] is global name)*/
 
 OP_VARARGPREP,/* 	(adjust vararg parameters)			*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* quickened opcodes (see note) */
+OP_ADDINT,/*	A B C	R[A] := R[B] + R[C]	(integers)		*/
+OP_ADDFLT,/*	A B C	R[A] := R[B] + R[C]	(floats)		*/
+OP_SUBINT,/*	A B C	R[A] := R[B] - R[C]	(integers)		*/
+OP_SUBFLT,/*	A B C	R[A] := R[B] - R[C]	(floats)		*/
+OP_MULINT,/*	A B C	R[A] := R[B] * R[C]	(integers)		*/
+OP_MULFLT,/*	A B C	R[A] := R[B] * R[C]	(floats)		*/
+OP_LTINT,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (integers)	*/
+OP_LTFLT,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (floats)	*/
+OP_LEINT,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (integers)	*/
+OP_LEFLT,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (floats)	*/
+
+/* superinstructions (see note) */
+OP_MOVE2,/*	A B	OP_MOVE; then next OP_MOVE			*/
+OP_MOVECALL,/*	A B	OP_MOVE; then next OP_CALL			*/
+OP_UPVALMOVE,/*	A B	OP_GETUPVAL; then next OP_MOVE			*/
+OP_TABUPFIELD,/* A B C	OP_GETTABUP; then next OP_GETFIELD		*/
+OP_GETFIELD2,/*	A B C	OP_GETFIELD; then next OP_GETFIELD		*/
+OP_SETFIELD2/*	A B C	OP_SETFIELD; then next OP_SETFIELD		*/
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_SETFIELD2) + 1)
+
+/* first quickened opcode */
+#define OP_FIRSTQUICK	OP_ADDINT
 
 
 
@@ -403,6 +426,21 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) Quickened opcodes are never generated by the compiler. The
+  interpreter rewrites a generic opcode (e.g., OP_ADD) into one of its
+  quickened variants when it finds operands of the corresponding types.
+  A quickened opcode rewrites itself back into its generic opcode when
+  its operands have other types. They are never dumped: 'luaP_genop'
+  gives the generic opcode for any opcode.
+
+  (*) Superinstructions are not generated by the compiler either.
+  After a function is compiled or loaded, 'luaP_fuse' replaces the
+  opcode of an instruction followed by a frequent partner with the
+  opcode of the pair, which executes the instruction and then the
+  next one without a full dispatch. The next instruction is kept
+  unchanged, so jumps to it still work. Like quickened opcodes, they
+  are never dumped.
+
 ===========================================================================*/
 
 
@@ -426,8 +464,16 @@ LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
 #define testMMMode(m)	(luaP_opmodes[m] & (1 << 7))
 
 
+/* generic opcode corresponding to opcode 'o' */
+#define luaP_genop(o)  \
+  ((o) < OP_FIRSTQUICK ? (o) : cast(OpCode, luaP_genops[(o) - OP_FIRSTQUICK]))
+
+LUAI_DDEC(const lu_byte luaP_genops[NUM_OPCODES - OP_FIRSTQUICK];)
+
+
 LUAI_FUNC int luaP_isOT (Instruction i);
 LUAI_FUNC int luaP_isIT (Instruction i);
+LUAI_FUNC void luaP_fuse (Instruction *code, int n);
 
 
 #endif
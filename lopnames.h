@@ -98,6 +98,22 @@ static const char *const opnames[] = {
   "ERRNNIL",
   "VARARGPREP",
   "EXTRAARG",
+  "ADDINT",
+  "ADDFLT",
+  "SUBINT",
+  "SUBFLT",
+  "MULINT",
+  "MULFLT",
+  "LTINT",
+  "LTFLT",
+  "LEINT",
+  "LEFLT",
+  "MOVE2",
+  "MOVECALL",
+  "UPVALMOVE",
+  "TABUPFIELD",
+  "GETFIELD2",
+  "SETFIELD2",
   NULL
 };
 
@@ -19,6 +19,13 @@
 #undef _XOPEN_SOURCE  /* use -D_XOPEN_SOURCE=0 to undefine it */
 #endif
 
+/*
+** Allows anonymous memory mappings, used by the JIT compiler
+*/
+#if defined(LUA_USE_JIT) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 /*
 ** Allows manipulation of large files in gcc and some other compilers
 */
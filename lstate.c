@@ -238,7 +238,10 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->openupval = NULL;
   L->status = LUA_OK;
   L->errfunc = 0;
+  L->gcclean = 0;
+  L->gcstamp = 0;
   L->oldpc = 0;
+  L->nextcursor = 0;
   L->base_ci.previous = L->base_ci.next = NULL;
 }
 
@@ -264,7 +267,10 @@ static void close_state (lua_State *L) {
     luai_userstateclose(L);
   }
   luaM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
+  if (G(L)->strt.old != NULL)  /* was resizing the string table? */
+    luaM_freearray(L, G(L)->strt.old, cast_sizet(G(L)->strt.oldsize));
   freestack(L);
+  luaM_freeheap(L);
   lua_assert(gettotalbytes(g) == sizeof(global_State));
   (*g->frealloc)(g->ud, g, sizeof(global_State), 0);  /* free main block */
 }
@@ -308,6 +314,7 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
 
 
 TStatus luaE_resetthread (lua_State *L, TStatus status) {
+  L->gcclean = 0;  /* stack will change */
   resetCI(L);
   if (status == LUA_YIELD)
     status = LUA_OK;
@@ -352,22 +359,45 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   g->warnf = NULL;
   g->ud_warn = NULL;
   g->seed = seed;
+#if defined(LUA_USE_CACHESTATS)
+  g->ichits = g->icmisses = 0;
+#endif
+  g->rootshape.next = NULL;
+  g->rootshape.tt = LUA_VSHAPE;
+  g->rootshape.marked = 0;  /* gray forever, like fixed objects */
+  g->rootshape.parent = g->rootshape.child = g->rootshape.sibling = NULL;
+  g->rootshape.keys = NULL;
+  g->rootshape.key = NULL;
+  g->rootshape.nkeys = g->rootshape.nchildren = 0;
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.old = NULL;
+  g->strt.oldsize = g->strt.moved = 0;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gccycle = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
+  g->ephdeps = NULL;
+  g->views = NULL;
   g->twups = NULL;
+  g->gcpool = NULL;
+  g->gcsweeper = NULL;
+  g->deadblocks = NULL;
+  g->heap = NULL;
+  g->nremset = g->nremold = 0;
+  g->gcadapt.on = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  g->gcdefer = 0;
   g->GCtotalbytes = sizeof(global_State);
   g->GCmarked = 0;
   g->GCdebt = 0;
@@ -375,6 +405,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   setgcparam(g, PAUSE, LUAI_GCPAUSE);
   setgcparam(g, STEPMUL, LUAI_GCMUL);
   setgcparam(g, STEPSIZE, LUAI_GCSTEPSIZE);
+  g->gcsteptime = LUAI_GCSTEPTIME;
   setgcparam(g, MINORMUL, LUAI_GENMINORMUL);
   setgcparam(g, MINORMAJOR, LUAI_MINORMAJOR);
   setgcparam(g, MAJORMINOR, LUAI_MAJORMINOR);
@@ -153,6 +153,15 @@ struct lua_longjmp;  /* defined in ldo.c */
 #endif
 
 
+/*
+** Size of the remembered set of generational mode, which keeps young
+** objects stored into large old tables (see 'luaC_barrierback_').
+*/
+#if !defined(GCREMSET_N)
+#define GCREMSET_N              256
+#endif
+
+
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
 #define stacksize(th)	cast_int((th)->stack_last.p - (th)->stack.p)
@@ -166,8 +175,11 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 typedef struct stringtable {
   TString **hash;  /* array of buckets (linked lists of strings) */
+  TString **old;  /* previous array of buckets, while resizing */
   int nuse;  /* number of elements */
   int size;  /* number of buckets */
+  int oldsize;  /* number of buckets in 'old' */
+  int moved;  /* number of buckets of 'old' already moved to 'hash' */
 } stringtable;
 
 
@@ -299,9 +311,12 @@ struct lua_State {
   CallInfo base_ci;  /* CallInfo for first level (C host) */
   volatile lua_Hook hook;
   ptrdiff_t errfunc;  /* current error handling function (stack index) */
+  ptrdiff_t gcclean;  /* stack below it unchanged since 'gcstamp' (or 0) */
+  l_uint32 gcstamp;  /* GC cycle when 'gcclean' was set */
   l_uint32 nCcalls;  /* number of nested non-yieldable or C calls */
   int oldpc;  /* last pc traced */
   int nci;  /* number of items in 'ci' list */
+  unsigned int nextcursor;  /* cursor of last 'lua_next' (see 'luaH_next') */
   int basehookcount;
   int hookcount;
   volatile l_signalT hookmask;
@@ -321,6 +336,40 @@ typedef struct LX {
 } LX;
 
 
+/*
+** State of the adaptive mode of the collector (see lgc.c). The
+** measurements refer to the current "window", which started at 'start'.
+*/
+typedef struct GCAdapt {
+  lua_Unsigned start;  /* clock when the window started */
+  lua_Unsigned gctime;  /* time spent in GC steps in the window */
+  lua_Unsigned maxpause;  /* longest GC step in the window */
+  l_mem base;  /* number of bytes in use after the last GC step */
+  l_mem minoralloc;  /* bytes allocated before minor collections */
+  l_mem minorfreed;  /* bytes freed by minor collections */
+  l_uint32 cycle;  /* value of 'gccycle' when the window started */
+  int targetpause;  /* target for the longest step (in microseconds) */
+  int maxoverhead;  /* maximum percentage of time in the collector */
+  int nwindows;  /* windows in incremental mode since last try */
+  lu_byte on;  /* true if the collector is in adaptive mode */
+} GCAdapt;
+
+
+/*
+** Statistics of the collector (see lgc.c)
+*/
+typedef struct GCStats {
+  lua_Unsigned last;  /* clock when the current phase was last accounted */
+  lua_Unsigned cycles;  /* finished cycles */
+  lua_Unsigned time[LUA_GCPHN];  /* time spent in each phase */
+  lua_Unsigned pauses[LUA_GCNPAUSES];  /* histogram of pauses */
+  l_mem marked;  /* bytes marked in the last cycle */
+  l_mem freed;  /* bytes freed in the last cycle */
+  l_mem freeing;  /* bytes freed in the current cycle */
+  int timing;  /* true while timing some GC work */
+} GCStats;
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -335,13 +384,21 @@ typedef struct global_State {
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
+#if defined(LUA_USE_CACHESTATS)
+  lu_mem ichits;  /* number of hits in inline caches */
+  lu_mem icmisses;  /* number of misses in inline caches */
+#endif
+  Shape rootshape;  /* shape with no keys (not a collectable object) */
   lu_byte gcparams[LUA_GCPN];
+  int gcsteptime;  /* time budget of each step (microseconds), or 0 */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcstopem;  /* stops emergency collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  l_uint32 gccycle;  /* number of collection cycles started */
+  lu_byte gcdefer;  /* true if frees go to 'deadblocks' */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -350,6 +407,8 @@ typedef struct global_State {
   GCObject *weak;  /* list of tables with weak values */
   GCObject *ephemeron;  /* list of ephemeron tables (weak keys) */
   GCObject *allweak;  /* list of all-weak tables */
+  struct EphDeps *ephdeps;  /* blocked ephemeron entries (see lgc.c) */
+  TString *views;  /* list of views to check in the atomic phase */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
   /* fields for generational collector */
@@ -361,11 +420,20 @@ typedef struct global_State {
   GCObject *finobjold1;  /* list of old1 objects with finalizers */
   GCObject *finobjrold;  /* list of really old objects with finalizers */
   struct lua_State *twups;  /* list of threads with open upvalues */
+  struct GCPool *gcpool;  /* helper threads for parallel marking */
+  struct GCSweeper *gcsweeper;  /* thread freeing dead objects */
+  struct DeadBlock *deadblocks;  /* blocks to be freed by 'gcsweeper' */
+  struct SmallHeap *heap;  /* pages of small blocks */
   lua_CFunction panic;  /* to be called in unprotected errors */
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTYPES];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  int nremset;  /* number of objects in 'remset' */
+  int nremold;  /* how many of them were remembered before last collection */
+  GCObject *remset[GCREMSET_N];  /* remembered set */
+  GCAdapt gcadapt;  /* adaptive mode */
+  GCStats gcstats;  /* statistics */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
   LX mainth;  /* main thread of this state */
@@ -400,6 +468,7 @@ union GCUnion {
   struct Proto p;
   struct lua_State th;  /* thread */
   struct UpVal upv;
+  struct Shape sh;
 };
 
 
@@ -422,6 +491,7 @@ union GCUnion {
 #define gco2p(o)  check_exp((o)->tt == LUA_VPROTO, &((cast_u(o))->p))
 #define gco2th(o)  check_exp((o)->tt == LUA_VTHREAD, &((cast_u(o))->th))
 #define gco2upv(o)	check_exp((o)->tt == LUA_VUPVAL, &((cast_u(o))->upv))
+#define gco2sh(o)  check_exp((o)->tt == LUA_VSHAPE, &((cast_u(o))->sh))
 
 
 /*
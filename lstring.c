@@ -50,6 +50,8 @@ int luaS_eqstr (TString *a, TString *b) {
 }
 
 
+#if defined(LUA_USE_BYTEHASH)
+
 static unsigned luaS_hash (const char *str, size_t l, unsigned seed) {
   unsigned int h = seed ^ cast_uint(l);
   for (; l > 0; l--)
@@ -57,6 +59,66 @@ static unsigned luaS_hash (const char *str, size_t l, unsigned seed) {
   return h;
 }
 
+#else
+
+/*
+** String hash that reads the string one word (4 bytes) at a time,
+** mixing each word as in MurmurHash3. Blocks of 8 bytes go to two
+** independent lanes, so that their multiplications can overlap.
+** Words are assembled from bytes to avoid alignment and endianness
+** issues (compilers turn that into a single load); 'trim32' keeps
+** only the lower 32 bits when 'l_uint32' is larger than that.
+*/
+
+#define HC1	0xcc9e2d51u
+#define HC2	0x1b873593u
+
+#define trim32(x)	((x) & 0xffffffffu)
+#define rotl32(x,n)	trim32(((x) << (n)) | (trim32(x) >> (32 - (n))))
+
+#define getword(p)  \
+	(cast(l_uint32, (p)[0]) | (cast(l_uint32, (p)[1]) << 8) |  \
+	 (cast(l_uint32, (p)[2]) << 16) | (cast(l_uint32, (p)[3]) << 24))
+
+/* scramble a word 'k' */
+#define mixk(k)		(rotl32((k) * HC1, 15) * HC2)
+
+/* add word 'k' to hash 'h' */
+#define mixword(h,k)	(rotl32((h) ^ mixk(k), 13) * 5u + 0xe6546b64u)
+
+
+static unsigned luaS_hash (const char *str, size_t l, unsigned seed) {
+  const lu_byte *p = cast(const lu_byte *, str);
+  l_uint32 h1 = trim32(cast(l_uint32, seed) ^ cast(l_uint32, l));
+  l_uint32 h2 = trim32(h1 * HC1);
+  l_uint32 k = 0;
+  for (; l >= 8; l -= 8, p += 8) {
+    h1 = mixword(h1, getword(p));
+    h2 = mixword(h2, getword(p + 4));
+  }
+  h1 = trim32(h1 ^ rotl32(h2, 16));
+  if (l >= 4) {
+    h1 = mixword(h1, getword(p));
+    l -= 4; p += 4;
+  }
+  switch (l) {  /* last bytes */
+    case 3: k ^= cast(l_uint32, p[2]) << 16;  /* FALLTHROUGH */
+    case 2: k ^= cast(l_uint32, p[1]) << 8;  /* FALLTHROUGH */
+    case 1: k ^= p[0];
+            h1 ^= trim32(mixk(k));
+  }
+  /* final mix (from MurmurHash3) */
+  h1 = trim32(h1);
+  h1 ^= h1 >> 16;
+  h1 = trim32(h1 * 0x85ebca6bu);
+  h1 ^= h1 >> 13;
+  h1 = trim32(h1 * 0xc2b2ae35u);
+  h1 ^= h1 >> 16;
+  return cast_uint(h1);
+}
+
+#endif
+
 
 unsigned luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_VLNGSTR);
@@ -69,21 +131,54 @@ unsigned luaS_hashlongstr (TString *ts) {
 }
 
 
-static void tablerehash (TString **vect, int osize, int nsize) {
-  int i;
-  for (i = osize; i < nsize; i++)  /* clear new elements */
-    vect[i] = NULL;
-  for (i = 0; i < osize; i++) {  /* rehash old part of the array */
-    TString *p = vect[i];
-    vect[i] = NULL;
+/*
+** The string table grows and shrinks incrementally. A resize allocates
+** the new array of buckets and keeps the previous one in 'old'; then,
+** each creation of a short string and each sweep step of the collector
+** move STRTMOVESTEP buckets from the old array to the new one, in
+** order. A string lives in the old array while its bucket there has
+** not been moved ('strbucket'). A new resize first finishes the
+** current one.
+*/
+#if !defined(STRTMOVESTEP)
+#define STRTMOVESTEP	2
+#endif
+
+
+/* bucket where a string with hash 'h' lives */
+static TString **strbucket (stringtable *tb, unsigned int h) {
+  if (tb->old != NULL) {  /* resizing? */
+    int i = cast_int(lmod(h, tb->oldsize));
+    if (i >= tb->moved)  /* bucket not moved yet? */
+      return &tb->old[i];
+  }
+  return &tb->hash[lmod(h, tb->size)];
+}
+
+
+/*
+** Move up to 'n' buckets from the old array of the string table to the
+** new one, freeing the old array when it is empty.
+*/
+void luaS_movestrtab (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->old == NULL)  /* not resizing? */
+    return;  /* nothing to be done */
+  for (; n > 0 && tb->moved < tb->oldsize; n--) {
+    TString *p = tb->old[tb->moved++];
     while (p) {  /* for each string in the list */
       TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, nsize);  /* new position */
-      p->u.hnext = vect[h];  /* chain it into array */
-      vect[h] = p;
+      unsigned int h = lmod(p->hash, tb->size);  /* new position */
+      p->u.hnext = tb->hash[h];  /* chain it into new array */
+      tb->hash[h] = p;
       p = hnext;
     }
   }
+  if (tb->moved == tb->oldsize) {  /* moved all buckets? */
+    luaM_freearray(L, tb->old, cast_sizet(tb->oldsize));
+    tb->old = NULL;
+    tb->oldsize = tb->moved = 0;
+  }
 }
 
 
@@ -94,22 +189,19 @@ static void tablerehash (TString **vect, int osize, int nsize) {
 */
 void luaS_resize (lua_State *L, int nsize) {
   stringtable *tb = &G(L)->strt;
-  int osize = tb->size;
   TString **newvect;
-  if (nsize < osize)  /* shrinking table? */
-    tablerehash(tb->hash, osize, nsize);  /* depopulate shrinking part */
-  newvect = luaM_reallocvector(L, tb->hash, osize, nsize, TString*);
-  if (l_unlikely(newvect == NULL)) {  /* reallocation failed? */
-    if (nsize < osize)  /* was it shrinking table? */
-      tablerehash(tb->hash, nsize, osize);  /* restore to original size */
-    /* leave table as it was */
-  }
-  else {  /* allocation succeeded */
-    tb->hash = newvect;
-    tb->size = nsize;
-    if (nsize > osize)
-      tablerehash(newvect, osize, nsize);  /* rehash for new size */
-  }
+  int i;
+  luaS_movestrtab(L, tb->oldsize);  /* finish previous resize */
+  newvect = luaM_reallocvector(L, NULL, 0, nsize, TString*);
+  if (l_unlikely(newvect == NULL))  /* allocation failed? */
+    return;  /* leave table as it was */
+  for (i = 0; i < nsize; i++)  /* clear new array */
+    newvect[i] = NULL;
+  tb->old = tb->hash;
+  tb->oldsize = tb->size;
+  tb->moved = 0;
+  tb->hash = newvect;
+  tb->size = nsize;
 }
 
 
@@ -135,7 +227,8 @@ void luaS_init (lua_State *L) {
   int i, j;
   stringtable *tb = &G(L)->strt;
   tb->hash = luaM_newvector(L, MINSTRTABSIZE, TString*);
-  tablerehash(tb->hash, 0, MINSTRTABSIZE);  /* clear array */
+  for (i = 0; i < MINSTRTABSIZE; i++)  /* clear array */
+    tb->hash[i] = NULL;
   tb->size = MINSTRTABSIZE;
   /* pre-create memory-error message */
   g->memerrmsg = luaS_newliteral(L, MEMERRMSG);
@@ -150,12 +243,12 @@ size_t luaS_sizelngstr (size_t len, int kind) {
   switch (kind) {
     case LSTRREG:  /* regular long string */
       /* don't need 'falloc'/'ud', but need space for content */
-      return offsetof(TString, falloc) + (len + 1) * sizeof(char);
+      return offsetof(TString, f) + (len + 1) * sizeof(char);
     case LSTRFIX:  /* fixed external long string */
       /* don't need 'falloc'/'ud' */
-      return offsetof(TString, falloc);
-    default:  /* external long string with deallocation */
-      lua_assert(kind == LSTRMEM);
+      return offsetof(TString, f);
+    default:  /* external string with deallocation, buffer, or view */
+      lua_assert(kind == LSTRMEM || kind == LSTRBUF || kind == LSTRVIEW);
       return sizeof(TString);
   }
 }
@@ -181,7 +274,7 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
   TString *ts = createstrobj(L, totalsize, LUA_VLNGSTR, G(L)->seed);
   ts->u.lnglen = l;
   ts->shrlen = LSTRREG;  /* signals that it is a regular long string */
-  ts->contents = cast_charp(ts) + offsetof(TString, falloc);
+  ts->contents = cast_charp(ts) + offsetof(TString, f);
   ts->contents[l] = '\0';  /* ending 0 */
   return ts;
 }
@@ -189,7 +282,7 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = strbucket(tb, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -216,9 +309,9 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   global_State *g = G(L);
   stringtable *tb = &g->strt;
   unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &tb->hash[lmod(h, tb->size)];
+  TString **list;
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
-  for (ts = *list; ts != NULL; ts = ts->u.hnext) {
+  for (ts = *strbucket(tb, h); ts != NULL; ts = ts->u.hnext) {
     if (l == cast_uint(ts->shrlen) &&
         (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)) {
       /* found! */
@@ -228,14 +321,15 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
     }
   }
   /* else must create a new string */
-  if (tb->nuse >= tb->size) {  /* need to grow string table? */
+  if (tb->nuse >= tb->size)  /* need to grow string table? */
     growstrtab(L, tb);
-    list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
-  }
   ts = createstrobj(L, sizestrshr(l), LUA_VSHRSTR, h);
   ts->shrlen = cast(ls_byte, l);
   getshrstr(ts)[l] = '\0';  /* ending 0 */
   memcpy(getshrstr(ts), str, l * sizeof(char));
+  luaS_movestrtab(L, STRTMOVESTEP);  /* continue resize, if any */
+  /* (bucket computed only now, as the table may have changed) */
+  list = strbucket(tb, h);
   ts->u.hnext = *list;
   *list = ts;
   tb->nuse++;
@@ -328,7 +422,7 @@ TString *luaS_newextlstr (lua_State *L,
       (*falloc)(ud, cast_voidp(s), len + 1, 0);  /* free external string */
       luaM_error(L);  /* re-raise memory error */
     }
-    ne.ts->falloc = falloc;
+    ne.ts->f.falloc = falloc;
     ne.ts->ud = ud;
   }
   ne.ts->shrlen = ne.kind;
@@ -351,3 +445,181 @@ TString *luaS_normstr (lua_State *L, TString *ts) {
   }
 }
 
+
+/*
+** {==================================================================
+** Buffer strings
+** ===================================================================
+*/
+
+static Strbuf *newstrbuf (lua_State *L, size_t size) {
+  Strbuf *b = cast(Strbuf *, luaM_newblock(L, sizestrbuf(size)));
+  b->nrefs = 0;
+  b->used = 0;
+  b->size = size;
+  return b;
+}
+
+
+/*
+** Create a string with length 'l' whose contents start with the
+** contents of long string 'first'; the caller fills the rest. If
+** 'first' ends its buffer and the buffer has room, the new string
+** goes into the same buffer. Otherwise, it goes into a new buffer,
+** with some room to grow when 'first' was already in a buffer.
+*/
+TString *luaS_appendbuf (lua_State *L, TString *first, size_t l) {
+  size_t lf = first->u.lnglen;
+  TString *ts = createstrobj(L, luaS_sizelngstr(l, LSTRBUF),
+                                LUA_VLNGSTR, G(L)->seed);
+  Strbuf *b;
+  lua_assert(!strisshr(first) && lf < l && l > LUAI_MAXSHORTLEN);
+  ts->shrlen = LSTRBUF;
+  ts->u.lnglen = l;
+  ts->ud = NULL;  /* no buffer yet ('luaS_releasebuf' may see it) */
+  if (isbufstr(first) && first->contents == gbuf(first)->data &&
+      gbuf(first)->used == lf && l < gbuf(first)->size)
+    b = gbuf(first);  /* append in place */
+  else {
+    size_t size = l + 1;
+    if (isbufstr(first) && l < MAX_SIZE / 2)  /* growing a buffer? */
+      size += l / 2;  /* leave room for more appends */
+    setsvalue2s(L, L->top.p, ts);  /* anchor new string (EXTRA_STACK) */
+    L->top.p++;
+    b = newstrbuf(L, size);
+    L->top.p--;
+    memcpy(b->data, getlngstr(first), lf * sizeof(char));
+  }
+  b->nrefs++;
+  b->used = l;
+  b->data[l] = '\0';  /* ending 0 */
+  ts->ud = b;
+  ts->contents = b->data;
+  return ts;
+}
+
+
+/*
+** Move the contents of string 'ts' (a buffer string or a view) to
+** buffer 'nb', which becomes its own buffer, sealed.
+*/
+static void moveto (lua_State *L, TString *ts, Strbuf *nb) {
+  size_t l = ts->u.lnglen;
+  memcpy(nb->data, ts->contents, l * sizeof(char));
+  nb->data[l] = '\0';  /* ending 0 */
+  nb->used = l + 1;  /* sealed */
+  nb->nrefs = 1;
+  if (isbufstr(ts))
+    luaS_releasebuf(L, ts);
+  ts->shrlen = LSTRBUF;
+  ts->ud = nb;
+  ts->contents = nb->data;
+}
+
+
+/*
+** Make buffer string or view 'ts' safe to be used as a C string: it
+** must end with a '\0', no append can go after it, and its contents
+** cannot move. If a buffer string ends the used part of its buffer,
+** count its ending '\0' as used. Otherwise, if it has no '\0' after it
+** or it is a view (which may be compacted), move it to a buffer of its
+** own.
+*/
+void luaS_sealstr (lua_State *L, TString *ts) {
+  size_t l = ts->u.lnglen;
+  if (isbufstr(ts) && endsbuf(ts))  /* string ends its buffer? */
+    gbuf(ts)->used++;  /* its '\0' cannot be overwritten anymore */
+  else if (isviewstr(ts) || ts->contents[l] != '\0')
+    moveto(L, ts, newstrbuf(L, l + 1));
+}
+
+
+/*
+** Check whether long string 'ts' can have views: Its memory must be
+** managed by Lua (see 'l_strton'), so it must be a regular string, a
+** buffer string, an external string allocated with the state's
+** allocation function (e.g., a result from 'luaL_pushresult'), or a
+** view itself.
+*/
+static int canview (lua_State *L, TString *ts) {
+  switch (ts->shrlen) {
+    case LSTRREG: case LSTRBUF: case LSTRVIEW: return 1;
+    case LSTRMEM: return (ts->f.falloc == G(L)->frealloc);
+    default: return 0;
+  }
+}
+
+
+/*
+** Create a string with the 'l' bytes of string 'ts' starting at
+** position 'i'. Large enough results are views; others are copies.
+** A substring of a buffer string is not a view, but a buffer string
+** in the same buffer: Buffer strings can move to another buffer
+** (see 'luaS_sealstr'), so a view could not rely on its parent to
+** keep those contents. The buffer is only shared when it is not much
+** larger than the substring, so that the substring cannot keep alive
+** a buffer STRVIEWFACTOR times its size.
+*/
+TString *luaS_sub (lua_State *L, TString *ts, size_t i, size_t l) {
+  TString *v;
+  TString *p;
+  lua_assert(i + l <= tsslen(ts));
+  if (i == 0 && l == tsslen(ts))
+    return ts;  /* whole string */
+  else if (l < LUAI_MINSTRVIEW || !canview(L, ts) ||
+           (isbufstr(ts) && l <= gbuf(ts)->size / STRVIEWFACTOR))
+    return luaS_newlstr(L, getstr(ts) + i, l);  /* copy */
+  else if (isbufstr(ts)) {  /* substring in the same buffer? */
+    v = createstrobj(L, luaS_sizelngstr(l, LSTRBUF), LUA_VLNGSTR,
+                        G(L)->seed);
+    v->shrlen = LSTRBUF;
+    v->u.lnglen = l;
+    v->ud = gbuf(ts);
+    gbuf(ts)->nrefs++;
+    v->contents = ts->contents + i;
+    return v;
+  }
+  v = createstrobj(L, luaS_sizelngstr(l, LSTRVIEW), LUA_VLNGSTR, G(L)->seed);
+  /* (parent computed only now, as a collection may compact 'ts') */
+  p = isviewstr(ts) ? gparent(ts) : ts;
+  v->shrlen = LSTRVIEW;
+  v->u.lnglen = l;
+  v->ud = p;
+  v->contents = ts->contents + i;
+  return v;
+}
+
+
+/*
+** Give view 'ts' a copy of its contents, so that it does not need its
+** parent anymore. Called by the collector, so it cannot raise errors;
+** returns 0 if there is no memory for the copy.
+*/
+int luaS_compactview (lua_State *L, TString *ts) {
+  size_t size = ts->u.lnglen + 1;
+  Strbuf *nb = cast(Strbuf *, luaM_realloc_(L, NULL, 0, sizestrbuf(size)));
+  if (nb == NULL)  /* no memory? */
+    return 0;  /* keep it as a view */
+  nb->size = size;
+  moveto(L, ts, nb);
+  return 1;
+}
+
+
+/*
+** Called when buffer string 'ts' is freed (or moved to another
+** buffer). Frees its buffer if no other string uses it, returning the
+** number of bytes freed.
+*/
+size_t luaS_releasebuf (lua_State *L, TString *ts) {
+  Strbuf *b = gbuf(ts);
+  if (b != NULL && --b->nrefs == 0) {  /* last string using it? */
+    size_t size = sizestrbuf(b->size);
+    luaM_freemem(L, b, size);
+    return size;
+  }
+  return 0;
+}
+
+/* }================================================================== */
+
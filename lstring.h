@@ -42,6 +42,65 @@
                                  (sizeof(s)/sizeof(char))-1))
 
 
+/*
+** Shared buffer for long strings built by repeated concatenation (kind
+** LSTRBUF, with the buffer in field 'ud'). Each such string is a prefix
+** of the buffer contents, except for substrings of those strings (see
+** 'luaS_sub'), which can be any part of it. Bytes before 'used' never
+** change, so the concatenation of a prefix that ends at 'used' with
+** other strings can append them in place, creating a new (longer)
+** string in the same buffer. Buffers are freed when their last string
+** is collected.
+*/
+typedef struct Strbuf {
+  size_t nrefs;  /* number of strings using this buffer */
+  size_t used;  /* number of bytes in use */
+  size_t size;  /* size of 'data' */
+  char data[1];
+} Strbuf;
+
+#define sizestrbuf(n)	(offsetof(Strbuf, data) + (n) * sizeof(char))
+
+#define isbufstr(ts)	((ts)->shrlen == LSTRBUF)
+#define gbuf(ts)	check_exp(isbufstr(ts), cast(Strbuf *, (ts)->ud))
+
+/* check whether buffer string 'ts' ends the used part of its buffer */
+#define endsbuf(ts)  \
+	((ts)->contents + (ts)->u.lnglen == gbuf(ts)->data + gbuf(ts)->used)
+
+
+/*
+** Views (kind LSTRVIEW) are long strings whose contents are part of the
+** contents of another long string, their parent (in field 'ud'). The
+** parent is never a view or a buffer string, and its memory is managed
+** by Lua (see 'canview'). The collector keeps the parent
+** alive while there are views into it, unless the parent is much larger
+** than a view (STRVIEWFACTOR times), in which case the view can get a
+** copy of its contents so that the parent can be collected.
+*/
+#define isviewstr(ts)	((ts)->shrlen == LSTRVIEW)
+#define gparent(ts)	check_exp(isviewstr(ts), cast(TString *, (ts)->ud))
+
+/* minimum length for a substring to be a view */
+#if !defined(LUAI_MINSTRVIEW)
+#define LUAI_MINSTRVIEW		256
+#endif
+
+#if !defined(STRVIEWFACTOR)
+#define STRVIEWFACTOR		4
+#endif
+
+
+/*
+** Buffer strings and views may have no '\0' after their contents, and
+** the end of a buffer string may be overwritten by a later append.
+** 'luaS_seal' makes such a string a proper C string whose contents
+** will not change or move, before its address goes to C code.
+*/
+#define luaS_seal(L,ts)  \
+	((isbufstr(ts) || isviewstr(ts)) ? luaS_sealstr(L, ts) : cast_void(0))
+
+
 /*
 ** test whether a string is a reserved word
 */
@@ -57,6 +116,7 @@
 LUAI_FUNC unsigned luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_movestrtab (lua_State *L, int n);
 LUAI_FUNC void luaS_clearcache (global_State *g);
 LUAI_FUNC void luaS_init (lua_State *L);
 LUAI_FUNC void luaS_remove (lua_State *L, TString *ts);
@@ -69,5 +129,10 @@ LUAI_FUNC TString *luaS_newextlstr (lua_State *L,
 		const char *s, size_t len, lua_Alloc falloc, void *ud);
 LUAI_FUNC size_t luaS_sizelngstr (size_t len, int kind);
 LUAI_FUNC TString *luaS_normstr (lua_State *L, TString *ts);
+LUAI_FUNC TString *luaS_appendbuf (lua_State *L, TString *first, size_t l);
+LUAI_FUNC void luaS_sealstr (lua_State *L, TString *ts);
+LUAI_FUNC size_t luaS_releasebuf (lua_State *L, TString *ts);
+LUAI_FUNC TString *luaS_sub (lua_State *L, TString *ts, size_t i, size_t l);
+LUAI_FUNC int luaS_compactview (lua_State *L, TString *ts);
 
 #endif
@@ -84,11 +84,15 @@ static size_t getendpos (lua_State *L, int arg, lua_Integer def,
 
 static int str_sub (lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
-  size_t start = posrelatI(luaL_checkinteger(L, 2), l);
-  size_t end = getendpos(L, 3, -1, l);
+  size_t start, end;
+  if (lua_type(L, 1) == LUA_TSTRING)  /* (do not need its contents) */
+    l = cast_sizet(lua_rawlen(L, 1));
+  else
+    luaL_checklstring(L, 1, &l);  /* convert it or raise an error */
+  start = posrelatI(luaL_checkinteger(L, 2), l);
+  end = getendpos(L, 3, -1, l);
   if (start <= end)
-    lua_pushlstring(L, s + start - 1, (end - start) + 1);
+    lua_pushsubstring(L, 1, start - 1, (end - start) + 1);
   else lua_pushliteral(L, "");
   return 1;
 }
@@ -362,6 +366,7 @@ typedef struct MatchState {
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
   lua_State *L;
+  int src;  /* stack index of source string */
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   int level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -729,8 +734,9 @@ static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   const char *cap;
   ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
-  if (l != CAP_POSITION)
-    lua_pushlstring(ms->L, cap, cast_sizet(l));
+  if (l != CAP_POSITION)  /* a substring of the source */
+    lua_pushsubstring(ms->L, ms->src, ct_diff2sz(cap - ms->src_init),
+                                      cast_sizet(l));
   /* else position was already pushed */
 }
 
@@ -757,9 +763,10 @@ static int nospecials (const char *p, size_t l) {
 }
 
 
-static void prepstate (MatchState *ms, lua_State *L,
+static void prepstate (MatchState *ms, lua_State *L, int src,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
+  ms->src = src;
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
@@ -799,7 +806,7 @@ static int str_find_aux (lua_State *L, int find) {
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
-    prepstate(&ms, L, s, ls, p, lp);
+    prepstate(&ms, L, 1, s, ls, p, lp);
     do {
       const char *res;
       reprepstate(&ms);
@@ -864,7 +871,8 @@ static int gmatch (lua_State *L) {
   gm = (GMatchState *)lua_newuserdatauv(L, sizeof(GMatchState), 0);
   if (init > ls)  /* start after string's end? */
     init = ls + 1;  /* avoid overflows in 's + init' */
-  prepstate(&gm->ms, L, s, ls, p, lp);
+  /* source will be the first upvalue of 'gmatch_aux' */
+  prepstate(&gm->ms, L, lua_upvalueindex(1), s, ls, p, lp);
   gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
   lua_pushcclosure(L, gmatch_aux, 3);
   return 1;
@@ -962,7 +970,7 @@ static int str_gsub (lua_State *L) {
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
-  prepstate(&ms, L, src, srcl, p, lp);
+  prepstate(&ms, L, 1, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
     reprepstate(&ms);  /* (re)prepare state for new match */
@@ -21,6 +21,9 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** With LUA_USE_SWISSHASH, the hash part uses instead open addressing
+** with an array of control bytes, probed a group at a time (see
+** "Open addressing" below).
 */
 
 #include <math.h>
@@ -40,6 +43,8 @@
 #include "lvm.h"
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 /*
 ** Only hash parts with at least 2^LIMFORLAST have a 'lastfree' field
 ** that optimizes finding a free slot. That field is stored just before
@@ -59,9 +64,98 @@ typedef union {
   char padding[offsetof(Limbox_aux, follows_pNode)];
 } Limbox;
 
-#define haslastfree(t)     ((t)->lsizenode >= LIMFORLAST)
+#define haslastfree(t)     (((t)->lsizenode & MASKLSIZE) >= LIMFORLAST)
 #define getlastfree(t)     ((cast(Limbox *, (t)->node) - 1)->lastfree)
 
+#else
+
+/*
+** With open addressing, each node has a control byte: CTRLEMPTY for a
+** free node or the 7 high bits of the hash of its key ('ctrlbyte').
+** The control bytes follow the array of nodes, in the same block, plus
+** GROUPSIZE - 1 copies of the first ones, so that a group of GROUPSIZE
+** bytes can be read starting at any node. (In hash parts smaller than
+** a group, those copies repeat the whole array.) Lookups compare all
+** bytes in a group at once; with SSE2, using its vector instructions.
+*/
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define GROUPSIZE	16
+
+/* bit mask of the bytes equal to 'b' in the group at 'g' */
+static unsigned matchbyte (const lu_byte *g, lu_byte b) {
+  __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, g));
+  __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(cast(char, b)));
+  return cast_uint(_mm_movemask_epi8(eq));
+}
+
+/* bit mask of the free nodes in the group at 'g' */
+#define matchempty(g)  \
+	cast_uint(_mm_movemask_epi8(_mm_loadu_si128(cast(const __m128i *, g))))
+
+#else
+
+#define GROUPSIZE	8
+
+static unsigned matchbyte (const lu_byte *g, lu_byte b) {
+  unsigned m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++)
+    m |= cast_uint(g[i] == b) << i;
+  return m;
+}
+
+#define matchempty(g)	matchbyte(g, CTRLEMPTY)
+
+#endif
+
+
+/* index of the lowest bit set in a (non-zero) mask */
+#if defined(__GNUC__)
+#define lowbit(m)	cast_uint(__builtin_ctz(m))
+#else
+static unsigned lowbit (unsigned m) {
+  unsigned i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+#define CTRLEMPTY	0x80
+
+#define ctrlbyte(h)	cast_byte((h) >> 25)
+
+
+/*
+** The union 'Swissbox' keeps, just before the array of nodes, the
+** number of free nodes and the longest probe distance (measured in
+** nodes) used by any key in the hash part; a search that reaches that
+** distance can stop. It also ensures that what follows it is properly
+** aligned to store a Node.
+*/
+typedef struct {
+  unsigned int nfree;  /* number of free nodes */
+  unsigned int maxstep;  /* longest probe distance */
+} Swissinfo;
+
+typedef struct { Swissinfo dummy; Node follows_pNode; } Swissbox_aux;
+
+typedef union {
+  Swissinfo u;
+  char padding[offsetof(Swissbox_aux, follows_pNode)];
+} Swissbox;
+
+#define getswiss(t)	(&(cast(Swissbox *, (t)->node) - 1)->u)
+#define getctrl(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* size of the control bytes for a hash part with 'size' nodes */
+#define sizectrl(size)	((size) + GROUPSIZE - 1)
+
+#endif
+
 
 /*
 ** MAXABITS is the largest integer such that 2^MAXABITS fits in an
@@ -127,15 +221,42 @@ typedef union {
 ** part?") when indexing. Its sole node has an empty value and a key
 ** (DEADKEY, NULL) that is different from any valid TValue.
 */
+#if !defined(LUA_USE_SWISSHASH)
+
 static const Node dummynode_ = {
   {{NULL}, LUA_VEMPTY,  /* value's value and type */
    LUA_TDEADKEY, 0, {NULL}}  /* key type, next, and key value */
 };
 
+#else
+
+/*
+** With open addressing, the dummy node comes with its 'Swissbox', with
+** no free nodes, and with its control bytes, all empty.
+*/
+static const struct {
+  Swissbox box;
+  Node node;
+  lu_byte ctrl[16];  /* (GROUPSIZE is at most 16) */
+} dummyhash = {
+  {{0, 0}},
+  {{{NULL}, LUA_VEMPTY, LUA_TDEADKEY, 0, {NULL}}},
+  {CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY}
+};
+
+#define dummynode_	(dummyhash.node)
+
+#endif
+
 
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 /*
 ** Hash for integers. To allow a good hash, use the remainder operator
 ** ('%'). If integer fits as a non-negative int, compute an int
@@ -150,6 +271,8 @@ static Node *hashint (const Table *t, lua_Integer i) {
     return hashmod(t, ui);
 }
 
+#endif
+
 
 /*
 ** Hash for floating-point numbers.
@@ -181,6 +304,8 @@ static unsigned l_hashfloat (lua_Number n) {
 #endif
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 /*
 ** returns the 'main' position of an element in a table (that is,
 ** the index of its hash value).
@@ -229,6 +354,100 @@ l_sinline Node *mainpositionfromnode (const Table *t, Node *nd) {
   return mainpositionTV(t, &key);
 }
 
+#else
+
+/*
+** With open addressing, the low bits of a hash give the position where
+** the search for a key starts and its high bits give the control byte
+** of the key, so all its bits must be good. 'mixhash' (the finalizer of
+** MurmurHash3) spreads the original hash over all bits.
+*/
+static l_uint32 mixhash (l_uint32 h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+
+/* hash for integers, folding all their bits into 32 */
+static l_uint32 hashint (lua_Integer i) {
+  lua_Unsigned ui = l_castS2U(i);
+  return mixhash(cast(l_uint32, ui ^ (ui >> 31 >> 1)));
+}
+
+
+#define hashshrstr(ts)	mixhash((ts)->hash)
+
+
+/*
+** returns the hash of a key
+*/
+static l_uint32 hashkey (const TValue *key) {
+  switch (ttypetag(key)) {
+    case LUA_VNUMINT:
+      return hashint(ivalue(key));
+    case LUA_VNUMFLT:
+      return mixhash(l_hashfloat(fltvalue(key)));
+    case LUA_VSHRSTR:
+      return hashshrstr(tsvalue(key));
+    case LUA_VLNGSTR:
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
+    case LUA_VFALSE:
+      return mixhash(0);
+    case LUA_VTRUE:
+      return mixhash(1);
+    case LUA_VLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_VLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+
+/*
+** Set the control byte of node 'i' and its copies.
+*/
+static void setctrl (Table *t, unsigned i, lu_byte b) {
+  lu_byte *ctrl = getctrl(t);
+  unsigned size = sizenode(t);
+  for (; i < sizectrl(size); i += size)
+    ctrl[i] = b;
+}
+
+
+/*
+** Search the hash part of table 't' for a node 'n' satisfying 'cond',
+** among the nodes whose keys have hash 'h'. The search visits groups of
+** nodes following a triangular sequence, which, with sizes that are
+** powers of 2, covers the whole hash part. It stops at a group with a
+** free node, as no key is ever removed from the control bytes, or when
+** it goes beyond the longest probe distance in the table.
+*/
+#define searchhash(t,h,n,cond) {  \
+  const lu_byte *ctrl_ = getctrl(t);  \
+  unsigned mask_ = sizenode(t) - 1u;  \
+  unsigned pos_ = cast_uint(h) & mask_;  \
+  unsigned step_ = 0;  \
+  lu_byte b_ = ctrlbyte(h);  \
+  for (;;) {  \
+    unsigned m_ = matchbyte(ctrl_ + pos_, b_);  \
+    for (; m_ != 0; m_ &= m_ - 1u) {  \
+      n = gnode(t, (pos_ + lowbit(m_)) & mask_);  \
+      if (cond) return gval(n);  \
+    }  \
+    if (matchempty(ctrl_ + pos_) != 0 || step_ >= getswiss(t)->maxstep)  \
+      return &absentkey;  /* not found */  \
+    step_ += GROUPSIZE;  \
+    pos_ = (pos_ + step_) & mask_;  \
+  } }
+
+#endif
+
 
 /*
 ** Check whether key 'k1' is equal to the key in node 'n2'. This
@@ -284,11 +503,31 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
 
 
 /*
-** "Generic" get version. (Not that generic: not valid for integers,
-** which may be in array part, nor for floats with integral values.)
-** See explanation about 'deadok' in function 'equalkey'.
+** Search a table with a shape for a key that is not a short string.
+** Only an external string with the length of a short string can be
+** there, as 'luaH_finishset' internalizes such strings before using
+** them as keys. The key cannot be hashed like a short string without
+** the global state, but shapes are small, so a linear search by
+** contents does the job.
 */
-static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
+static const TValue *getshapedkey (Table *t, const TValue *key) {
+  if (ttislngstring(key) && tsslen(tsvalue(key)) <= LUAI_MAXSHORTLEN) {
+    Shape *s = shapeof(t);
+    unsigned i;
+    for (i = 0; i < s->nkeys; i++) {
+      if (luaS_eqstr(tsvalue(key), gshapekey(s, i)))
+        return &t->slots[i];
+    }
+  }
+  return &absentkey;
+}
+
+
+/*
+** Search the hash part of table 't' for a generic key.
+*/
+static const TValue *gethashkey (Table *t, const TValue *key, int deadok) {
+#if !defined(LUA_USE_SWISSHASH)
   Node *n = mainpositionTV(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (equalkey(key, n, deadok))
@@ -300,6 +539,24 @@ static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
       n += nx;
     }
   }
+#else
+  l_uint32 h = hashkey(key);
+  Node *n;
+  searchhash(t, h, n, equalkey(key, n, deadok));
+#endif
+}
+
+
+/*
+** "Generic" get version. (Not that generic: not valid for integers,
+** which may be in array part, nor for floats with integral values.)
+** See explanation about 'deadok' in function 'equalkey'.
+*/
+static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
+  if (isshaped(t))  /* all keys are in the shape? */
+    return getshapedkey(t, key);
+  else
+    return gethashkey(t, key, deadok);
 }
 
 
@@ -335,6 +592,18 @@ static unsigned keyinarray (Table *t, const TValue *key) {
 }
 
 
+/*
+** Index of an entry in the hash part of table 't', given its value.
+** For a table with a shape, that is the index of the slot.
+*/
+static unsigned slotindex (const Table *t, const TValue *slot) {
+  if (isshaped(t))
+    return cast_uint(slot - t->slots);
+  else
+    return cast_uint(nodefromval(slot) - gnode(t, 0));
+}
+
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
@@ -348,32 +617,84 @@ static unsigned findindex (lua_State *L, Table *t, TValue *key,
   if (i != 0)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
   else {
-    const TValue *n = getgeneric(t, key, 1);
+    const TValue *n = (isshaped(t) && ttisshrstring(key))
+                    ? luaH_Hgetshortstr(t, tsvalue(key))
+                    : getgeneric(t, key, 1);
     if (l_unlikely(isabstkey(n)))
       luaG_runerror(L, "invalid key to 'next'");  /* key not found */
-    i = cast_uint(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
+    i = slotindex(t, n);  /* key index in hash table */
     /* hash elements are numbered after array ones */
     return (i + 1) + asize;
   }
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
+/*
+** Check whether 'c', the cursor of a traversal, gives the position of
+** 'key' in table 't', as 'findindex' would compute it. A cursor is only
+** a hint: it may come from another traversal, another table, or a
+** table that has been resized since, so the key at that position must
+** be compared with 'key'. (This comparison does not need to hash the
+** key, unlike 'findindex'.) Cursors are not used in the array part,
+** where 'findindex' needs no search.
+*/
+static int checkcursor (const Table *t, const TValue *key, unsigned c) {
+  unsigned asize = t->asize;
+  if (c <= asize)  /* no cursor (or in the array part)? */
+    return 0;
+  c -= asize + 1;
+  if (isshaped(t)) {  /* slots? */
+    Shape *s = shapeof(t);
+    return (c < s->nkeys && ttisshrstring(key) &&
+            gshapekey(s, c) == tsvalue(key));
+  }
+  else  /* hash part */
+    return (c < sizenode(t) && !ttisnil(key) &&
+            equalkey(key, gnode(t, c), 1));
+}
+
+
+/*
+** Traversal of table 't': puts at 'key' and 'key + 1' the pair after
+** 'key'. If 'cursor' is not NULL, it keeps the position of 'key' in
+** the table between calls, so that a sequential traversal does not
+** have to search for each key. (Invalid cursors are ignored.)
+*/
+int luaH_next (lua_State *L, Table *t, StkId key, unsigned *cursor) {
   unsigned int asize = t->asize;
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
+  unsigned int i;
+  if (cursor != NULL && checkcursor(t, s2v(key), *cursor))
+    i = *cursor;  /* position of 'key' */
+  else
+    i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
     lu_byte tag = *getArrTag(t, i);
     if (!tagisempty(tag)) {  /* a non-empty entry? */
       setivalue(s2v(key), cast_int(i) + 1);
       farr2val(t, i, tag, s2v(key + 1));
+      if (cursor != NULL) *cursor = 0;  /* no cursor in the array part */
       return 1;
     }
   }
-  for (i -= asize; i < sizenode(t); i++) {  /* hash part */
+  i -= asize;
+  if (isshaped(t)) {  /* slots */
+    Shape *s = shapeof(t);
+    for (; i < s->nkeys; i++) {
+      if (!isempty(&t->slots[i])) {  /* a non-empty entry? */
+        setsvalue2s(L, key, gshapekey(s, i));
+        setobj2s(L, key + 1, &t->slots[i]);
+        if (cursor != NULL) *cursor = asize + i + 1;
+        return 1;
+      }
+    }
+    return 0;  /* no more elements */
+  }
+  for (; i < sizenode(t); i++) {  /* hash part */
     if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
+      if (cursor != NULL) *cursor = asize + i + 1;
       return 1;
     }
   }
@@ -381,6 +702,8 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
 }
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 /* Extra space in Node array if it has a lastfree entry */
 #define extraLastfree(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
 
@@ -389,6 +712,19 @@ static size_t sizehash (Table *t) {
   return cast_sizet(sizenode(t)) * sizeof(Node) + extraLastfree(t);
 }
 
+#else
+
+/* Extra space in Node array: its 'Swissbox' */
+#define extraLastfree(t)	sizeof(Swissbox)
+
+/* 'node' size in bytes, including the control bytes */
+static size_t sizehash (Table *t) {
+  return cast_sizet(sizenode(t)) * sizeof(Node) + sizeof(Swissbox) +
+         sizectrl(cast_sizet(sizenode(t)));
+}
+
+#endif
+
 
 static void freehash (lua_State *L, Table *t) {
   if (!isdummy(t)) {
@@ -399,6 +735,272 @@ static void freehash (lua_State *L, Table *t) {
 }
 
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/*
+** Maximum number of keys in a shape. A table that needs more keys
+** in its hash part uses a regular hash. (Positions in 'ShapeKeys' must
+** fit in its byte-sized index.)
+*/
+#if !defined(LUAI_MAXSHAPEKEYS)
+#define LUAI_MAXSHAPEKEYS	32
+#endif
+
+#if LUAI_MAXSHAPEKEYS > 128
+#error "invalid value for LUAI_MAXSHAPEKEYS"
+#endif
+
+
+/*
+** Maximum number of shapes that can extend a given shape. A table that
+** would need yet another one uses a regular hash.
+*/
+#if !defined(LUAI_MAXSHAPEFORKS)
+#define LUAI_MAXSHAPEFORKS	32
+#endif
+
+
+/* size of a 'ShapeKeys' with 'size' keys (plus its index) */
+#define sizeshapekeys(size)  \
+	(offsetof(ShapeKeys, key) + (size) * (sizeof(TString *) + 2))
+
+#define sizeindex(a)	(2u * (a)->size)
+
+
+/* size of the block for 'size' slots */
+#define sizeslotsblock(size)	(sizeof(Shapebox) + (size) * sizeof(TValue))
+
+
+/*
+** Insert 'a->key[i]' into the index of 'a'.
+*/
+static void indexkey (ShapeKeys *a, unsigned i) {
+  unsigned mask = sizeindex(a) - 1u;
+  unsigned h = lmod(a->key[i]->hash, sizeindex(a));
+  while (a->index[h] != 0)
+    h = (h + 1u) & mask;
+  a->index[h] = cast_byte(i + 1u);
+}
+
+
+/*
+** Return the slot of 'key' in shape 's', or -1 if 's' does not have
+** that key.
+*/
+static int shapeslot (const Shape *s, const TString *key) {
+  const ShapeKeys *a = s->keys;
+  if (a != NULL) {  /* not the root shape? */
+    unsigned mask = sizeindex(a) - 1u;
+    unsigned h = lmod(key->hash, sizeindex(a));
+    unsigned p;
+    while ((p = a->index[h]) != 0) {
+      if (a->key[p - 1u] == key)  /* found key? */
+        return (p <= s->nkeys) ? cast_int(p) - 1 : -1;
+      h = (h + 1u) & mask;
+    }
+  }
+  return -1;
+}
+
+
+/*
+** Find the shape that extends 's' with 'key'. (Dead shapes, waiting to
+** be swept, cannot be reused.) A shape found is moved to the front of
+** the list, as it is likely to be used again.
+*/
+static Shape *findshape (global_State *g, Shape *s, TString *key) {
+  Shape **l;
+  for (l = &s->child; *l != NULL; l = &(*l)->sibling) {
+    Shape *c = *l;
+    if (c->key == key && !isdead(g, c)) {
+      *l = c->sibling;  /* move it to the front */
+      c->sibling = s->child;
+      s->child = c;
+      return c;
+    }
+  }
+  return NULL;
+}
+
+
+/*
+** Create a new shape extending 'p' with 'key'. If 'p' was the last
+** shape to add a key to its 'ShapeKeys' and there is room there, the
+** new shape shares it; otherwise, the new shape gets its own copy of
+** the keys of 'p', in the same block as the shape.
+*/
+static Shape *newshape (lua_State *L, Shape *p, TString *key) {
+  ShapeKeys *a = p->keys;
+  GCObject *o;
+  Shape *s;
+  unsigned n = p->nkeys;
+  if (a != NULL && a->n == n && n < a->size) {  /* can share keys? */
+    o = luaC_newobj(L, LUA_VSHAPE, sizeof(Shape));
+    s = gco2sh(o);
+  }
+  else {
+    unsigned size = 4;
+    unsigned i;
+    while (size <= n) size *= 2;
+    o = luaC_newobj(L, LUA_VSHAPE, sizeof(Shape) + sizeshapekeys(size));
+    s = gco2sh(o);
+    a = cast(ShapeKeys *, s + 1);
+    a->size = size;
+    a->index = cast(lu_byte *, &a->key[size]);
+    memset(a->index, 0, sizeindex(a));
+    for (i = 0; i < n; i++) {  /* copy keys from 'p' */
+      a->key[i] = gshapekey(p, i);
+      indexkey(a, i);
+    }
+  }
+  a->key[n] = key;
+  indexkey(a, n);
+  a->n = n + 1;
+  s->parent = p;
+  s->child = NULL;
+  s->sibling = p->child;
+  p->child = s;
+  p->nchildren++;
+  s->keys = a;
+  s->key = key;
+  s->nkeys = n + 1;
+  s->nchildren = 0;
+  return s;
+}
+
+
+lu_mem luaH_sizeshape (Shape *s) {
+  ShapeKeys *a = s->keys;
+  if (a == cast(ShapeKeys *, s + 1))  /* keys in the same block? */
+    return sizeof(Shape) + sizeshapekeys(a->size);
+  else
+    return sizeof(Shape);
+}
+
+
+/*
+** Free a shape. Its children, if any, are dead too (a shape keeps its
+** parent alive), and the collector may free them in any order. The
+** keys of the shape are not touched, as other shapes may share them.
+*/
+void luaH_freeshape (lua_State *L, Shape *s) {
+  Shape *p = s->parent;
+  Shape *c;
+  for (c = s->child; c != NULL; c = c->sibling)
+    c->parent = NULL;  /* parent is gone */
+  if (p != NULL) {  /* remove 's' from the list of its parent */
+    Shape **l = &p->child;
+    while (*l != s)
+      l = &(*l)->sibling;
+    *l = s->sibling;
+    p->nchildren--;
+  }
+  luaM_freemem(L, s, luaH_sizeshape(s));
+}
+
+
+/*
+** Change the shape of table 't' to 'ns'.
+*/
+static void setshape (lua_State *L, Table *t, Shape *ns) {
+  shapeof(t) = ns;
+  luaC_objbarrier(L, t, ns);
+}
+
+
+/*
+** Give 't' room for 'size' slots (which must be enough for all its
+** current keys). A table without a shape gets the root shape.
+*/
+static void resizeslots (lua_State *L, Table *t, unsigned size) {
+  Shapebox *nb = cast(Shapebox *, luaM_newblock(L, sizeslotsblock(size)));
+  if (isshaped(t)) {
+    Shapebox *b = getshapebox(t);
+    lua_assert(b->u.shape->nkeys <= size);
+    nb->u.shape = b->u.shape;
+    memcpy(nb + 1, t->slots, b->u.shape->nkeys * sizeof(TValue));
+    luaM_freemem(L, b, sizeslotsblock(b->u.size));
+  }
+  else
+    nb->u.shape = &G(L)->rootshape;
+  nb->u.size = size;
+  t->slots = cast(TValue *, nb + 1);
+}
+
+
+static void freeslots (lua_State *L, Table *t) {
+  Shapebox *b = getshapebox(t);
+  luaM_freemem(L, b, sizeslotsblock(b->u.size));
+  t->slots = NULL;
+}
+
+
+/*
+** Try to add key 'key' with value 'val' to table 't' changing its shape,
+** without allocating memory: The new shape must already exist and the
+** slots must have room for the new value. Without the global state,
+** this function cannot tell directly whether a white shape is dead, but
+** a black shape is alive, and so is a shape with the same white as a
+** white table (which has the current white). Otherwise, or if it would
+** need a barrier, the function lets 'addshape' do the work.
+*/
+static int fastaddshape (Table *t, TString *key, TValue *val) {
+  if (isshaped(t)) {
+    Shape *s = shapeof(t);
+    Shape *c;
+    if (s->nkeys < sizeslots(t)) {
+      for (c = s->child; c != NULL; c = c->sibling) {
+        if (c->key == key) {
+          if (!(isblack(c) ||
+                (iswhite(t) && ((t->marked ^ c->marked) & WHITEBITS) == 0)))
+            break;  /* maybe dead */
+          shapeof(t) = c;
+          setobj2t(cast(lua_State *, NULL), &t->slots[s->nkeys], val);
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Add key 'key' with value 'val' to table 't' changing its shape. If
+** the new shape would be too large or too many shapes already extend
+** the current one, 't' cannot have a shape anymore and the function
+** returns 0.
+*/
+static int addshape (lua_State *L, Table *t, TString *key, TValue *val) {
+  unsigned n = isshaped(t) ? shapeof(t)->nkeys : 0;
+  Shape *s, *ns;
+  if (n >= LUAI_MAXSHAPEKEYS) {
+    setnoshape(t);
+    return 0;
+  }
+  if (!isshaped(t) || n == sizeslots(t))  /* no room for a new value? */
+    resizeslots(L, t, (n == 0) ? 1 : 2 * n);
+  s = shapeof(t);
+  ns = findshape(G(L), s, key);
+  if (ns == NULL) {  /* no such shape yet? */
+    if (s->nchildren >= LUAI_MAXSHAPEFORKS) {
+      setnoshape(t);
+      return 0;
+    }
+    ns = newshape(L, s, key);
+  }
+  setshape(L, t, ns);
+  setobj2t(L, &t->slots[n], val);
+  return 1;
+}
+
+/* }============================================================= */
+
+
 /*
 ** {=============================================================
 ** Rehash
@@ -611,6 +1213,7 @@ static void setnodevector (lua_State *L, Table *t, unsigned size) {
     if (lsize > MAXHBITS || (1 << lsize) > MAXHSIZE)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
+#if !defined(LUA_USE_SWISSHASH)
     if (lsize < LIMFORLAST)  /* no 'lastfree' field? */
       t->node = luaM_newvector(L, size, Node);
     else {
@@ -620,6 +1223,17 @@ static void setnodevector (lua_State *L, Table *t, unsigned size) {
       getlastfree(t) = gnode(t, size);  /* all positions are free */
     }
     t->lsizenode = cast_byte(lsize);
+#else
+    {
+      size_t bsize = size * sizeof(Node) + sizeof(Swissbox) + sizectrl(size);
+      char *node = luaM_newblock(L, bsize);
+      t->node = cast(Node *, node + sizeof(Swissbox));
+      t->lsizenode = cast_byte(lsize);
+      getswiss(t)->nfree = size;  /* all positions are free */
+      getswiss(t)->maxstep = 0;
+      memset(getctrl(t), CTRLEMPTY, sizectrl(size));
+    }
+#endif
     setnodummy(t);
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
@@ -650,20 +1264,45 @@ static void reinserthash (lua_State *L, Table *ot, Table *t) {
 }
 
 
+/*
+** Move the entries in the slots of 't' to its hash part, which then
+** replaces its shape. The keys were referred by the shape, not by the
+** table, so the table needs a barrier for them. (A barrier for each key
+** would not do: A key marked through the shape is black, but it may be
+** younger than an old table.)
+*/
+static void reinsertslots (lua_State *L, Table *t) {
+  Shape *s = shapeof(t);
+  unsigned i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!isempty(&t->slots[i])) {
+      TValue k;
+      setsvalue(L, &k, gshapekey(s, i));
+      newcheckedkey(t, &k, &t->slots[i]);
+    }
+  }
+  luaC_touch(L, t);
+  freeslots(L, t);
+}
+
+
 /*
 ** Exchange the hash part of 't1' and 't2'. (In 'flags', only the
 ** dummy bit must be exchanged: The 'isrealasize' is not related
 ** to the hash part, and the metamethod bits do not change during
-** a resize, so the "real" table can keep their values.)
+** a resize, so the "real" table can keep their values. In 'lsizenode',
+** the bit for the array part stays with each table.)
 */
 static void exchangehashpart (Table *t1, Table *t2) {
   lu_byte lsizenode = t1->lsizenode;
   Node *node = t1->node;
   int bitdummy1 = t1->flags & BITDUMMY;
-  t1->lsizenode = t2->lsizenode;
+  t1->lsizenode = cast_byte((t1->lsizenode & BITARRGC) |
+                            (t2->lsizenode & ~BITARRGC));
   t1->node = t2->node;
   t1->flags = cast_byte((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
-  t2->lsizenode = lsizenode;
+  t2->lsizenode = cast_byte((t2->lsizenode & BITARRGC) |
+                            (lsizenode & ~BITARRGC));
   t2->node = node;
   t2->flags = cast_byte((t2->flags & NOTBITDUMMY) | bitdummy1);
 }
@@ -712,6 +1351,9 @@ static void clearNewSlice (Table *t, unsigned oldasize, unsigned newasize) {
 ** Note that if the new size for the array part ('newasize') is equal to
 ** the old one ('oldasize'), this function will do nothing with that
 ** part.
+** For a table that can have a shape, 'nhsize' is the number of slots
+** to reserve, and the hash part stays empty. A table with a shape that
+** cannot keep it moves its slots to the new hash part.
 */
 void luaH_resize (lua_State *L, Table *t, unsigned newasize,
                                           unsigned nhsize) {
@@ -720,6 +1362,15 @@ void luaH_resize (lua_State *L, Table *t, unsigned newasize,
   Value *newarray;
   if (newasize > MAXASIZE)
     luaG_runerror(L, "table overflow");
+  if (shapable(t) && nhsize > LUAI_MAXSHAPEKEYS)
+    setnoshape(t);  /* too many keys for a shape */
+  if (shapable(t)) {
+    if (nhsize > (isshaped(t) ? sizeslots(t) : 0))  /* needs more slots? */
+      resizeslots(L, t, twoto(luaO_ceillog2(nhsize)));
+    nhsize = 0;  /* no hash part */
+  }
+  else if (isshaped(t))
+    nhsize += shapeof(t)->nkeys;  /* slots will go to the hash part */
   /* create new hash part with appropriate size into 'newt' */
   newt.flags = 0;
   setnodevector(L, &newt, nhsize);
@@ -744,6 +1395,8 @@ void luaH_resize (lua_State *L, Table *t, unsigned newasize,
   clearNewSlice(t, oldasize, newasize);
   /* re-insert elements from old hash part into new parts */
   reinserthash(L, &newt, t);  /* 'newt' now has the old hash */
+  if (isshaped(t) && !shapable(t))
+    reinsertslots(L, t);
   freehash(L, &newt);  /* free old hash part */
 }
 
@@ -754,10 +1407,46 @@ void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
 }
 
 
+/*
+** Check whether all entries in the array part of table 't' are present.
+** This is a pass over the whole array part (though only over its tags,
+** which are packed in bytes), stopping at the first hole.
+*/
+static int arrayisfull (const Table *t) {
+  unsigned i;
+  for (i = 0; i < t->asize; i++) {
+    if (tagisempty(*getArrTag(t, i)))
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Check whether the new key 'ek' is an append to the array part of
+** table 't' (the index right after the array part, which is full) and
+** it is the only array index outside the array part ('ct' has counted
+** 'ek' and the keys in the hash part).
+*/
+static int isappend (const Table *t, const TValue *ek, const Counters *ct) {
+  return (ct->na == 1 && ttisinteger(ek) &&
+          l_castS2U(ivalue(ek)) == cast(lua_Unsigned, t->asize) + 1u &&
+          arrayisfull(t));
+}
+
+
 /*
 ** Rehash a table. First, count its keys. If there are array indices
 ** outside the array part, compute the new best size for that part.
 ** Then, resize the table.
+** Appends (as in 't[#t + 1] = v') to a full array part skip
+** 'numusearray' and 'computesizes': the array grows to the next power
+** of 2, which is what 'computesizes' would give for it. Checking that
+** the array is full still reads all its tags, so it is not cheaper in
+** order than counting them; but, as the array doubles at each such
+** rehash, appends cost amortized O(1). An array with holes (e.g., a
+** queue that removes elements from its front) gets the usual
+** computation, so that it does not grow without need.
 */
 static void rehash (lua_State *L, Table *t, const TValue *ek) {
   unsigned asize;  /* optimal size for array part */
@@ -776,6 +1465,11 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
     /* no new keys to enter array part; keep it with the same size */
     asize = t->asize;
   }
+  else if (isappend(t, ek, &ct)) {  /* 'ek' goes to the end of the array? */
+    asize = twoto(luaO_ceillog2(t->asize + 1u));
+    if (asize > MAXASIZE)
+      asize = MAXASIZE;
+  }
   else {  /* compute best size for array part */
     numusearray(t, &ct);  /* count keys in array part */
     asize = computesizes(&ct);  /* compute new size for array part */
@@ -787,6 +1481,8 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
        avoid repeated resizings */
     nsize += nsize >> 2;
   }
+  if (nsize > 0)  /* some key will go to the hash part? */
+    setnoshape(t);  /* then it cannot be in a shape */
   /* resize the table to new computed sizes */
   luaH_resize(L, t, asize, nsize);
 }
@@ -803,6 +1499,7 @@ Table *luaH_new (lua_State *L) {
   t->flags = maskflags;  /* table has no metamethod fields */
   t->array = NULL;
   t->asize = 0;
+  t->slots = NULL;
   setnodevector(L, t, 0);
   return t;
 }
@@ -812,6 +1509,8 @@ lu_mem luaH_size (Table *t) {
   lu_mem sz = cast(lu_mem, sizeof(Table)) + concretesize(t->asize);
   if (!isdummy(t))
     sz += sizehash(t);
+  if (isshaped(t))
+    sz += sizeslotsblock(sizeslots(t));
   return sz;
 }
 
@@ -821,11 +1520,15 @@ lu_mem luaH_size (Table *t) {
 */
 void luaH_free (lua_State *L, Table *t) {
   freehash(L, t);
+  if (isshaped(t))
+    freeslots(L, t);
   resizearray(L, t, t->asize, 0);
   luaM_free(L, t);
 }
 
 
+#if !defined(LUA_USE_SWISSHASH)
+
 static Node *getfreepos (Table *t) {
   if (haslastfree(t)) {  /* does it have 'lastfree' information? */
     /* look for a spot before 'lastfree', updating 'lastfree' */
@@ -891,9 +1594,66 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
   setnodekey(mp, key);
   lua_assert(isempty(gval(mp)));
   setobj2t(cast(lua_State *, 0), gval(mp), value);
+  sethashgc(t, rawtt(key) | rawtt(value));
+  return 1;
+}
+
+#else
+
+/*
+** Inserts a new key into a hash table, in the first node of its search
+** sequence that is either free or holds an empty entry with the same
+** control byte. (As the table does not contain the key, any node in
+** that sequence holding that key, maybe dead, has an empty value; so,
+** the new key comes before any of them, and 'next' finds it first.)
+** Only nodes that were never used count as free, so that searches can
+** stop at them. Return 0 if could not insert key (there are no free
+** nodes, which is always the case for the dummy node).
+*/
+static int insertkey (Table *t, const TValue *key, TValue *value) {
+  Swissinfo *si = getswiss(t);
+  l_uint32 h = hashkey(key);
+  const lu_byte *ctrl = getctrl(t);
+  unsigned mask = sizenode(t) - 1u;
+  unsigned pos = cast_uint(h) & mask;
+  unsigned step = 0;
+  lu_byte b = ctrlbyte(h);
+  unsigned m;
+  Node *n;
+  /* table cannot already contain the key */
+  lua_assert(isabstkey(getgeneric(t, key, 0)));
+  for (;;) {
+    unsigned mb;
+    m = (si->nfree > 0) ? matchempty(ctrl + pos) : 0;
+    for (mb = matchbyte(ctrl + pos, b); mb != 0; mb &= mb - 1u) {
+      if (isempty(gval(gnode(t, (pos + lowbit(mb)) & mask))))
+        m |= mb & (~mb + 1u);  /* node can be reused */
+    }
+    if (m != 0)  /* found a place? */
+      break;
+    else if (si->nfree == 0 && step >= si->maxstep)
+      return 0;  /* no place for the key */
+    step += GROUPSIZE;
+    pos = (pos + step) & mask;
+  }
+  lua_assert(!isdummy(t));
+  pos = (pos + lowbit(m)) & mask;
+  if (step > si->maxstep)
+    si->maxstep = step;
+  if (getctrl(t)[pos] == CTRLEMPTY) {  /* a free node? */
+    si->nfree--;
+    setctrl(t, pos, b);
+  }
+  n = gnode(t, pos);
+  setnodekey(n, key);
+  lua_assert(isempty(gval(n)));
+  setobj2t(cast(lua_State *, 0), gval(n), value);
+  sethashgc(t, rawtt(key) | rawtt(value));
   return 1;
 }
 
+#endif
+
 
 /*
 ** Insert a key in a table where there is space for that key, the
@@ -914,10 +1674,13 @@ static void newcheckedkey (Table *t, const TValue *key, TValue *value) {
 static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
   if (!ttisnil(value)) {  /* do not insert nil values */
-    int done = insertkey(t, key, value);
-    if (!done) {  /* could not find a free place? */
-      rehash(L, t, key);  /* grow table */
-      newcheckedkey(t, key, value);  /* insert key in grown table */
+    if (!(shapable(t) && ttisshrstring(key) &&
+          addshape(L, t, tsvalue(key), value))) {
+      int done = insertkey(t, key, value);
+      if (!done) {  /* could not find a free place? */
+        rehash(L, t, key);  /* grow table */
+        newcheckedkey(t, key, value);  /* insert key in grown table */
+      }
     }
     luaC_barrierback(L, obj2gco(t), key);
     /* for debugging only: any new key may force an emergency collection */
@@ -927,6 +1690,7 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
 
 
 static const TValue *getintfromhash (Table *t, lua_Integer key) {
+#if !defined(LUA_USE_SWISSHASH)
   Node *n = hashint(t, key);
   lua_assert(!ikeyinarray(t, key));
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -939,6 +1703,12 @@ static const TValue *getintfromhash (Table *t, lua_Integer key) {
     }
   }
   return &absentkey;
+#else
+  l_uint32 h = hashint(key);
+  Node *n;
+  lua_assert(!ikeyinarray(t, key));
+  searchhash(t, h, n, keyisinteger(n) && keyival(n) == key);
+#endif
 }
 
 
@@ -973,8 +1743,14 @@ lu_byte luaH_getint (Table *t, lua_Integer key, TValue *res) {
 ** search function for short strings
 */
 const TValue *luaH_Hgetshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(strisshr(key));
+  if (isshaped(t)) {
+    int i = shapeslot(shapeof(t), key);
+    return (i >= 0) ? &t->slots[i] : &absentkey;
+  }
+#if !defined(LUA_USE_SWISSHASH)
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
@@ -985,6 +1761,12 @@ const TValue *luaH_Hgetshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#else
+  {
+    l_uint32 h = hashshrstr(key);
+    searchhash(t, h, n, keyisshrstr(n) && eqshrstr(keystrval(n), key));
+  }
+#endif
 }
 
 
@@ -993,6 +1775,19 @@ lu_byte luaH_getshortstr (Table *t, TString *key, TValue *res) {
 }
 
 
+/*
+** Variant of 'luaH_getshortstr' for an inline-cache miss: it also
+** updates the cache 'ic' with the node where the key was found.
+*/
+lu_byte luaH_getshortstrIC (Table *t, TString *key, TValue *res,
+                                      unsigned *ic) {
+  const TValue *slot = luaH_Hgetshortstr(t, key);
+  if (!isabstkey(slot))
+    *ic = slotindex(t, slot) + 1u;
+  return finishnodeget(slot, res);
+}
+
+
 static const TValue *Hgetlongstr (Table *t, TString *key) {
   TValue ko;
   lua_assert(!strisshr(key));
@@ -1049,14 +1844,15 @@ lu_byte luaH_get (Table *t, const TValue *key, TValue *res) {
 static int retpsetcode (Table *t, const TValue *slot) {
   if (isabstkey(slot))
     return HNOTFOUND;  /* no slot with that key */
-  else  /* return node encoded */
-    return cast_int((cast(Node*, slot) - t->node)) + HFIRSTNODE;
+  else  /* return node (or slot) encoded */
+    return cast_int(slotindex(t, slot)) + HFIRSTNODE;
 }
 
 
 static int finishnodeset (Table *t, const TValue *slot, TValue *val) {
   if (!ttisnil(slot)) {
     setobj(((lua_State*)NULL), cast(TValue*, slot), val);
+    sethashgc(t, rawtt(val));
     return HOK;  /* success */
   }
   else
@@ -1064,11 +1860,12 @@ static int finishnodeset (Table *t, const TValue *slot, TValue *val) {
 }
 
 
-static int rawfinishnodeset (const TValue *slot, TValue *val) {
+static int rawfinishnodeset (Table *t, const TValue *slot, TValue *val) {
   if (isabstkey(slot))
     return 0;  /* no slot with that key */
   else {
     setobj(((lua_State*)NULL), cast(TValue*, slot), val);
+    sethashgc(t, rawtt(val));
     return 1;  /* success */
   }
 }
@@ -1099,6 +1896,7 @@ int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
   const TValue *slot = luaH_Hgetshortstr(t, key);
   if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
     setobj(((lua_State*)NULL), cast(TValue*, slot), val);  /* update it */
+    sethashgc(t, rawtt(val));
     return HOK;  /* done */
   }
   else if (checknoTM(t->metatable, TM_NEWINDEX)) {  /* no metamethod? */
@@ -1108,7 +1906,8 @@ int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
        !(isblack(t) && iswhite(key))) {  /* and don't need barrier? */
       TValue tk;  /* key as a TValue */
       setsvalue(cast(lua_State *, NULL), &tk, key);
-      if (insertkey(t, &tk, val)) {  /* insert key, if there is space */
+      if (shapable(t) ? fastaddshape(t, key, val)  /* insert key... */
+                      : insertkey(t, &tk, val)) {  /* ...if there is space */
         invalidateTMcache(t);
         return HOK;
       }
@@ -1178,8 +1977,11 @@ void luaH_finishset (lua_State *L, Table *t, const TValue *key,
     }
     luaH_newkey(L, t, key, value);
   }
-  else if (hres > 0) {  /* regular Node? */
-    setobj2t(L, gval(gnode(t, hres - HFIRSTNODE)), value);
+  else if (hres > 0) {  /* regular Node (or slot)? */
+    int i = hres - HFIRSTNODE;
+    TValue *slot = isshaped(t) ? &t->slots[i] : gval(gnode(t, i));
+    setobj2t(L, slot, value);
+    sethashgc(t, rawtt(value));
   }
   else {  /* array entry */
     hres = ~hres;  /* real index */
@@ -1208,7 +2010,7 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
   if (ik > 0)
     obj2arr(t, ik - 1, value);
   else {
-    int ok = rawfinishnodeset(getintfromhash(t, key), value);
+    int ok = rawfinishnodeset(t, getintfromhash(t, key), value);
     if (!ok) {
       TValue k;
       setivalue(&k, key);
@@ -1349,7 +2151,11 @@ lua_Unsigned luaH_getn (lua_State *L, Table *t) {
 /* export this function for the test library */
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if !defined(LUA_USE_SWISSHASH)
   return mainpositionTV(t, key);
+#else
+  return gnode(t, lmod(hashkey(key), sizenode(t)));
+#endif
 }
 
 #endif
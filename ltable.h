@@ -45,6 +45,86 @@
 #define nodefromval(v)	cast(Node *, (v))
 
 
+/*
+** Bits BITARRGC and BITHASHGC in 'lsizenode' mean that the array part
+** and the hash part, respectively, may have collectable values (or
+** keys). Storing a collectable value sets them; the collector skips a
+** part whose bit is clear, and clears the bit of a part where it finds
+** nothing to mark. (BITARRGC is equal to BIT_ISCOLLECTABLE, so that the
+** tag of a value sets it directly.)
+*/
+#define BITARRGC		BIT_ISCOLLECTABLE
+#define BITHASHGC		(1 << 7)
+
+#define arrmaygc(t)		((t)->lsizenode & BITARRGC)
+#define hashmaygc(t)		((t)->lsizenode & BITHASHGC)
+
+#define setarrgc(t,tt)	((t)->lsizenode |= cast_byte((tt) & BITARRGC))
+#define sethashgc(t,tt)  \
+	((t)->lsizenode |= cast_byte(((tt) & BIT_ISCOLLECTABLE) << 1))
+
+#define cleararrgc(t)		((t)->lsizenode &= cast_byte(~BITARRGC))
+#define clearhashgc(t)		((t)->lsizenode &= cast_byte(~BITHASHGC))
+
+
+/*
+** Bit BITNOSHAPE set in 'flags' means the table cannot have a shape,
+** because its hash part has (or had) keys that do not fit in one.
+*/
+#define BITNOSHAPE		(1 << 7)
+#define setnoshape(t)		((t)->flags |= BITNOSHAPE)
+
+
+/*
+** With LUA_USE_SHAPES, a table with a shape keeps the values of its
+** short-string keys in 'slots', and its hash part is the dummy node.
+** A table can get a shape while it has no other keys in its hash part.
+*/
+#if defined(LUA_USE_SHAPES)
+#define isshaped(t)	((t)->slots != NULL)
+#define shapable(t)  \
+	(!((t)->flags & BITNOSHAPE) && (isshaped(t) || isdummy(t)))
+#else
+#define isshaped(t)	0
+#define shapable(t)	0
+#endif
+
+
+/*
+** Keys of shapes. Shapes along a path in the tree of shapes share the
+** same 'ShapeKeys', each one using a prefix of 'key'; the first shape
+** in that path keeps it in its own block. Keys are only appended, so
+** that a shape never changes the keys of another. 'index' is a hash
+** index for 'key', with '2*size' entries holding positions plus one
+** (zero means an empty entry).
+*/
+typedef struct ShapeKeys {
+  unsigned int n;  /* number of keys in use */
+  unsigned int size;  /* size of 'key' */
+  lu_byte *index;
+  TString *key[1];
+} ShapeKeys;
+
+#define gshapekey(s,i)	((s)->keys->key[i])
+
+
+/*
+** The shape of a table and the number of its slots are kept in the
+** same block as the slots, just before them.
+*/
+typedef union {
+  struct {
+    Shape *shape;
+    unsigned int size;  /* number of slots */
+  } u;
+  TValue dummy;  /* ensures proper alignment for the slots */
+} Shapebox;
+
+#define getshapebox(t)	(cast(Shapebox *, (t)->slots) - 1)
+#define shapeof(t)	(getshapebox(t)->u.shape)
+#define sizeslots(t)	(getshapebox(t)->u.size)
+
+
 
 #define luaH_fastgeti(t,k,res,tag) \
   { Table *h = t; lua_Unsigned u = l_castS2U(k) - 1u; \
@@ -64,6 +144,27 @@
     else { hres = luaH_psetint(h, k, val); }}
 
 
+/*
+** Inline caches: an inline cache 'ic' keeps the index (plus one) of
+** the node (or the slot, for a table with a shape) where an instruction
+** found its short-string key the last time. 'luaH_icslot' gives the
+** value there, if it still belongs to key 'k' and is not empty in table
+** 't', or NULL otherwise. (An empty cache, with value 0, wraps around
+** to an index larger than any valid one.)
+*/
+#define luaH_icslot(t,k,ic)  (isshaped(t) ? icshape(t,k,ic) : icnode(t,k,ic))
+
+#define icnode(t,k,ic) \
+  ((ic) - 1u < sizenode(t) && keyisshrstr(gnode(t, (ic) - 1u)) && \
+   keystrval(gnode(t, (ic) - 1u)) == (k) && \
+   !isempty(gval(gnode(t, (ic) - 1u))) ? gval(gnode(t, (ic) - 1u)) : NULL)
+
+#define icshape(t,k,ic) \
+  ((ic) - 1u < shapeof(t)->nkeys && \
+   gshapekey(shapeof(t), (ic) - 1u) == (k) && \
+   !isempty(&(t)->slots[(ic) - 1u]) ? &(t)->slots[(ic) - 1u] : NULL)
+
+
 /* results from pset */
 #define HOK		0
 #define HNOTFOUND	1
@@ -131,7 +232,8 @@
   ((val)->tt_ = *getArrTag(h,(k)), (val)->value_ = *getArrVal(h,(k)))
 
 #define obj2arr(h,k,val)  \
-  (*getArrTag(h,(k)) = (val)->tt_, *getArrVal(h,(k)) = (val)->value_)
+  (*getArrTag(h,(k)) = (val)->tt_, setarrgc(h, (val)->tt_), \
+   *getArrVal(h,(k)) = (val)->value_)
 
 
 /*
@@ -143,11 +245,14 @@
   ((res)->tt_ = tag, (res)->value_ = *getArrVal(h,(k)))
 
 #define fval2arr(h,k,tag,val)  \
-  (*tag = (val)->tt_, *getArrVal(h,(k)) = (val)->value_)
+  (*tag = (val)->tt_, setarrgc(h, (val)->tt_), \
+   *getArrVal(h,(k)) = (val)->value_)
 
 
 LUAI_FUNC lu_byte luaH_get (Table *t, const TValue *key, TValue *res);
 LUAI_FUNC lu_byte luaH_getshortstr (Table *t, TString *key, TValue *res);
+LUAI_FUNC lu_byte luaH_getshortstrIC (Table *t, TString *key, TValue *res,
+                                                 unsigned *ic);
 LUAI_FUNC lu_byte luaH_getstr (Table *t, TString *key, TValue *res);
 LUAI_FUNC lu_byte luaH_getint (Table *t, lua_Integer key, TValue *res);
 
@@ -172,8 +277,11 @@ LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned nasize,
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned nasize);
 LUAI_FUNC lu_mem luaH_size (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
-LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key,
+                                             unsigned *cursor);
 LUAI_FUNC lua_Unsigned luaH_getn (lua_State *L, Table *t);
+LUAI_FUNC lu_mem luaH_sizeshape (Shape *s);
+LUAI_FUNC void luaH_freeshape (lua_State *L, Shape *s);
 
 
 #if defined(LUA_DEBUG)
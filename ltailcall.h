@@ -0,0 +1,282 @@
+/*
+** $Id: ltailcall.h $
+** Tail-call dispatch for the Lua interpreter
+** See Copyright Notice in lua.h
+*/
+
+/*
+** Each opcode is executed by its own function (a "handler"), and each
+** handler goes to the handler of the next instruction through a
+** guaranteed tail call. All handlers get the interpreter state in
+** their parameters, so that it stays in registers across instructions.
+** The current CallInfo is always 'L->ci'.
+*/
+
+#define vmparams  \
+	lua_State *L, TValue *k, StkId base, const Instruction *pc,  \
+	int trap, Instruction i
+
+#define vmargs		L, k, base, pc, trap, i
+
+typedef void (*VMHandler) (vmparams);
+
+#define vmtailcall(h)	l_musttail return (h)(vmargs)
+
+
+#undef vmfetch
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+#undef vmlabel
+#undef vmgoto
+
+/*
+** Hooks and stack reallocations are handled by 'h_trap', which is kept
+** out of line so that handlers do not need a stack frame for them.
+*/
+#define vmfetch()	{ if (l_unlikely(trap)) vmtailcall(h_trap); i = *(pc++); }
+
+#if defined(__GNUC__)
+#define l_noinline	__attribute__((noinline))
+#else
+#define l_noinline	/* empty */
+#endif
+
+#define vmdispatch(x)     { vmcheck(); vmtailcall(disptab[x]); }
+
+/*
+** Each case closes the handler of the previous case and opens its own
+** handler, where the case code runs as an inner block.
+*/
+#define vmcase(l)  \
+	} static void h_##l (vmparams) {  \
+	  CallInfo *ci = L->ci; LClosure *cl = ci_func(ci);  \
+	  cast_void(ci); cast_void(cl);
+
+#define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
+
+#define vmlabel(l)	/* empty */
+
+#define vmgoto(l)	vmtailcall(h_##l)
+
+
+l_noinline static void h_trap (vmparams);
+static void h_startfunc (vmparams);
+static void h_returning (vmparams);
+
+#if 0
+** you can update the following lists with these commands:
+**
+**  sed -n '/^OP_/!d; s/[,/ \t].*// ; s/.*/static void h_& (vmparams);/ ; p'  lopcodes.h
+**  sed -n '/^OP_/!d; s/OP_/h_OP_/ ; s/,.*/,/ ; s/\/.*// ; p'  lopcodes.h
+**
+#endif
+
+static void h_OP_MOVE (vmparams);
+static void h_OP_LOADI (vmparams);
+static void h_OP_LOADF (vmparams);
+static void h_OP_LOADK (vmparams);
+static void h_OP_LOADKX (vmparams);
+static void h_OP_LOADFALSE (vmparams);
+static void h_OP_LFALSESKIP (vmparams);
+static void h_OP_LOADTRUE (vmparams);
+static void h_OP_LOADNIL (vmparams);
+static void h_OP_GETUPVAL (vmparams);
+static void h_OP_SETUPVAL (vmparams);
+static void h_OP_GETTABUP (vmparams);
+static void h_OP_GETTABLE (vmparams);
+static void h_OP_GETI (vmparams);
+static void h_OP_GETFIELD (vmparams);
+static void h_OP_SETTABUP (vmparams);
+static void h_OP_SETTABLE (vmparams);
+static void h_OP_SETI (vmparams);
+static void h_OP_SETFIELD (vmparams);
+static void h_OP_NEWTABLE (vmparams);
+static void h_OP_SELF (vmparams);
+static void h_OP_ADDI (vmparams);
+static void h_OP_ADDK (vmparams);
+static void h_OP_SUBK (vmparams);
+static void h_OP_MULK (vmparams);
+static void h_OP_MODK (vmparams);
+static void h_OP_POWK (vmparams);
+static void h_OP_DIVK (vmparams);
+static void h_OP_IDIVK (vmparams);
+static void h_OP_BANDK (vmparams);
+static void h_OP_BORK (vmparams);
+static void h_OP_BXORK (vmparams);
+static void h_OP_SHLI (vmparams);
+static void h_OP_SHRI (vmparams);
+static void h_OP_ADD (vmparams);
+static void h_OP_SUB (vmparams);
+static void h_OP_MUL (vmparams);
+static void h_OP_MOD (vmparams);
+static void h_OP_POW (vmparams);
+static void h_OP_DIV (vmparams);
+static void h_OP_IDIV (vmparams);
+static void h_OP_BAND (vmparams);
+static void h_OP_BOR (vmparams);
+static void h_OP_BXOR (vmparams);
+static void h_OP_SHL (vmparams);
+static void h_OP_SHR (vmparams);
+static void h_OP_MMBIN (vmparams);
+static void h_OP_MMBINI (vmparams);
+static void h_OP_MMBINK (vmparams);
+static void h_OP_UNM (vmparams);
+static void h_OP_BNOT (vmparams);
+static void h_OP_NOT (vmparams);
+static void h_OP_LEN (vmparams);
+static void h_OP_CONCAT (vmparams);
+static void h_OP_CLOSE (vmparams);
+static void h_OP_TBC (vmparams);
+static void h_OP_JMP (vmparams);
+static void h_OP_EQ (vmparams);
+static void h_OP_LT (vmparams);
+static void h_OP_LE (vmparams);
+static void h_OP_EQK (vmparams);
+static void h_OP_EQI (vmparams);
+static void h_OP_LTI (vmparams);
+static void h_OP_LEI (vmparams);
+static void h_OP_GTI (vmparams);
+static void h_OP_GEI (vmparams);
+static void h_OP_TEST (vmparams);
+static void h_OP_TESTSET (vmparams);
+static void h_OP_CALL (vmparams);
+static void h_OP_TAILCALL (vmparams);
+static void h_OP_RETURN (vmparams);
+static void h_OP_RETURN0 (vmparams);
+static void h_OP_RETURN1 (vmparams);
+static void h_OP_FORLOOP (vmparams);
+static void h_OP_FORPREP (vmparams);
+static void h_OP_TFORPREP (vmparams);
+static void h_OP_TFORCALL (vmparams);
+static void h_OP_TFORLOOP (vmparams);
+static void h_OP_SETLIST (vmparams);
+static void h_OP_CLOSURE (vmparams);
+static void h_OP_VARARG (vmparams);
+static void h_OP_GETVARG (vmparams);
+static void h_OP_ERRNNIL (vmparams);
+static void h_OP_VARARGPREP (vmparams);
+static void h_OP_EXTRAARG (vmparams);
+static void h_OP_ADDINT (vmparams);
+static void h_OP_ADDFLT (vmparams);
+static void h_OP_SUBINT (vmparams);
+static void h_OP_SUBFLT (vmparams);
+static void h_OP_MULINT (vmparams);
+static void h_OP_MULFLT (vmparams);
+static void h_OP_LTINT (vmparams);
+static void h_OP_LTFLT (vmparams);
+static void h_OP_LEINT (vmparams);
+static void h_OP_LEFLT (vmparams);
+static void h_OP_MOVE2 (vmparams);
+static void h_OP_MOVECALL (vmparams);
+static void h_OP_UPVALMOVE (vmparams);
+static void h_OP_TABUPFIELD (vmparams);
+static void h_OP_GETFIELD2 (vmparams);
+static void h_OP_SETFIELD2 (vmparams);
+
+
+static const VMHandler disptab[NUM_OPCODES] = {
+
+h_OP_MOVE,
+h_OP_LOADI,
+h_OP_LOADF,
+h_OP_LOADK,
+h_OP_LOADKX,
+h_OP_LOADFALSE,
+h_OP_LFALSESKIP,
+h_OP_LOADTRUE,
+h_OP_LOADNIL,
+h_OP_GETUPVAL,
+h_OP_SETUPVAL,
+h_OP_GETTABUP,
+h_OP_GETTABLE,
+h_OP_GETI,
+h_OP_GETFIELD,
+h_OP_SETTABUP,
+h_OP_SETTABLE,
+h_OP_SETI,
+h_OP_SETFIELD,
+h_OP_NEWTABLE,
+h_OP_SELF,
+h_OP_ADDI,
+h_OP_ADDK,
+h_OP_SUBK,
+h_OP_MULK,
+h_OP_MODK,
+h_OP_POWK,
+h_OP_DIVK,
+h_OP_IDIVK,
+h_OP_BANDK,
+h_OP_BORK,
+h_OP_BXORK,
+h_OP_SHLI,
+h_OP_SHRI,
+h_OP_ADD,
+h_OP_SUB,
+h_OP_MUL,
+h_OP_MOD,
+h_OP_POW,
+h_OP_DIV,
+h_OP_IDIV,
+h_OP_BAND,
+h_OP_BOR,
+h_OP_BXOR,
+h_OP_SHL,
+h_OP_SHR,
+h_OP_MMBIN,
+h_OP_MMBINI,
+h_OP_MMBINK,
+h_OP_UNM,
+h_OP_BNOT,
+h_OP_NOT,
+h_OP_LEN,
+h_OP_CONCAT,
+h_OP_CLOSE,
+h_OP_TBC,
+h_OP_JMP,
+h_OP_EQ,
+h_OP_LT,
+h_OP_LE,
+h_OP_EQK,
+h_OP_EQI,
+h_OP_LTI,
+h_OP_LEI,
+h_OP_GTI,
+h_OP_GEI,
+h_OP_TEST,
+h_OP_TESTSET,
+h_OP_CALL,
+h_OP_TAILCALL,
+h_OP_RETURN,
+h_OP_RETURN0,
+h_OP_RETURN1,
+h_OP_FORLOOP,
+h_OP_FORPREP,
+h_OP_TFORPREP,
+h_OP_TFORCALL,
+h_OP_TFORLOOP,
+h_OP_SETLIST,
+h_OP_CLOSURE,
+h_OP_VARARG,
+h_OP_GETVARG,
+h_OP_ERRNNIL,
+h_OP_VARARGPREP,
+h_OP_EXTRAARG,
+h_OP_ADDINT,
+h_OP_ADDFLT,
+h_OP_SUBINT,
+h_OP_SUBFLT,
+h_OP_MULINT,
+h_OP_MULFLT,
+h_OP_LTINT,
+h_OP_LTFLT,
+h_OP_LEINT,
+h_OP_LEFLT,
+h_OP_MOVE2,
+h_OP_MOVECALL,
+h_OP_UPVALMOVE,
+h_OP_TABUPFIELD,
+h_OP_GETFIELD2,
+h_OP_SETFIELD2
+
+};
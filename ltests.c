@@ -25,6 +25,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lopcodes.h"
 #include "lopnames.h"
@@ -208,9 +209,21 @@ static void freeblock (Memcontrol *mc, memHeader *block) {
 }
 
 
-void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
+/*
+** With LUA_USE_GCPAGES, the allocation of pages does not count in the
+** limit of allocations; 'debug_newslot' counts their small blocks.
+*/
+#if defined(LUA_USE_GCPAGES)
+#define isheapblock(b,os)	((b) == NULL && (os) == LUAI_HEAPTAG)
+#else
+#define isheapblock(b,os)	0
+#endif
+
+
+static void *realloc_ (void *ud, void *b, size_t oldsize, size_t size) {
   Memcontrol *mc = cast(Memcontrol *, ud);
   memHeader *block = cast(memHeader *, b);
+  int heap = isheapblock(b, oldsize);
   int type;
   if (mc->memlimit == 0) {  /* first time? */
     char *limit = getenv("MEMLIMIT");  /* initialize memory limit */
@@ -229,11 +242,11 @@ void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
     freeblock(mc, block);
     return NULL;
   }
-  if (mc->failnext) {
+  if (mc->failnext && !heap) {
     mc->failnext = 0;
     return NULL;  /* fake a single memory allocation error */
   }
-  if (mc->countlimit != ~0UL && size != oldsize) {  /* count limit in use? */
+  if (mc->countlimit != ~0UL && size != oldsize && !heap) {  /* limit? */
     if (mc->countlimit == 0)
       return NULL;  /* fake a memory allocation error */
     mc->countlimit--;
@@ -270,6 +283,76 @@ void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
 }
 
 
+#if defined(LUA_USE_PARALLELGC)
+
+#include <pthread.h>
+
+/* the background sweeper frees blocks concurrently with the state */
+static pthread_mutex_t memlock = PTHREAD_MUTEX_INITIALIZER;
+#define lockmem()	pthread_mutex_lock(&memlock)
+#define unlockmem()	pthread_mutex_unlock(&memlock)
+
+#else
+
+#define lockmem()	((void)0)
+#define unlockmem()	((void)0)
+
+#endif
+
+
+void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
+  void *res;
+  lockmem();
+  res = realloc_(ud, b, oldsize, size);
+  unlockmem();
+  return res;
+}
+
+
+/*
+** Called for each new small block from the heap of small blocks (see
+** LUA_USE_GCPAGES in lmem.c), which does not call 'debug_realloc'
+** for them: checks the limit of allocations and counts the objects.
+*/
+int debug_newslot (void *ud, int tag) {
+  Memcontrol *mc = cast(Memcontrol *, ud);
+  int fail = 0;
+  lockmem();
+  if (mc->failnext) {
+    mc->failnext = 0;
+    fail = 1;  /* fake a single memory allocation error */
+  }
+  else if (mc->countlimit != ~0UL) {  /* count limit in use? */
+    if (mc->countlimit == 0)
+      fail = 1;  /* fake a memory allocation error */
+    else
+      mc->countlimit--;
+  }
+  if (!fail)
+    mc->objcount[(tag < LUA_NUMTYPES) ? tag : 0]++;
+  unlockmem();
+  return fail;
+}
+
+
+/* called for each small block given back to the heap of small blocks */
+void debug_freeslot (void *ud, int tag) {
+  Memcontrol *mc = cast(Memcontrol *, ud);
+  lockmem();
+  mc->objcount[tag]--;
+  unlockmem();
+}
+
+
+lua_State *debug_newstate (void) {
+  lua_State *L = lua_newstate(debug_realloc, &l_memcontrol,
+                              luaL_makeseed(NULL));
+  if (L != NULL)
+    lua_setallocsafe(L, 1);  /* 'debug_realloc' is thread safe */
+  return L;
+}
+
+
 /* }====================================================================== */
 
 
@@ -294,6 +377,16 @@ void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
 ** continue to be visited in all collections, and therefore can point to
 ** new objects. They, and only they, are old but gray.)
 */
+static int isremembered (global_State *g, GCObject *o) {
+  int i;
+  for (i = 0; i < g->nremset; i++) {
+    if (g->remset[i] == o)
+      return 1;
+  }
+  return 0;
+}
+
+
 static int testobjref1 (global_State *g, GCObject *f, GCObject *t) {
   if (isdead(g,t)) return 0;
   if (issweepphase(g))
@@ -302,7 +395,7 @@ static int testobjref1 (global_State *g, GCObject *f, GCObject *t) {
     return !(isblack(f) && iswhite(t));  /* basic incremental invariant */
   else {  /* generational mode */
     if ((getage(f) == G_OLD && isblack(f)) && !isold(t))
-      return 0;
+      return isremembered(g, t);  /* young object in an old table? */
     if ((getage(f) == G_OLD1 || getage(f) == G_TOUCHED2) &&
          getage(t) == G_NEW)
       return 0;
@@ -406,13 +499,23 @@ static void checktable (global_State *g, Table *h) {
   for (i = 0; i < asize; i++) {
     TValue aux;
     arr2obj(h, i, &aux);
+    assert(arrmaygc(h) || !iscollectable(&aux));
     checkvalref(g, hgc, &aux);
   }
+  if (isshaped(h)) {
+    Shape *s = shapeof(h);
+    assert(isdummy(h) && s->nkeys <= sizeslots(h));
+    if (s != &g->rootshape)
+      checkobjref(g, hgc, obj2gco(s));
+    for (i = 0; i < s->nkeys; i++)
+      checkvalref(g, hgc, &h->slots[i]);
+  }
   for (n = gnode(h, 0); n < limit; n++) {
     if (!isempty(gval(n))) {
       TValue k;
       getnodekey(mainthread(g), &k, n);
       assert(!keyisnil(n));
+      assert(hashmaygc(h) || !(iscollectable(&k) || iscollectable(gval(n))));
       checkvalref(g, hgc, &k);
       checkvalref(g, hgc, gval(n));
     }
@@ -429,6 +532,19 @@ static void checkudata (global_State *g, Udata *u) {
 }
 
 
+static void checkshape (global_State *g, Shape *s) {
+  GCObject *sgc = obj2gco(s);
+  unsigned int i;
+  assert(s->parent == NULL || s->parent->nkeys + 1 == s->nkeys);
+  if (s->parent != &g->rootshape)  /* (root is not a collectable object) */
+    checkobjrefN(g, sgc, s->parent);
+  checkobjref(g, sgc, obj2gco(s->key));
+  assert(s->nkeys <= s->keys->n && gshapekey(s, s->nkeys - 1) == s->key);
+  for (i = 0; i < s->nkeys; i++)
+    assert(!isdead(g, obj2gco(gshapekey(s, i))));
+}
+
+
 static void checkproto (global_State *g, Proto *f) {
   int i;
   GCObject *fgc = obj2gco(f);
@@ -532,6 +648,10 @@ static void checkrefs (global_State *g, GCObject *o) {
       checkproto(g, gco2p(o));
       break;
     }
+    case LUA_VSHAPE: {
+      checkshape(g, gco2sh(o));
+      break;
+    }
     case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
       assert(!isgray(o));  /* strings are never gray */
@@ -719,10 +839,14 @@ int lua_checkmemory (lua_State *L) {
 */
 
 
-static char *buildop (Proto *p, int pc, char *buff) {
+/*
+** Build a description of an instruction. Unless 'quick' is true,
+** quickened opcodes are shown as their generic versions.
+*/
+static char *buildop (Proto *p, int pc, char *buff, int quick) {
   char *obuff = buff;
   Instruction i = p->code[pc];
-  OpCode o = GET_OPCODE(i);
+  OpCode o = (quick) ? GET_OPCODE(i) : luaP_genop(GET_OPCODE(i));
   const char *name = opnames[o];
   int line = luaG_getfuncline(p, pc);
   int lineinfo = (p->lineinfo != NULL) ? p->lineinfo[pc] : 0;
@@ -764,7 +888,7 @@ void luaI_printcode (Proto *pt, int size) {
   int pc;
   for (pc=0; pc<size; pc++) {
     char buff[100];
-    printf("%s\n", buildop(pt, pc, buff));
+    printf("%s\n", buildop(pt, pc, buff, 1));
   }
   printf("-------\n");
 }
@@ -772,7 +896,7 @@ void luaI_printcode (Proto *pt, int size) {
 
 void luaI_printinst (Proto *pt, int pc) {
   char buff[100];
-  printf("%s\n", buildop(pt, pc, buff));
+  printf("%s\n", buildop(pt, pc, buff, 1));
 }
 #endif
 
@@ -780,6 +904,7 @@ void luaI_printinst (Proto *pt, int pc) {
 static int listcode (lua_State *L) {
   int pc;
   Proto *p;
+  int quick = lua_toboolean(L, 2);  /* show quickened opcodes? */
   luaL_argcheck(L, lua_isfunction(L, 1) && !lua_iscfunction(L, 1),
                  1, "Lua function expected");
   p = getproto(obj_at(L, 1));
@@ -789,7 +914,7 @@ static int listcode (lua_State *L) {
   for (pc=0; pc<p->sizecode; pc++) {
     char buff[100];
     lua_pushinteger(L, pc+1);
-    lua_pushstring(L, buildop(p, pc, buff));
+    lua_pushstring(L, buildop(p, pc, buff, quick));
     lua_settable(L, -3);
   }
   return 1;
@@ -799,6 +924,7 @@ static int listcode (lua_State *L) {
 static int printcode (lua_State *L) {
   int pc;
   Proto *p;
+  int quick = lua_toboolean(L, 2);  /* show quickened opcodes? */
   luaL_argcheck(L, lua_isfunction(L, 1) && !lua_iscfunction(L, 1),
                  1, "Lua function expected");
   p = getproto(obj_at(L, 1));
@@ -806,7 +932,7 @@ static int printcode (lua_State *L) {
   printf("numparams: %d\n", p->numparams);
   for (pc=0; pc<p->sizecode; pc++) {
     char buff[100];
-    printf("%s\n", buildop(p, pc, buff));
+    printf("%s\n", buildop(p, pc, buff, quick));
   }
   return 0;
 }
@@ -1115,7 +1241,8 @@ static int table_query (lua_State *L) {
   asize = t->asize;
   if (i == -1) {
     lua_pushinteger(L, cast_Integer(asize));
-    lua_pushinteger(L, cast_Integer(allocsizenode(t)));
+    lua_pushinteger(L, cast_Integer(isshaped(t) ? sizeslots(t)
+                                                : allocsizenode(t)));
     lua_pushinteger(L, cast_Integer(asize > 0 ? *lenhint(t) : 0));
     return 3;
   }
@@ -1128,6 +1255,22 @@ static int table_query (lua_State *L) {
     api_incr_top(L);
     lua_pushnil(L);
   }
+  else if (isshaped(t)) {  /* slots */
+    const Shape *s = shapeof(t);
+    if (cast_uint(i -= cast_int(asize)) < s->nkeys) {
+      setsvalue2s(L, L->top.p, gshapekey(s, i));
+      api_incr_top(L);
+      if (!isempty(&t->slots[i]))
+        pushobject(L, &t->slots[i]);
+      else
+        lua_pushnil(L);
+    }
+    else {  /* free slot */
+      lua_pushnil(L);
+      lua_pushnil(L);
+    }
+    lua_pushinteger(L, 0);
+  }
   else if (cast_uint(i -= cast_int(asize)) < sizenode(t)) {
     TValue k;
     getnodekey(L, &k, gnode(t, i));
@@ -1142,7 +1285,11 @@ static int table_query (lua_State *L) {
       pushobject(L, gval(gnode(t, i)));
     else
       lua_pushnil(L);
+#if !defined(LUA_USE_SWISSHASH)
     lua_pushinteger(L, gnext(&t->node[i]));
+#else
+    lua_pushinteger(L, 0);  /* there are no chains */
+#endif
   }
   return 3;
 }
@@ -1177,18 +1324,29 @@ static int test_applyparam (lua_State *L) {
 }
 
 
+/*
+** Without arguments, return the size and the number of elements of the
+** string table, plus the size of its previous array and how many of its
+** buckets were moved, if it is being resized. With an index 'i', return
+** the strings in the i-th bucket of the string table or, if 'old' is
+** true, in the i-th bucket not moved yet of the previous array. This
+** query does not change the table; see 'string_move'.
+*/
 static int string_query (lua_State *L) {
   stringtable *tb = &G(L)->strt;
   int s = cast_int(luaL_optinteger(L, 1, 0)) - 1;
+  int old = lua_toboolean(L, 2);
   if (s == -1) {
     lua_pushinteger(L ,tb->size);
     lua_pushinteger(L ,tb->nuse);
-    return 2;
+    lua_pushinteger(L ,tb->oldsize);
+    lua_pushinteger(L ,tb->moved);
+    return 4;
   }
-  else if (s < tb->size) {
-    TString *ts;
+  else if (old ? (tb->moved <= s && s < tb->oldsize) : s < tb->size) {
+    TString *ts = old ? tb->old[s] : tb->hash[s];
     int n = 0;
-    for (ts = tb->hash[s]; ts != NULL; ts = ts->u.hnext) {
+    for (; ts != NULL; ts = ts->u.hnext) {
       setsvalue2s(L, L->top.p, ts);
       api_incr_top(L);
       n++;
@@ -1199,6 +1357,17 @@ static int string_query (lua_State *L) {
 }
 
 
+/*
+** Move up to 'n' (default all) buckets of the string table being
+** resized to its new array.
+*/
+static int string_move (lua_State *L) {
+  lua_Integer n = luaL_optinteger(L, 1, INT_MAX);
+  luaS_movestrtab(L, (n < INT_MAX) ? cast_int(n) : INT_MAX);
+  return 0;
+}
+
+
 static int getreftable (lua_State *L) {
   if (lua_istable(L, 2))  /* is there a table as second argument? */
     return 2;  /* use it as the table */
@@ -2174,6 +2343,7 @@ static const struct luaL_Reg tests_funcs[] = {
   {"pushuserdata", pushuserdata},
   {"gcquery", gc_query},
   {"querystr", string_query},
+  {"movestrtab", string_move},
   {"querytab", table_query},
   {"codeparam", test_codeparam},
   {"applyparam", test_applyparam},
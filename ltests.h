@@ -40,6 +40,18 @@
 #define LUA_USE_JUMPTABLE	0
 
 
+/* keep execution counters, to test them */
+#define LUA_USE_COUNTERS
+
+
+/* count hits and misses of inline caches, to test them */
+#define LUA_USE_CACHESTATS
+
+
+/* use shapes for tables, to test them */
+#define LUA_USE_SHAPES
+
+
 /* use 32-bit integers in random generator */
 #define LUA_RAND32
 
@@ -66,6 +78,13 @@ LUA_API Memcontrol l_memcontrol;
 extern void luai_tracegctest (lua_State *L, int first);
 
 
+#define luai_newslot(g,tag)		debug_newslot((g)->ud, tag)
+extern int debug_newslot (void *ud, int tag);
+
+#define luai_freeslot(g,tag)		debug_freeslot((g)->ud, tag)
+extern void debug_freeslot (void *ud, int tag);
+
+
 /*
 ** generic variable for debug tricks
 */
@@ -121,9 +140,10 @@ LUA_API int luaB_opentests (lua_State *L);
 LUA_API void *debug_realloc (void *ud, void *block,
                              size_t osize, size_t nsize);
 
+LUA_API lua_State *debug_newstate (void);
 
-#define luaL_newstate()  \
-	lua_newstate(debug_realloc, &l_memcontrol, luaL_makeseed(NULL))
+
+#define luaL_newstate()		debug_newstate()
 #define luai_openlibs(L)  \
   {  luaL_openlibs(L); \
      luaL_requiref(L, "T", luaB_opentests, 1); \
@@ -142,6 +162,12 @@ LUA_API void *debug_realloc (void *ud, void *block,
 #define STRCACHE_N	23
 #define STRCACHE_M	5
 
+#define GCREMSET_N	7
+#define LUAI_GCREMMIN	4
+
+#define LUAI_ADAPTWINDOW	1
+#define LUAI_ADAPTPROBE		2
+
 #define MAXINDEXRK	1
 
 
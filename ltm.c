@@ -31,7 +31,7 @@ LUAI_DDEF const char *const luaT_typenames_[LUA_TOTALTYPES] = {
   "no value",
   "nil", "boolean", udatatypename, "number",
   "string", "table", "function", udatatypename, "thread",
-  "upvalue", "proto" /* these last cases are used for tests only */
+  "upvalue", "proto", "shape" /* these last cases are used for tests only */
 };
 
 
@@ -93,8 +93,10 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
   if ((ttistable(o) && (mt = hvalue(o)->metatable) != NULL) ||
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
     const TValue *name = luaH_Hgetshortstr(mt, luaS_new(L, "__name"));
-    if (ttisstring(name))  /* is '__name' a string? */
+    if (ttisstring(name)) {  /* is '__name' a string? */
+      luaS_seal(L, tsvalue(name));
       return getstr(tsvalue(name));  /* use it as type name */
+    }
   }
   return ttypename(ttype(o));  /* else use standard type name */
 }
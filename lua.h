@@ -120,7 +120,11 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 
 
 /*
-** Type for memory-allocation functions
+** Type for memory-allocation functions. An allocation function is
+** thread safe if it can free a block (a call with 'nsize' equal to 0)
+** in another thread while Lua keeps calling it in the thread running
+** the state; 'lua_setallocsafe' tells that to Lua, which then may free
+** the blocks of dead objects in a background thread.
 */
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
@@ -244,6 +248,8 @@ LUA_API void        (lua_pushnil) (lua_State *L);
 LUA_API void        (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
+LUA_API void        (lua_pushsubstring) (lua_State *L, int idx,
+                                         size_t i, size_t len);
 LUA_API const char *(lua_pushexternalstring) (lua_State *L,
 		const char *s, size_t len, lua_Alloc falloc, void *ud);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
@@ -338,6 +344,9 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCGEN		7
 #define LUA_GCINC		8
 #define LUA_GCPARAM		9
+#define LUA_GCIDLE		10
+#define LUA_GCADAPT		11
+#define LUA_GCSTATS		12
 
 
 /*
@@ -352,14 +361,43 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCPPAUSE		3  /* size of pause between successive GCs */
 #define LUA_GCPSTEPMUL		4  /* GC "speed" */
 #define LUA_GCPSTEPSIZE		5  /* GC granularity */
+#define LUA_GCPSTEPTIME		6  /* time budget of each step */
+
+/* parameter for both modes */
+#define LUA_GCPWORKERS		7  /* number of threads marking objects */
 
 /* number of parameters */
-#define LUA_GCPN		6
+#define LUA_GCPN		8
 
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
 
 
+/*
+** statistics of the garbage collector (option LUA_GCSTATS)
+*/
+
+/* phases of a collection, for the times in 'lua_GCStats' */
+#define LUA_GCPHPROPAGATE	0
+#define LUA_GCPHATOMIC		1
+#define LUA_GCPHSWEEP		2
+#define LUA_GCPHCALLFIN		3
+#define LUA_GCPHN		4
+
+/* number of buckets in the histogram of pauses */
+#define LUA_GCNPAUSES		24
+
+typedef struct lua_GCStats {
+  lua_Unsigned cycles;  /* finished cycles (including minor collections) */
+  lua_Unsigned time[LUA_GCPHN];  /* microseconds spent in each phase */
+  lua_Unsigned pauses[LUA_GCNPAUSES];  /* pauses of 2^i to 2^(i+1) usec */
+  size_t marked;  /* bytes marked in the last cycle */
+  size_t freed;  /* bytes freed in the last cycle */
+  size_t count[LUA_NUMTYPES + 1];  /* live objects by type (last: others) */
+  size_t bytes[LUA_NUMTYPES + 1];  /* their sizes */
+} lua_GCStats;
+
+
 /*
 ** miscellaneous functions
 */
@@ -367,6 +405,7 @@ LUA_API int (lua_gc) (lua_State *L, int what, ...);
 LUA_API int   (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
+LUA_API int   (lua_nextc) (lua_State *L, int idx, lua_Unsigned *cursor);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
@@ -377,6 +416,7 @@ LUA_API size_t  (lua_stringtonumber) (lua_State *L, const char *s);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void      (lua_setallocsafe) (lua_State *L, int safe);
 
 LUA_API void (lua_toclose) (lua_State *L, int idx);
 LUA_API void (lua_closeslot) (lua_State *L, int idx);
@@ -483,6 +523,11 @@ LUA_API lua_Hook (lua_gethook) (lua_State *L);
 LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+LUA_API void (lua_getcachestats) (lua_State *L, size_t *hits,
+                                                size_t *misses);
+LUA_API int (lua_getcounter) (lua_State *L, int fidx, int n,
+                              lua_Unsigned *count, int *line);
+
 
 struct lua_Debug {
   int event;
@@ -20,6 +20,7 @@
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstring.h"
 #include "ltable.h"
 #include "lundump.h"
@@ -195,7 +196,10 @@ static void loadCode (LoadState *S, Proto *f) {
     f->code = luaM_newvectorchecked(S->L, n, Instruction);
     f->sizecode = n;
     loadVector(S, f->code, n);
+    luaP_fuse(f->code, n);
   }
+  luaF_initcache(S->L, f);
+  luaF_initcounters(S->L, f);
 }
 
 
@@ -19,10 +19,12 @@
 #include "lua.h"
 
 #include "lapi.h"
+#include "lctype.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -45,6 +47,41 @@
 #endif
 
 
+/*
+** With LUA_USE_TAILCALL, the main interpreter loop is replaced by one
+** function per opcode, with each function going to the next one through
+** a guaranteed tail call. (See 'ltailcall.h'.) That needs a compiler
+** that supports attribute 'musttail'; otherwise, the option is ignored.
+** (With a compiler that always optimizes these tail calls, one can
+** define 'l_musttail' as empty.)
+*/
+#if defined(LUA_USE_TAILCALL) && !defined(l_musttail)
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define l_musttail	__attribute__((musttail))
+#endif
+#endif
+#if !defined(l_musttail)
+#undef LUA_USE_TAILCALL
+#endif
+#endif
+
+#if defined(LUA_USE_TAILCALL)
+#undef LUA_USE_JUMPTABLE
+#define LUA_USE_JUMPTABLE	0
+#endif
+
+
+/*
+** By default, the interpreter quickens arithmetic and order opcodes,
+** rewriting them into variants specialized for the types of their
+** operands. (See note about quickened opcodes in 'lopcodes.h'.)
+*/
+#if !defined(LUAI_QUICKEN)
+#define LUAI_QUICKEN	1
+#endif
+
+
 
 /* limit for table tag-method chains (to avoid infinite loops) */
 #define MAXTAGLOOP	2000
@@ -81,14 +118,49 @@
 #endif
 
 
+/* size of the buffer for numerals in strings with no '\0' */
+#if !defined (L_MAXLENNUM)
+#define L_MAXLENNUM	200
+#endif
+
+/*
+** Convert the 'len' bytes at 's', which may not be followed by a '\0',
+** from a terminated copy of them (without surrounding spaces). Long
+** numerals are copied to a block of their size; if there is no memory
+** for it, the conversion fails. (The allocation does not raise errors,
+** as the API functions that convert values do not raise them.)
+*/
+static int strton_copy (lua_State *L, const char *s, size_t len,
+                                      TValue *result) {
+  char buff[L_MAXLENNUM + 1];
+  char *b = buff;
+  int res;
+  while (len > 0 && lisspace(cast_uchar(*s))) { s++; len--; }
+  while (len > 0 && lisspace(cast_uchar(s[len - 1]))) len--;
+  if (len > L_MAXLENNUM) {  /* too long for 'buff'? */
+    b = luaM_reallocvector(L, NULL, 0, len + 1, char);
+    if (b == NULL)
+      return 0;  /* no memory for the copy */
+  }
+  memcpy(b, s, len * sizeof(char));
+  b[len] = '\0';
+  res = (luaO_str2num(b, result) == len + 1);
+  if (b != buff)
+    luaM_freearray(L, b, len + 1);
+  return res;
+}
+
+
 /*
 ** Try to convert a value from string to a number value.
 ** If the value is not a string or is a string not representing
 ** a valid numeral (or if coercions from strings to numbers
 ** are disabled via macro 'cvt2num'), do not modify 'result'
-** and return 0.
+** and return 0. Buffer strings and views may not have a '\0' after
+** their contents, and they cannot get one there (a view may be part
+** of an external string), so they are converted from a copy.
 */
-static int l_strton (const TValue *obj, TValue *result) {
+static int l_strton (lua_State *L, const TValue *obj, TValue *result) {
   lua_assert(obj != result);
   if (!cvt2num(obj))  /* is object not a string? */
     return 0;
@@ -96,6 +168,8 @@ static int l_strton (const TValue *obj, TValue *result) {
     TString *st = tsvalue(obj);
     size_t stlen;
     const char *s = getlstr(st, stlen);
+    if (l_unlikely(s[stlen] != '\0'))  /* buffer string or view? */
+      return strton_copy(L, s, stlen, result);
     return (luaO_str2num(s, result) == stlen + 1);
   }
 }
@@ -105,13 +179,13 @@ static int l_strton (const TValue *obj, TValue *result) {
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
 */
-int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
+int luaV_tonumber_ (lua_State *L, const TValue *obj, lua_Number *n) {
   TValue v;
   if (ttisinteger(obj)) {
     *n = cast_num(ivalue(obj));
     return 1;
   }
-  else if (l_strton(obj, &v)) {  /* string coercible to number? */
+  else if (l_strton(L, obj, &v)) {  /* string coercible to number? */
     *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
     return 1;
   }
@@ -154,9 +228,10 @@ int luaV_tointegerns (const TValue *obj, lua_Integer *p, F2Imod mode) {
 /*
 ** try to convert a value to an integer.
 */
-int luaV_tointeger (const TValue *obj, lua_Integer *p, F2Imod mode) {
+int luaV_tointeger (lua_State *L, const TValue *obj, lua_Integer *p,
+                                  F2Imod mode) {
   TValue v;
-  if (l_strton(obj, &v))  /* does 'obj' point to a numerical string? */
+  if (l_strton(L, obj, &v))  /* does 'obj' point to a numerical string? */
     obj = &v;  /* change it to point to its corresponding number */
   return luaV_tointegerns(obj, p, mode);
 }
@@ -180,7 +255,7 @@ int luaV_tointeger (const TValue *obj, lua_Integer *p, F2Imod mode) {
 */
 static int forlimit (lua_State *L, lua_Integer init, const TValue *lim,
                                    lua_Integer *p, lua_Integer step) {
-  if (!luaV_tointeger(lim, p, (step < 0 ? F2Iceil : F2Ifloor))) {
+  if (!luaV_tointeger(L, lim, p, (step < 0 ? F2Iceil : F2Ifloor))) {
     /* not coercible to in integer */
     lua_Number flim;  /* try to convert to float */
     if (!tonumber(lim, &flim)) /* cannot convert to float? */
@@ -388,11 +463,15 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** of the strings. Note that segments can compare equal but still
 ** have different lengths.
 */
-static int l_strcmp (const TString *ts1, const TString *ts2) {
+static int l_strcmp (lua_State *L, TString *ts1, TString *ts2) {
   size_t rl1;  /* real length */
-  const char *s1 = getlstr(ts1, rl1);
+  const char *s1;
   size_t rl2;
-  const char *s2 = getlstr(ts2, rl2);
+  const char *s2;
+  luaS_seal(L, ts1);  /* 'strcoll' needs final '\0's */
+  luaS_seal(L, ts2);
+  s1 = getlstr(ts1, rl1);
+  s2 = getlstr(ts2, rl2);
   for (;;) {  /* for each segment */
     int temp = l_strcoll(s1, s2);
     if (temp != 0)  /* not equal? */
@@ -537,7 +616,7 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 static int lessthanothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else
     return luaT_callorderTM(L, l, r, TM_LT);
 }
@@ -559,7 +638,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 static int lessequalothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else
     return luaT_callorderTM(L, l, r, TM_LE);
 }
@@ -713,6 +792,13 @@ void luaV_concat (lua_State *L, int total) {
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = luaS_newlstr(L, buff, tl);
       }
+      else if (ttislngstring(s2v(top - n))) {  /* appending to a long one? */
+        /* result shares a buffer with it, if possible */
+        TString *first = tsvalue(s2v(top - n));
+        size_t lf = first->u.lnglen;
+        ts = luaS_appendbuf(L, first, tl);
+        copy2buff(top, n - 1, getlngstr(ts) + lf);
+      }
       else {  /* long string; copy strings directly to final result */
         ts = luaS_createlngstrobj(L, tl);
         copy2buff(top, n, getlngstr(ts));
@@ -856,7 +942,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = luaP_genop(GET_OPCODE(inst));
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
       setobjs2s(L, base + GETARG_A(*(ci->u.l.savedpc - 2)), --L->top.p);
@@ -1007,6 +1093,28 @@ void luaV_finishOp (lua_State *L) {
   op_arith_aux(L, v1, v2, iop, fop); }
 
 
+/*
+** Arithmetic operations with register operands that quicken the
+** instruction into 'qi' (for two integers) or 'qf' (for two floats).
+*/
+#define op_arithQ(L,iop,fop,qi,qf) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (ttisinteger(v1) && ttisinteger(v2)) {  \
+    StkId ra = RA(i); \
+    lua_Integer i1 = ivalue(v1); lua_Integer i2 = ivalue(v2);  \
+    quicken(qi);  \
+    pc++; setivalue(s2v(ra), iop(L, i1, i2));  \
+  }  \
+  else if (ttisfloat(v1) && ttisfloat(v2)) {  \
+    StkId ra = RA(i); \
+    lua_Number n1 = fltvalue(v1); lua_Number n2 = fltvalue(v2);  \
+    quicken(qf);  \
+    pc++; setfltvalue(s2v(ra), fop(L, n1, n2));  \
+  }  \
+  else op_arithf_aux(L, v1, v2, fop); }
+
+
 /*
 ** Arithmetic operations with K operands.
 */
@@ -1064,6 +1172,31 @@ void luaV_finishOp (lua_State *L) {
   docondjump(); }
 
 
+/*
+** Order operations with register operands that quicken the instruction
+** into 'qi' (for two integers) or 'qf' (for two floats).
+*/
+#define op_orderQ(L,opi,opf,opn,other,qi,qf) {  \
+  TValue *ra = vRA(i); \
+  int cond;  \
+  TValue *rb = vRB(i);  \
+  if (ttisinteger(ra) && ttisinteger(rb)) {  \
+    lua_Integer ia = ivalue(ra);  \
+    lua_Integer ib = ivalue(rb);  \
+    cond = opi(ia, ib);  \
+    quicken(qi);  \
+  }  \
+  else if (ttisfloat(ra) && ttisfloat(rb)) {  \
+    cond = opf(fltvalue(ra), fltvalue(rb));  \
+    quicken(qf);  \
+  }  \
+  else if (ttisnumber(ra) && ttisnumber(rb))  \
+    cond = opn(ra, rb);  \
+  else  \
+    Protect(cond = other(L, ra, rb));  \
+  docondjump(); }
+
+
 /*
 ** Order operations with immediate operand. (Immediate operand is
 ** always small enough to have an exact representation as a float.)
@@ -1088,6 +1221,153 @@ void luaV_finishOp (lua_State *L) {
 /* }================================================================== */
 
 
+/*
+** {==================================================================
+** Quickened opcodes
+**
+** Each quickened opcode handles only operands of one given type. When
+** its operands have other types, it rewrites the instruction back to
+** its generic opcode 'o' and goes to the code of 'o' (see 'vmgoto'),
+** which runs the generic version of the instruction. These macros are
+** to be used exclusively inside function 'luaV_execute'.
+** ===================================================================
+*/
+
+#if LUAI_QUICKEN
+
+/*
+** Rewrite current instruction with a quickened opcode. Prototypes with
+** fixed code (loaded from fixed buffers) are never rewritten.
+*/
+#define quicken(o)  \
+  { if (!(cl->p->flag & PF_FIXED))  \
+      SET_OPCODE(*cast(Instruction *, pc - 1), o); }
+
+#else
+
+#define quicken(o)	((void)0)
+
+#endif
+
+
+/* rewrite current instruction back into its generic opcode */
+#define deoptimize(o)	SET_OPCODE(*cast(Instruction *, pc - 1), o)
+
+
+#define op_arithint(L,iop,o) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {  \
+    StkId ra = RA(i); \
+    lua_Integer i1 = ivalue(v1); lua_Integer i2 = ivalue(v2);  \
+    pc++; setivalue(s2v(ra), iop(L, i1, i2));  \
+  }  \
+  else { deoptimize(o); vmgoto(o); }}
+
+
+#define op_arithflt(L,fop,o) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    StkId ra = RA(i); \
+    lua_Number n1 = fltvalue(v1); lua_Number n2 = fltvalue(v2);  \
+    pc++; setfltvalue(s2v(ra), fop(L, n1, n2));  \
+  }  \
+  else { deoptimize(o); vmgoto(o); }}
+
+
+#define op_orderint(L,opi,o) {  \
+  TValue *ra = vRA(i); \
+  int cond;  \
+  TValue *rb = vRB(i);  \
+  if (l_likely(ttisinteger(ra) && ttisinteger(rb)))  \
+    cond = opi(ivalue(ra), ivalue(rb));  \
+  else { deoptimize(o); vmgoto(o); }  \
+  docondjump(); }
+
+
+#define op_orderflt(L,opf,o) {  \
+  TValue *ra = vRA(i); \
+  int cond;  \
+  TValue *rb = vRB(i);  \
+  if (l_likely(ttisfloat(ra) && ttisfloat(rb)))  \
+    cond = opf(fltvalue(ra), fltvalue(rb));  \
+  else { deoptimize(o); vmgoto(o); }  \
+  docondjump(); }
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Superinstructions
+**
+** A superinstruction executes its own instruction, with the code of
+** the instruction's generic opcode, and then goes directly to the code
+** of opcode 'o' for the next instruction, skipping the full dispatch.
+** These macros are to be used exclusively inside function
+** 'luaV_execute'.
+** ===================================================================
+*/
+
+/*
+** Go to the next instruction, which has opcode 'o'. When 'trap' is set
+** (hooks or a stack reallocation), use a normal dispatch instead, so
+** that 'vmfetch' can handle it.
+*/
+#define fusenext(o)  \
+  { if (l_unlikely(trap)) { vmbreak; }  \
+    i = *(pc++); vmgoto(o); }
+
+
+#define op_move(L) {  \
+  StkId ra = RA(i);  \
+  setobjs2s(L, ra, RB(i)); }
+
+
+#define op_getupval(L) {  \
+  StkId ra = RA(i);  \
+  int b = GETARG_B(i);  \
+  setobj2s(L, ra, cl->upvals[b]->v.p); }
+
+
+#define op_gettabup(L) {  \
+  StkId ra = RA(i);  \
+  TValue *upval = cl->upvals[GETARG_B(i)]->v.p;  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  lu_byte tag;  \
+  fastgetfield(upval, key, s2v(ra), tag);  \
+  if (tagisempty(tag))  \
+    Protect(luaV_finishget(L, upval, rc, ra, tag)); }
+
+
+#define op_getfield(L) {  \
+  StkId ra = RA(i);  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  lu_byte tag;  \
+  fastgetfield(rb, key, s2v(ra), tag);  \
+  if (tagisempty(tag))  \
+    Protect(luaV_finishget(L, rb, rc, ra, tag)); }
+
+
+#define op_setfield(L) {  \
+  StkId ra = RA(i);  \
+  int hres;  \
+  TValue *rb = KB(i);  \
+  TValue *rc = RKC(i);  \
+  TString *key = tsvalue(rb);  /* key must be a short string */  \
+  luaV_fastset(s2v(ra), key, rc, hres, luaH_psetshortstr);  \
+  if (hres == HOK)  \
+    luaV_finishfastset(L, s2v(ra), rc);  \
+  else  \
+    Protect(luaV_finishset(L, s2v(ra), rb, rc, hres)); }
+
+/* }================================================================== */
+
+
 /*
 ** {==================================================================
 ** Function 'luaV_execute': main interpreter loop
@@ -1110,6 +1390,41 @@ void luaV_finishOp (lua_State *L) {
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
 
+/*
+** With LUA_USE_CACHESTATS, count hits and misses of the inline caches.
+** (Off by default, as they would cost a store in each access.)
+*/
+#if defined(LUA_USE_CACHESTATS)
+#define countic(L,f)	(G(L)->f++)
+#else
+#define countic(L,f)	((void)0)
+#endif
+
+
+/*
+** Fast track for 'gettable' with a constant short-string key, using
+** the inline cache of the current instruction. (See 'luaH_icslot'.)
+*/
+#define fastgetfield(t,key,res,tag) {  \
+  if (!ttistable(t)) tag = LUA_VNOTABLE;  \
+  else {  \
+    Table *h_ = hvalue(t);  \
+    unsigned *ic_ = cl->p->icache;  \
+    const TValue *v_;  \
+    if (l_unlikely(ic_ == NULL))  /* no caches? */  \
+      tag = luaH_getshortstr(h_, key, res);  \
+    else if ((v_ = luaH_icslot(h_, key, ic_[pcRel(pc, cl->p)])) != NULL) {  \
+      countic(L, ichits);  \
+      setobj(L, res, v_);  \
+      tag = ttypetag(v_);  \
+    }  \
+    else {  \
+      countic(L, icmisses);  \
+      tag = luaH_getshortstrIC(h_, key, res, &ic_[pcRel(pc, cl->p)]);  \
+    }  \
+  }}
+
+
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
 
@@ -1120,6 +1435,35 @@ void luaV_finishOp (lua_State *L) {
 	{ if (l_unlikely(trap)) { updatebase(ci); ra = RA(i); } }
 
 
+#if defined(LUA_USE_JIT)
+
+/*
+** Count one more activation or loop iteration of the current function
+** towards its compilation; if it is already compiled, run its native
+** code from 'pc' on. (Native code does not handle hooks.)
+*/
+#define jitcheck()  \
+  { Proto *p_ = cl->p;  \
+    if (p_->jit == NULL) {  \
+      if (--p_->jitcount == 0) luaJ_compile(L, p_); }  \
+    else if (!trap) {  \
+      pc = luaJ_run(L, p_, base, pc);  \
+      updatetrap(ci); } }
+
+#else
+
+#define jitcheck()	((void)0)
+
+#endif
+
+
+/*
+** Count one more iteration of the loop closed by the current
+** instruction. (See 'luaF_count'.)
+*/
+#define countloop()	luaF_count(cl->p, pc - cl->p->code)
+
+
 /*
 ** Execute a jump instruction. The 'updatetrap' allows signals to stop
 ** tight loops. (Without it, the local copy of 'trap' could never change.)
@@ -1181,6 +1525,14 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/* internal checks before the execution of each instruction */
+#define vmcheck()  \
+  { lua_assert(base == ci->func.p + 1);  \
+    lua_assert(base <= L->top.p && L->top.p <= L->stack_last.p);  \
+    /* for tests, invalidate top for instructions not expecting it */  \
+    lua_assert(luaP_isIT(i) || (cast_void(L->top.p = base), 1)); }
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -1194,6 +1546,24 @@ void luaV_finishOp (lua_State *L) {
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/*
+** Labels for the code of opcodes that other opcodes can go to, and for
+** the entry points of the interpreter
+*/
+#define vmlabel(l)	l_##l:
+#define vmgoto(l)	goto l_##l
+
+
+/*
+** Return from a Lua function: end this frame if the function was
+** called from C, else continue running its caller in this frame.
+*/
+#define doreturn(ci)  \
+  { if (ci->callstatus & CIST_FRESH) return;  \
+    else { ci = ci->previous; vmgoto(returning); } }
+
+
+#if !defined(LUA_USE_TAILCALL)
 
 void luaV_execute (lua_State *L, CallInfo *ci) {
   LClosure *cl;
@@ -1204,15 +1574,19 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
 #if LUA_USE_JUMPTABLE
 #include "ljumptab.h"
 #endif
- startfunc:
+ vmlabel(startfunc)
   trap = L->hookmask;
- returning:  /* trap already set */
+ vmlabel(returning)  /* trap already set */
   cl = ci_func(ci);
   k = cl->p->k;
   pc = ci->u.l.savedpc;
   if (l_unlikely(trap))
     trap = luaG_tracecall(L);
   base = ci->func.p + 1;
+  jitcheck();
+#if LUA_USE_JUMPTABLE
+  disp = vmtable();  /* 'trap' may have changed */
+#endif
   /* main loop of interpreter */
   for (;;) {
     Instruction i;  /* instruction being executed */
@@ -1225,14 +1599,43 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
              opnames[GET_OPCODE(i)], pcrel);
     }
     #endif
-    lua_assert(base == ci->func.p + 1);
-    lua_assert(base <= L->top.p && L->top.p <= L->stack_last.p);
-    /* for tests, invalidate top for instructions not expecting it */
-    lua_assert(luaP_isIT(i) || (cast_void(L->top.p = base), 1));
+    vmcheck();
     vmdispatch (GET_OPCODE(i)) {
+
+#else
+
+#include "ltailcall.h"
+
+/* fetch an instruction when 'trap' is set (see 'vmfetch') */
+static void h_trap (vmparams) {
+  CallInfo *ci = L->ci;
+  trap = luaG_traceexec(L, pc);  /* handle hooks */
+  updatebase(ci);  /* correct stack */
+  i = *(pc++);
+  vmdispatch(GET_OPCODE(i));
+}
+
+static void h_startfunc (vmparams) {
+  trap = L->hookmask;
+  vmgoto(returning);
+}
+
+static void h_returning (vmparams) {  /* trap already set */
+  CallInfo *ci = L->ci;
+  LClosure *cl = ci_func(ci);
+  k = cl->p->k;
+  pc = ci->u.l.savedpc;
+  if (l_unlikely(trap))
+    trap = luaG_tracecall(L);
+  base = ci->func.p + 1;
+  jitcheck();
+  vmbreak;
+  /* this function is closed by the first 'vmcase' */
+
+#endif
       vmcase(OP_MOVE) {
-        StkId ra = RA(i);
-        setobjs2s(L, ra, RB(i));
+       vmlabel(OP_MOVE)
+        op_move(L);
         vmbreak;
       }
       vmcase(OP_LOADI) {
@@ -1285,9 +1688,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETUPVAL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);
-        setobj2s(L, ra, cl->upvals[b]->v.p);
+        op_getupval(L);
         vmbreak;
       }
       vmcase(OP_SETUPVAL) {
@@ -1298,14 +1699,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETTABUP) {
-        StkId ra = RA(i);
-        TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        luaV_fastget(upval, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, upval, rc, ra, tag));
+        op_gettabup(L);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
@@ -1336,14 +1730,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETFIELD) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, rb, rc, ra, tag));
+       vmlabel(OP_GETFIELD)
+        op_getfield(L);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -1392,16 +1780,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_SETFIELD) {
-        StkId ra = RA(i);
-        int hres;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a short string */
-        luaV_fastset(s2v(ra), key, rc, hres, luaH_psetshortstr);
-        if (hres == HOK)
-          luaV_finishfastset(L, s2v(ra), rc);
-        else
-          Protect(luaV_finishset(L, s2v(ra), rb, rc, hres));
+       vmlabel(OP_SETFIELD)
+        op_setfield(L);
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -1432,7 +1812,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
         setobj2s(L, ra + 1, rb);
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
+        fastgetfield(rb, key, s2v(ra), tag);
         if (tagisempty(tag))
           Protect(luaV_finishget(L, rb, rc, ra, tag));
         vmbreak;
@@ -1504,15 +1884,18 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_ADD) {
-        op_arith(L, l_addi, luai_numadd);
+       vmlabel(OP_ADD)
+        op_arithQ(L, l_addi, luai_numadd, OP_ADDINT, OP_ADDFLT);
         vmbreak;
       }
       vmcase(OP_SUB) {
-        op_arith(L, l_subi, luai_numsub);
+       vmlabel(OP_SUB)
+        op_arithQ(L, l_subi, luai_numsub, OP_SUBINT, OP_SUBFLT);
         vmbreak;
       }
       vmcase(OP_MUL) {
-        op_arith(L, l_muli, luai_nummul);
+       vmlabel(OP_MUL)
+        op_arithQ(L, l_muli, luai_nummul, OP_MULINT, OP_MULFLT);
         vmbreak;
       }
       vmcase(OP_MOD) {
@@ -1559,7 +1942,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = vRB(i);
         TMS tm = (TMS)GETARG_C(i);
         StkId result = RA(pi);
-        lua_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
+        lua_assert(OP_ADD <= luaP_genop(GET_OPCODE(pi)) &&
+                   luaP_genop(GET_OPCODE(pi)) <= OP_SHR);
         Protect(luaT_trybinTM(L, s2v(ra), rb, result, tm));
         vmbreak;
       }
@@ -1644,7 +2028,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_JMP) {
-        dojump(ci, i, 0);
+        if (GETARG_sJ(i) < 0) {  /* backward jump? */
+          countloop();
+          dojump(ci, i, 0);
+          jitcheck();
+        }
+        else
+          dojump(ci, i, 0);
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1656,11 +2046,15 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_LT) {
-        op_order(L, l_lti, LTnum, lessthanothers);
+       vmlabel(OP_LT)
+        op_orderQ(L, l_lti, luai_numlt, LTnum, lessthanothers,
+                     OP_LTINT, OP_LTFLT);
         vmbreak;
       }
       vmcase(OP_LE) {
-        op_order(L, l_lei, LEnum, lessequalothers);
+       vmlabel(OP_LE)
+        op_orderQ(L, l_lei, luai_numle, LEnum, lessequalothers,
+                     OP_LEINT, OP_LEFLT);
         vmbreak;
       }
       vmcase(OP_EQK) {
@@ -1718,6 +2112,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_CALL) {
+       vmlabel(OP_CALL) {
         StkId ra = RA(i);
         CallInfo *newci;
         int b = GETARG_B(i);
@@ -1730,10 +2125,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           updatetrap(ci);  /* C call; nothing else to be done */
         else {  /* Lua call: run function in this same C frame */
           ci = newci;
-          goto startfunc;
+          vmgoto(startfunc);
         }
         vmbreak;
-      }
+      }}
       vmcase(OP_TAILCALL) {
         StkId ra = RA(i);
         int b = GETARG_B(i);  /* number of arguments + 1 (function) */
@@ -1752,12 +2147,12 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           lua_assert(base == ci->func.p + 1);
         }
         if ((n = luaD_pretailcall(L, ci, ra, b, delta)) < 0)  /* Lua function? */
-          goto startfunc;  /* execute the callee */
+          vmgoto(startfunc);  /* execute the callee */
         else {  /* C function? */
           ci->func.p -= delta;  /* restore 'func' (if vararg) */
           luaD_poscall(L, ci, n);  /* finish caller */
           updatetrap(ci);  /* 'luaD_poscall' can change hooks */
-          goto ret;  /* caller returns after the tail call */
+          doreturn(ci);  /* caller returns after the tail call */
         }
       }
       vmcase(OP_RETURN) {
@@ -1780,7 +2175,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         L->top.p = ra + n;  /* set call for 'luaD_poscall' */
         luaD_poscall(L, ci, n);
         updatetrap(ci);  /* 'luaD_poscall' can change hooks */
-        goto ret;
+        doreturn(ci);
       }
       vmcase(OP_RETURN0) {
         if (l_unlikely(L->hookmask)) {
@@ -1797,7 +2192,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           for (; l_unlikely(nres > 0); nres--)
             setnilvalue(s2v(L->top.p++));  /* all results are nil */
         }
-        goto ret;
+        doreturn(ci);
       }
       vmcase(OP_RETURN1) {
         if (l_unlikely(L->hookmask)) {
@@ -1820,13 +2215,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
               setnilvalue(s2v(L->top.p++));  /* complete missing results */
           }
         }
-       ret:  /* return from a Lua function */
-        if (ci->callstatus & CIST_FRESH)
-          return;  /* end this frame */
-        else {
-          ci = ci->previous;
-          goto returning;  /* continue running caller in this frame */
-        }
+        doreturn(ci);
       }
       vmcase(OP_FORLOOP) {
         StkId ra = RA(i);
@@ -1838,12 +2227,16 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             chgivalue(s2v(ra), l_castU2S(count - 1));  /* update counter */
             idx = intop(+, idx, step);  /* add step to index */
             chgivalue(s2v(ra + 2), idx);  /* update control variable */
+            countloop();
             pc -= GETARG_Bx(i);  /* jump back */
           }
         }
-        else if (floatforloop(ra))  /* float loop */
+        else if (floatforloop(ra)) {  /* float loop */
+          countloop();
           pc -= GETARG_Bx(i);  /* jump back */
+        }
         updatetrap(ci);  /* allows a signal to break the loop */
+        jitcheck();
         vmbreak;
       }
       vmcase(OP_FORPREP) {
@@ -1870,10 +2263,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         pc += GETARG_Bx(i);  /* go to end of the loop */
         i = *(pc++);  /* fetch next instruction */
         lua_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
-        goto l_tforcall;
+        vmgoto(OP_TFORCALL);
       }
       vmcase(OP_TFORCALL) {
-       l_tforcall: {
+       vmlabel(OP_TFORCALL) {
         /* 'ra' has the iterator function, 'ra + 1' has the state,
            'ra + 2' has the closing variable, and 'ra + 3' has the control
            variable. The call will use the stack starting at 'ra + 3',
@@ -1889,13 +2282,16 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         updatestack(ci);  /* stack may have changed */
         i = *(pc++);  /* go to next instruction */
         lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
-        goto l_tforloop;
+        vmgoto(OP_TFORLOOP);
       }}
       vmcase(OP_TFORLOOP) {
-       l_tforloop: {
+       vmlabel(OP_TFORLOOP) {
         StkId ra = RA(i);
-        if (!ttisnil(s2v(ra + 3)))  /* continue loop? */
+        if (!ttisnil(s2v(ra + 3))) {  /* continue loop? */
+          countloop();
           pc -= GETARG_Bx(i);  /* jump back */
+          jitcheck();
+        }
         vmbreak;
       }}
       vmcase(OP_SETLIST) {
@@ -1964,8 +2360,93 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_ADDINT) {
+        op_arithint(L, l_addi, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_ADDFLT) {
+        op_arithflt(L, luai_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBINT) {
+        op_arithint(L, l_subi, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_SUBFLT) {
+        op_arithflt(L, luai_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULINT) {
+        op_arithint(L, l_muli, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_MULFLT) {
+        op_arithflt(L, luai_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_LTINT) {
+        op_orderint(L, l_lti, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LTFLT) {
+        op_orderflt(L, luai_numlt, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LEINT) {
+        op_orderint(L, l_lei, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_LEFLT) {
+        op_orderflt(L, luai_numle, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_MOVE2) {
+        op_move(L);
+        fusenext(OP_MOVE);
+      }
+      vmcase(OP_MOVECALL) {
+        op_move(L);
+        fusenext(OP_CALL);
+      }
+      vmcase(OP_UPVALMOVE) {
+        op_getupval(L);
+        fusenext(OP_MOVE);
+      }
+      vmcase(OP_TABUPFIELD) {
+        op_gettabup(L);
+        fusenext(OP_GETFIELD);
+      }
+      vmcase(OP_GETFIELD2) {
+        op_getfield(L);
+        fusenext(OP_GETFIELD);
+      }
+      vmcase(OP_SETFIELD2) {
+        op_setfield(L);
+        fusenext(OP_SETFIELD);
+      }
+#if LUA_USE_JUMPTABLE
+     L_trap: {  /* instruction dispatched with 'trap' set */
+        pc--;  /* undo the fetch */
+        trap = luaG_traceexec(L, pc);  /* handle hooks */
+        updatebase(ci);  /* correct stack */
+        disp = vmtable();
+        i = *(pc++);
+        goto *disptab[GET_OPCODE(i)];
+      }
+#endif
+#if !defined(LUA_USE_TAILCALL)
     }
   }
 }
+#else
+}
+
+
+void luaV_execute (lua_State *L, CallInfo *ci) {
+  lua_assert(ci == L->ci);
+  UNUSED(ci);
+  h_startfunc(L, NULL, NULL, NULL, 0, 0);
+}
+#endif
 
 /* }================================================================== */
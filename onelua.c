@@ -100,6 +100,7 @@
 #include "ltable.c"
 #include "ldo.c"
 #include "lvm.c"
+#include "ljit.c"
 #include "lapi.c"
 
 /* auxiliary library -- used by all */
@@ -500,5 +500,127 @@ do   print("testing code for integer limits")
 
 end
 
+
+do   print("testing quickening")
+  -- get opcode of the first instruction with generic opcode 'op'
+  local function getop (f, op)
+    local c = T.listcode(f)
+    local q = T.listcode(f, true)
+    for i = 1, #c do
+      if string.match(c[i], "%u%w+") == op then
+        return string.match(q[i], "%u%w+")
+      end
+    end
+  end
+
+  local function add (a, b) return a + b end
+  local function lt (a, b) return a < b end
+  assert(getop(add, "ADD") == "ADD" and getop(lt, "LT") == "LT")
+  assert(add(1, 2) == 3 and getop(add, "ADDINT") == nil)
+  assert(getop(add, "ADD") == "ADDINT")
+  assert(add(1.5, 2.5) == 4.0 and getop(add, "ADD") == "ADDFLT")
+  assert(math.type(add(1, 2)) == "integer" and getop(add, "ADD") == "ADDINT")
+  assert(add(1, 2.5) == 3.5 and getop(add, "ADD") == "ADD")   -- mixed
+  assert(add(10, 20) == 30)
+  -- deoptimize into a metamethod
+  local mt = {__add = function (a, b) return "add" end,
+              __lt = function (a, b) return "lt" end}
+  local t = setmetatable({}, mt)
+  assert(add(t, 1) == "add" and getop(add, "ADD") == "ADD")
+  assert(add(math.maxinteger, 1) == math.mininteger)   -- wrap around
+  assert(add("10", 1) == 11)   -- string coercion
+
+  assert(lt(1, 2) and not lt(2, 1) and getop(lt, "LT") == "LTINT")
+  assert(lt(t, t) == true and getop(lt, "LT") == "LT")
+  assert(lt(1.0, 2.0) and getop(lt, "LT") == "LTFLT")
+  assert(not lt(0/0, 0/0) and lt(1, 2.5))
+  assert(lt("a", "b") and not lt("b", "a"))
+
+  -- dumps have only generic opcodes
+  add(2, 3); assert(getop(add, "ADD") == "ADDINT")
+  local add1 = load(string.dump(add))
+  assert(getop(add1, "ADD") == "ADD" and add1(4, 5) == 9)
+
+  -- numeric loop with floats and integers
+  local function sum (n, x)
+    local s = x
+    for i = 1, n do s = s + i * x end
+    return s
+  end
+  assert(sum(100, 1) == 5051 and sum(100, 0.5) == 2525.5)
+  assert(sum(100, 1) == 5051)
+end
+
+
+do   print("testing superinstructions")
+  local function ops (f)
+    local t = {}
+    for _, l in ipairs(T.listcode(f, true)) do
+      t[#t + 1] = string.match(l, "%u%w+")
+    end
+    return table.concat(t, " ")
+  end
+
+  local function f (a, b, c)
+    local v = a.x.y
+    local x, y = a, b
+    c(x, y)
+    return v, y
+  end
+  local s = ops(f)
+  assert(string.find(s, "^GETFIELD2 GETFIELD MOVE2 MOVE2 MOVE2 MOVE2 MOVECALL CALL"))
+  assert(string.find(T.listcode(f)[1], "GETFIELD "))
+  assert(ops(function () return math.pi end) == "TABUPFIELD GETFIELD RETURN1 RETURN0")
+  -- dumps have only generic opcodes
+  assert(not string.find(string.dump(f), "MOVE2", 1, true))
+  assert(ops(load(string.dump(f))) == s)
+
+  local function g (t, v)
+    t.a = v; t.b = t
+  end
+  assert(ops(g) == "SETFIELD2 SETFIELD RETURN0")
+  local t = {}; g(t, 10)
+  assert(t.a == 10 and t.b == t)
+
+  -- metamethods and yields between the two instructions
+  local log = {}
+  local a = setmetatable({}, {__index = function (_, k)
+    coroutine.yield(k); return {y = k}
+  end})
+  local co = coroutine.wrap(function ()
+    return f(a, 10, function (...) log[#log + 1] = {...} end)
+  end)
+  assert(co() == "x")
+  local p1, p2 = co()
+  assert(p1 == "x" and p2 == 10)
+  assert(log[1][1] == a and log[1][2] == 10)
+
+  -- jump into the second instruction of a pair
+  local function h (n, u)
+    local x, y = 0, 0
+    for i = 1, n do
+      if i % 2 == 0 then x = u end
+      y = x
+    end
+    return x, y
+  end
+  local x, y = h(10, 20)
+  assert(x == 20 and y == 20)
+
+  -- count hooks still see each instruction
+  local function k1 (a) local b = a; local c = b; return c end
+  local function k2 (a) local b = not a; local c = not b; return c end
+  assert(string.find(ops(k1), "^MOVE2 MOVE"))
+  local function count (f)
+    local debug = require "debug"
+    local n = 0
+    debug.sethook(function () n = n + 1 end, "", 1)
+    f(1)
+    debug.sethook()
+    return n
+  end
+  assert(count(k1) == count(k2))
+end
+
 print 'OK'
 
@@ -1058,5 +1058,72 @@ do   -- tests for 'source' in binary dumps
          debug.getinfo(h).source == '=?')
 end
 
+
+do   print("testing inline caches")
+  local function getx (t) return t.x end
+  local t = {x = 10, y = 20}
+  local h0, m0 = debug.cachestats()
+  for i = 1, 100 do assert(getx(t) == 10) end
+  local h1, m1 = debug.cachestats()
+  if T then   -- test library counts hits and misses
+    assert(h1 - h0 >= 99 and m1 - m0 >= 1)
+  else   -- may or may not count them
+    assert(h1 >= h0 and m1 >= m0)
+  end
+
+  -- cached slot must not survive changes in the table
+  t.x = nil; assert(getx(t) == nil)
+  t.x = 11; assert(getx(t) == 11)
+  for i = 1, 100 do t["k" .. i] = i end   -- force a rehash
+  assert(getx(t) == 11)
+  t.x = nil; collectgarbage(); assert(getx(t) == nil)
+
+  -- different tables sharing the same site
+  local a = {x = 1}; local b = {y = 2, x = 3}; local c = {}
+  for i = 1, 10 do
+    assert(getx(a) == 1 and getx(b) == 3 and getx(c) == nil)
+  end
+  setmetatable(c, {__index = b}); assert(getx(c) == 3)
+  assert(not pcall(getx, 10))
+
+  -- methods and globals
+  local obj = {v = 5, get = function (self) return self.v end}
+  for i = 1, 10 do assert(obj:get() == 5) end
+  for i = 1, 10 do assert(print == _G.print) end
+end
+
+do   print("testing execution counters")
+  local line = debug.getinfo(1, "l").currentline
+  local function f (n)
+    local s = 0
+    for i = 1, n do s = s + i end
+    local j = 0; while j < n do j = j + 1 end
+    for k in pairs({1, 2, 3}) do s = s + k end
+    return s
+  end
+  assert(debug.getcounters(print) == nil)
+  local c = debug.getcounters(f)
+  if not c then    -- counters are not kept?
+    assert(not T)    -- test builds always keep them
+  else
+    assert(c.calls == 0 and #c == 3)
+    f(10); f(5)
+    c = debug.getcounters(f)
+    assert(c.calls == 2)
+    assert(c[1].line == line + 3 and c[1].count == 9 + 4)
+    assert(c[2].line == line + 4 and c[2].count == 10 + 5)
+    assert(c[3].line == line + 5 and c[3].count == 3 + 3)
+    local function g (n) if n > 0 then return g(n - 1) end end
+    g(10)
+    assert(debug.getcounters(g).calls == 11)   -- tail calls are calls
+    -- functions from binary chunks have their own counters
+    local f1 = load(string.dump(f))
+    f1(1)
+    c = debug.getcounters(f1)
+    assert(c.calls == 1 and c[1].count == 0 and c[3].count == 3)
+  end
+end
+
+
 print"OK"
 
@@ -0,0 +1,65 @@
+-- $Id: testes/ephbench.lua $
+-- See Copyright Notice in file lua.h
+
+-- Benchmark for the convergence of ephemeron tables in the atomic
+-- phase: chains of entries where the value of each entry keeps alive
+-- the key of the next one, spread over several weak-keyed tables. Not
+-- part of the test suite; run it with the collector before and after
+-- a change and compare the results.
+
+local clock = os.clock
+local N = tonumber(arg and arg[1]) or 20000
+local mt = {__mode = "k"}
+
+
+local function report (name, t)
+  print(string.format("%-36s %9.2f ms", name, t * 1e3))
+end
+
+
+-- best time of a full collection among a few runs
+local function best ()
+  local b = math.huge
+  for _ = 1, 5 do
+    local t0 = clock()
+    collectgarbage()
+    b = math.min(b, clock() - t0)
+  end
+  return b
+end
+
+
+-- builds a chain of 'N' entries over 'ntab' tables; 'pos(i)' gives
+-- the table for the i-th entry of the chain
+local function chain (ntab, pos)
+  local E = {}
+  for i = 1, ntab do E[i] = setmetatable({}, mt) end
+  local first = {}
+  local k = first
+  for i = 1, N do
+    local n = {}
+    E[pos(i, ntab)][k] = {n}; k = n
+  end
+  return E, first
+end
+
+
+local cases = {
+  {"one table", 1, function (i, n) return 1 end},
+  {"tables in creation order", 100, function (i, n)
+     return (i - 1) * n // N + 1 end},
+  {"tables in reverse order", 100, function (i, n)
+     return n - (i - 1) * n // N end},
+  {"tables in round robin", 100, function (i, n) return i % n + 1 end},
+  {"random tables", 100, function (i, n) return math.random(n) end},
+}
+
+math.randomseed(42)
+collectgarbage("incremental")
+collectgarbage("param", "workers", 1)
+print(string.format("%d entries in each chain", N))
+for _, c in ipairs(cases) do
+  local E, first = chain(c[2], c[3])
+  report(c[1], best())
+  assert(E and first)
+end
@@ -357,6 +357,42 @@ K = nil
 GC()
 -- assert(next(a) == nil)
 
+do   -- long chains of ephemerons over several tables
+  local N = 2000
+  local E = {}
+  for i = 1, 10 do E[i] = setmetatable({}, mt) end
+  local function chain (rev)
+    local first = {}
+    local k = first
+    for i = 1, N do
+      local n = {}
+      E[(rev and N - i or i) % 10 + 1][k] = {n, i}; k = n
+    end
+    return first
+  end
+  local function count ()
+    local c = 0
+    for i = 1, 10 do
+      for _, v in pairs(E[i]) do c = c + 1; assert(v[2] <= N) end
+    end
+    return c
+  end
+  for _, rev in ipairs{false, true} do
+    local first = chain(rev)
+    collectgarbage()
+    assert(count() == N)
+    if T then   -- no memory for the records of blocked entries
+      T.totalmem(T.totalmem())
+      collectgarbage()
+      T.totalmem(0)
+      assert(count() == N)
+    end
+    first = nil
+    collectgarbage()
+    assert(count() == 0)
+  end
+end
+
 
 -- testing errors during GC
 if T then
@@ -705,6 +741,340 @@ do    -- check that the collector is not reentrant in incremental mode
 end
 
 
+do   print("substring views")
+  local function test (mode)
+    collectgarbage(mode)
+    collectgarbage()
+    local m = collectgarbage("count")
+    -- 1 MB (made by a concatenation, so that it uses counted memory)
+    local big = string.rep("abcdefgh", (1 << 17) - 1) .. "abcdefgh"
+    local v = string.sub(big, 9, 8 + 1000)   -- small view
+    local w = big:sub(1, #big // 2)   -- large view
+    local p = big:sub(#big // 2 + 1)   -- large view (a suffix)
+    big = nil
+    collectgarbage(); collectgarbage()
+    -- large views keep the parent alive
+    assert(collectgarbage("count") > m + 1000)
+    assert(w .. p == string.rep("abcdefgh", 1 << 17))
+    w = nil; p = nil
+    collectgarbage(); collectgarbage()
+    -- small view got its own copy; parent was collected
+    assert(collectgarbage("count") < m + 100)
+    assert(v == string.rep("abcdefgh", 125))
+  end
+  test("incremental")
+  test("generational")
+  test("incremental")
+
+  -- substrings of strings built by concatenation share their buffers,
+  -- even when the string they came from moves to another buffer
+  local s1 = string.rep("x", 300) .. "1"
+  local s2 = s1 .. "2"
+  local s3 = s2 .. "3"    -- 's1', 's2', and 's3' share a buffer
+  local v = s2:sub(1, 300)
+  s3 = nil; collectgarbage()
+  assert(string.format("%s", s2) == s2)   -- moves 's2' to a new buffer
+  collectgarbage()
+  assert(v == string.rep("x", 300) and s2:sub(301) == "12")
+
+  -- numerals in substrings without a '\0' after them
+  local n = string.rep(" ", 300) .. "10" .. string.rep(" ", 300) .. "x"
+  assert(n:sub(1, -2) + 1 == 11 and n:sub(299, 302) * 2 == 20)
+  assert(not pcall(function () return n:sub(250) + 1 end))
+end
+
+
+do   print("parallel marking")
+  local oldw = collectgarbage("param", "workers", 3)
+  -- without support for parallel marking, there is always one worker
+  assert(collectgarbage("param", "workers") == 3 or
+         collectgarbage("param", "workers") == 1)
+  local N = 20000   -- large enough for parallel rounds
+  for _, w in ipairs{1, 2, 3, 8} do
+    collectgarbage("param", "workers", w)
+    for _, mode in ipairs{"incremental", "generational"} do
+      collectgarbage(mode)
+      local a = {}
+      local wv = setmetatable({}, {__mode = "v"})
+      local wk = setmetatable({}, {__mode = "k"})
+      local mt = {__index = function (t, k) return k end}
+      for i = 1, N do
+        local t = setmetatable({i, tostring(i) .. "x"}, mt)
+        t.f = function () return i end
+        a[i] = t
+        wv[i] = t; wv[-i] = {}   -- only the first entry survives
+        wk[t] = {t}; wk[{}] = i   -- only the first entry survives
+      end
+      a.co = coroutine.wrap(function (x) coroutine.yield(x) end)
+      a.co({N})
+      collectgarbage()
+      if T then T.checkmemory() end
+      local nv, nk = 0, 0
+      for k, v in pairs(wv) do assert(v == a[k]); nv = nv + 1 end
+      for k, v in pairs(wk) do assert(v[1] == k); nk = nk + 1 end
+      assert(nv == N and nk == N)
+      for i = 1, N do
+        local t = a[i]
+        assert(t[1] == i and t[2] == tostring(i) .. "x" and t.f() == i)
+        assert(t.z == "z")
+      end
+    end
+  end
+  collectgarbage("param", "workers", oldw)
+  collectgarbage("incremental")
+end
+
+
+do   print("freeing dead objects")
+  -- with a thread-safe allocator (as in 'luaL_newstate'), a build with
+  -- support for it frees dead objects in a background thread
+  collectgarbage()
+  local m0 = collectgarbage("count")
+  local t0 = T and T.totalmem()
+  for _, mode in ipairs{"incremental", "generational"} do
+    collectgarbage(mode)
+    for round = 1, 3 do
+      local a = {}
+      for i = 1, 20000 do
+        a[i] = {tostring(i) .. "y", string.rep("x", i % 100), {}}
+      end
+      a = nil
+      for i = 1, 50 do collectgarbage("step") end
+    end
+    collectgarbage()
+    if T then
+      T.checkmemory()
+      -- a full collection waits for the release of all dead objects
+      assert(T.totalmem() < t0 + 100 * 1024)
+    end
+    assert(collectgarbage("count") < m0 + 100)
+  end
+  collectgarbage("incremental")
+end
+
+
+do   print("small blocks")
+  -- objects of many sizes, most of them dead; with LUA_USE_GCPAGES,
+  -- their pages must be reused or given back
+  collectgarbage()
+  local m0 = T and T.totalmem()
+  for round = 1, 3 do
+    local a = {}
+    for i = 1, 30000 do
+      a[i] = (i % 3 == 0) and {i, i, i} or
+             (i % 3 == 1) and string.rep("a", i % 40) .. i or
+             function () return i end
+    end
+    for i = 1, #a do if i % 97 ~= 0 then a[i] = false end end
+    collectgarbage()
+    for i = 97, #a, 97 do   -- survivors are intact
+      local v = a[i]
+      if i % 3 == 0 then assert(v[1] == i and v[3] == i)
+      elseif i % 3 == 1 then assert(v == string.rep("a", i % 40) .. i)
+      else assert(v() == i)
+      end
+    end
+  end
+  collectgarbage()
+  if T then assert(T.totalmem() < m0 + 200 * 1024) end
+end
+
+
+do   print("time-budgeted steps and idle time")
+  collectgarbage("incremental")
+  local old = collectgarbage("param", "steptime", 500)
+  assert(collectgarbage("param", "steptime", 1234) == 500)
+  assert(collectgarbage("param", "steptime") == 1234)   -- stored exactly
+  local function garbage (n)
+    local a = {}
+    for i = 1, n do a[i] = {i} end
+  end
+  -- steps measured by time still finish cycles
+  garbage(20000)
+  local n = 0
+  repeat n = n + 1 until collectgarbage("step") or n > 100000
+  assert(n <= 100000)
+  -- time-budgeted steps triggered by allocation
+  for i = 1, 20 do garbage(10000) end
+  collectgarbage("param", "steptime", old)
+
+  -- idle time
+  assert(not collectgarbage("idle", 0))   -- no time, no work
+  collectgarbage()
+  garbage(20000)
+  n = 0
+  repeat n = n + 1 until collectgarbage("idle", 1000) or n > 100000
+  assert(n <= 100000)
+  assert(not pcall(collectgarbage, "idle"))   -- time is mandatory
+  -- idle time also works with a stopped collector
+  collectgarbage("stop")
+  n = 0
+  repeat n = n + 1 until collectgarbage("idle", 1000) or n > 100000
+  assert(n <= 100000 and not collectgarbage("isrunning"))
+  collectgarbage("restart")
+  -- in generational mode, idle time does minor collections
+  collectgarbage("generational")
+  garbage(20000)
+  for i = 1, 3 do collectgarbage("idle", 1000) end
+  collectgarbage("incremental")
+end
+
+
+do   print("adaptive mode")
+  collectgarbage("incremental")
+  local params = {}
+  for _, p in ipairs{"pause", "stepmul", "minormul"} do
+    params[p] = collectgarbage("param", p)
+  end
+  warn("@off")   -- the collector reports its decisions as warnings
+  assert(collectgarbage("adaptive") == "incremental")
+  assert(collectgarbage("adaptive", 1000, 10) == "adaptive")
+  for i = 1, 20 do local a = {}; for j = 1, 1000 do a[j] = {j} end end
+  assert(collectgarbage("incremental") == "adaptive")
+  assert(collectgarbage("incremental") == "incremental")
+  if T then
+    -- loose targets: mode changes depend only on the survival of objects
+    collectgarbage("adaptive", 1000000, 100)
+    -- only garbage: the collector goes to minor mode
+    local i = 0
+    repeat
+      i = i + 1
+      for j = 1, 1000 do local t = {j} end
+    until T.gcquery() == "genminor" or i > 1000
+    assert(T.gcquery() == "genminor")
+    -- new objects survive: the collector goes back to incremental mode
+    local a = {}
+    i = 0
+    repeat i = i + 1; a[i] = {i} until T.gcquery() == "inc" or i > 1e6
+    assert(T.gcquery() == "inc")
+    for j = 1, i do assert(a[j][1] == j) end
+  end
+  collectgarbage("incremental")
+  for p, v in pairs(params) do collectgarbage("param", p, v) end
+  warn("@on")
+end
+
+
+do   print("statistics")
+  local function total (t)
+    local n = 0
+    for _, v in pairs(t) do n = n + v end
+    return n
+  end
+  collectgarbage()
+  local s1 = collectgarbage("stats")
+  assert(s1.cycles > 0 and s1.marked > 0)
+  assert(#s1.pauses == 24 and total(s1.pauses) > 0)
+  local a = {}
+  for i = 1, 1000 do a[i] = {} end
+  for i = 1, 1000 do local t = {i} end   -- garbage
+  collectgarbage()
+  local s2 = collectgarbage("stats")
+  assert(s2.cycles > s1.cycles and s2.freed > 0)
+  assert(total(s2.pauses) > total(s1.pauses))
+  assert(total(s2.time) >= total(s1.time))
+  for k, v in pairs(s1.time) do assert(s2.time[k] >= v) end
+  assert(s2.count.table >= s1.count.table + 1000)
+  assert(s2.bytes.table > s1.bytes.table)
+  assert(s2.count.thread >= 1 and s2.count.other > 0)
+  if T then   -- the walk finds all live objects
+    collectgarbage()
+    local nt, ns = T.totalmem("table"), T.totalmem("string")
+    local s = collectgarbage("stats")
+    assert(s.count.table == nt and s.count.string == ns)
+  end
+  a = nil
+  collectgarbage()
+  -- (some tables from previous calls may still be in the stack)
+  assert(collectgarbage("stats").count.table < s2.count.table - 900)
+  collectgarbage("generational")
+  collectgarbage("step")   -- a minor collection also finishes a cycle
+  local s3 = collectgarbage("stats")
+  assert(s3.cycles > s2.cycles)
+  collectgarbage("incremental")
+end
+
+
+do   print("suspended coroutines")
+  -- the final traversal of a suspended coroutine skips the part of its
+  -- stack below the yield; changes there must still be seen
+  local function body (n)
+    local x = {n}
+    local function set (v) x = v end
+    if n > 0 then
+      local r, a = body(n - 1)
+      return r, a .. n    -- not a tail call; frame stays in the stack
+    end
+    local a = coroutine.yield(set)
+    return x, a
+  end
+  for _, mode in ipairs{"incremental", "generational"} do
+    collectgarbage(mode)
+    local cos = {}
+    for i = 1, 50 do
+      local co = coroutine.create(body)
+      local _, set = coroutine.resume(co, 20)
+      cos[i] = {co, set}
+    end
+    for round = 1, 30 do
+      for i = 1, 50 do
+        local co, set = cos[i][1], cos[i][2]
+        debug.setlocal(co, 1, 2, {-round * i})   -- new object in a local
+        debug.setlocal(co, 21, 1, "n" .. i)   -- same, in a deep frame
+        collectgarbage("step", 0)
+        set({round * i})   -- new object through an open upvalue
+        collectgarbage("step", 0)
+      end
+      if T then T.checkmemory() end
+    end
+    for i = 1, 50 do
+      local ok, x, a = coroutine.resume(cos[i][1], "")
+      assert(ok and x[1] == 30 * i)
+      assert(string.find(a, "19n" .. i .. "$"))
+    end
+  end
+  collectgarbage("incremental")
+end
+
+
+do   print("tables without collectable values")
+  -- the collector skips parts of tables with no collectable values;
+  -- new values stored there later must still be marked
+  for _, mode in ipairs{"incremental", "generational"} do
+    collectgarbage(mode)
+    local t = {}
+    for i = 1, 1000 do t[i] = i * 1.5; t[i + 0.5] = true end
+    collectgarbage()   -- parts of 't' are known to have no objects
+    collectgarbage()
+    t[10] = {10}   -- object in the array part
+    t[10.5] = {10.5}   -- object as value in the hash part
+    t[{}] = 20   -- object as key in the hash part
+    t[-1] = "x" .. 30   -- new key in the hash part
+    for i = 1001, 1100 do t[i] = {i} end   -- array grows
+    for _ = 1, 5 do collectgarbage("step") end
+    collectgarbage()
+    if T then T.checkmemory() end
+    assert(t[10][1] == 10 and t[10.5][1] == 10.5 and t[-1] == "x30")
+    for i = 1001, 1100 do assert(t[i][1] == i) end
+    local n = 0
+    for k, v in pairs(t) do
+      if type(k) == "table" then assert(v == 20); n = n + 1 end
+    end
+    assert(n == 1)
+    -- remove all objects; table goes back to have no collectable values
+    t[10] = 1; t[10.5] = 2; t[-1] = nil
+    for k in pairs(t) do if type(k) == "table" then t[k] = nil end end
+    for i = 1001, 1100 do t[i] = i end
+    collectgarbage()
+    collectgarbage()
+    t[500] = {500}
+    collectgarbage("step")
+    collectgarbage()
+    assert(t[500][1] == 500)
+  end
+  collectgarbage("incremental")
+end
+
 collectgarbage(oldmode)
 
 print('OK')
@@ -123,6 +123,96 @@ do   -- bug introduced in commit 9cf3299fa
 end
 
 
+do   print("young objects in large old tables")
+  local t = {}
+  for i = 1, 1000 do t[i] = i end
+  collectgarbage()   -- make 't' old
+  assert(not T or T.gcage(t) == "old")
+  t[10] = {10}    -- goes to the remembered set; 't' is not touched
+  assert(not T or (T.gcage(t) == "old" and T.gcage(t[10]) == "new"))
+  collectgarbage("step")   -- minor collection
+  assert(not T or (T.gcage(t) == "old" and T.gcage(t[10]) == "survival"))
+  t[20] = {20}
+  collectgarbage("step")   -- minor collection
+  assert(not T or (T.gcage(t) == "old" and T.gcage(t[10]) == "old1"))
+  collectgarbage("step")   -- minor collection
+  assert(t[10][1] == 10 and t[20][1] == 20)
+
+  -- too many writes overflow the remembered set; back to 'touched'
+  for i = 1, 300 do
+    t[i] = {i}
+    if i % 50 == 0 then collectgarbage("step") end
+  end
+  for _ = 1, 3 do collectgarbage("step") end
+  if T then T.checkmemory() end
+  for i = 1, 300 do assert(t[i][1] == i) end
+end
+
+
+do   print("keys of a shape moved to an old table")
+  local a, b = {}, {}
+  collectgarbage()   -- make tables old
+  assert(not T or T.gcage(b) == "old")
+  collectgarbage("stop")
+  local k = {}
+  for i = 1, 33 do k[i] = "k" .. i end   -- new keys
+  a[k[33]] = true    -- marks 'k[33]' through the shape of 'a'
+  -- 'b' gets too many keys for a shape; the last one is already black
+  for i = 1, 33 do b[k[i]] = i end
+  if T then T.checkmemory() end
+  collectgarbage("restart")
+  a, k = nil, nil
+  for _ = 1, 4 do collectgarbage("step") end
+  if T then T.checkmemory() end
+  local n = 0
+  for key, v in pairs(b) do
+    assert(key == "k" .. v); n = n + 1
+  end
+  assert(n == 33)
+
+  -- a key marked through a shape goes to an old table without barrier
+  a, b = {}, {0}
+  collectgarbage()   -- make tables old
+  collectgarbage("stop")
+  local key = "key" .. 1   -- new string
+  a[key] = true    -- marks 'key' through the shape of 'a'
+  b[1] = key       -- 'key' is not white, so no barrier here
+  if T then T.checkmemory() end
+  collectgarbage("restart")
+  a, key = nil, nil
+  for _ = 1, 4 do collectgarbage("step") end
+  if T then T.checkmemory() end
+  assert(b[1] == "key1")
+end
+
+
+do   print("parallel marking in minor collections")
+  local oldw = collectgarbage("param", "workers")
+  local oldmm = collectgarbage("param", "minormajor", 0)  -- no major GCs
+  local N = 10000
+  for _, w in ipairs{1, 2, 4} do
+    collectgarbage("param", "workers", w)
+    local a = {}
+    for i = 1, N do a[i] = {} end
+    collectgarbage("incremental")
+    collectgarbage("generational")   -- all tables become old
+    for i = 1, N do a[i][1] = {i} end   -- old tables touched
+    collectgarbage("step")
+    assert(not T or (T.gcage(a[N]) == "touched2" and
+                     T.gcage(a[N][1]) == "survival"))
+    for i = 1, N do a[i][2] = {-i} end
+    collectgarbage("step")
+    collectgarbage("step")
+    if T then T.checkmemory() end
+    for i = 1, N do
+      assert(a[i][1][1] == i and a[i][2][1] == -i)
+    end
+  end
+  collectgarbage("param", "workers", oldw)
+  collectgarbage("param", "minormajor", oldmm)
+end
+
+
 if T == nil then
   (Message or print)('\n >>> testC not active: \z
                              skipping some generational tests <<<\n')
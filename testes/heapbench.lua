@@ -0,0 +1,78 @@
+-- $Id: testes/heapbench.lua $
+-- See Copyright Notice in file lua.h
+
+-- Benchmark for the memory layout of collectable objects: allocation
+-- of small objects and sweep of dead ones. Not part of the test suite;
+-- run it with builds with and without -DLUA_USE_GCPAGES and compare
+-- the results.
+
+local clock = os.clock
+local N = tonumber(arg and arg[1]) or 1000000
+
+
+local function report (name, n, t)
+  print(string.format("%-28s %8.1f ns/obj", name, t * 1e9 / n))
+end
+
+
+-- best time of 'f(...)' among a few runs
+local function best (f, ...)
+  local b = math.huge
+  for _ = 1, 5 do
+    collectgarbage()
+    local t0 = clock()
+    f(...)
+    b = math.min(b, clock() - t0)
+  end
+  return b
+end
+
+
+-- creators of 'n' objects of some kind, all kept in array 'a'
+local kinds = {
+  {"table", function (a, n) for i = 1, n do a[i] = {} end end},
+  {"table with fields", function (a, n)
+     for i = 1, n do a[i] = {x = i, y = i} end end},
+  {"closure", function (a, n)
+     for i = 1, n do a[i] = function () return i end end end},
+  {"short string", function (a, n)
+     for i = 1, n do a[i] = "s" .. i end end},
+  {"mix", function (a, n)
+     for i = 1, n, 4 do
+       a[i] = {}; a[i + 1] = "m" .. i
+       a[i + 2] = function () return i end; a[i + 3] = {i}
+     end end},
+}
+
+
+-- allocation: creates and keeps the objects, with the collector stopped
+local function alloc (f, n)
+  collectgarbage("stop")
+  f({}, n)
+  collectgarbage("restart")
+end
+
+for _, k in ipairs(kinds) do
+  report("alloc " .. k[1], N, best(alloc, k[2], N))
+end
+
+
+-- sweep: time of a full collection that frees all the objects (the
+-- marking of the few live objects is negligible)
+local function sweep (f, n)
+  local b = math.huge
+  for _ = 1, 5 do
+    local a = {}
+    f(a, n)
+    collectgarbage()
+    a = nil
+    local t0 = clock()
+    collectgarbage()
+    b = math.min(b, clock() - t0)
+  end
+  return b
+end
+
+for _, k in ipairs(kinds) do
+  report("sweep " .. k[1], N, sweep(k[2], N))
+end
@@ -1142,4 +1142,42 @@ end
 -- ]]==================================================================
 
 
+do   print("testing arithmetic and comparisons in hot loops")
+  local function loop (n, a, b)
+    local s, f, c = 0, 0.0, 0
+    for i = 1, n do
+      s = s + a * i - b
+      f = f + i / 2 + 0.5
+      if a < b then c = c + 1 end
+      if not (i <= b) then c = c + 2 end
+      if i == 7 then c = c + 10 end
+      local j = 0
+      while j < i % 4 do j = j + 1 end
+      c = c + j
+    end
+    return s, f, c
+  end
+  for _ = 1, 100 do
+    local s, f, c = loop(100, 2, 3)
+    assert(s == 2 * 5050 - 300 and math.type(s) == "integer")
+    assert(f == 5050 / 2 + 50 and c == 100 + 2 * 97 + 10 + 150)
+    s, f, c = loop(100, 2.0, 3.5)
+    assert(s == 2 * 5050 - 350 and math.type(s) == "float")
+    assert(c == 100 + 2 * 97 + 10 + 150)
+    s, f, c = loop(10, 0/0, 0/0)
+    assert(s ~= s and c == 2 * 10 + 10 + 15)
+    s = loop(2, math.maxinteger, 0)   -- wrap around
+    assert(s == math.maxinteger * 3)
+  end
+  -- operands with metamethods in the middle of a hot loop
+  local mt = {__mul = function (a, b) return 1 end,
+              __lt = function (a, b) return true end}
+  local t = _ENV.setmetatable({}, mt)
+  for _ = 1, 100 do
+    local s, f, c = loop(100, t, 3)
+    assert(s == 100 - 300 and c == 100 + 2 * 97 + 10 + 150)
+  end
+end
+
+
 print('OK')
@@ -127,10 +127,12 @@ end)
 
 do  -- vararg tables
   local function pack (...t) return t end
+  local keep = pack()   -- keep the shape of vararg tables (if any) in use
   local b = testamem("vararg table", function ()
     return pack(10, 20, 30, 40, "hello")
   end)
   assert(b.aloc == 3)   -- new table uses three memory blocks
+  keep = nil
   -- table optimized away
   local function sel (n, ...arg) return arg[n] + arg.n end
   local b = testamem("optimized vararg table",
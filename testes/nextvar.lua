@@ -179,7 +179,7 @@ for _, sa in ipairs(sizes) do    -- 'sa' is size of the array part
     local prog = table.concat(arr)
     local f = assert(load(prog))
     collectgarbage("stop")
-    f()    -- call once to ensure stack space
+    local t0 = f()    -- call once to ensure stack space (and shapes, if any)
     -- make sure table is not resized after being created
     if sa == 0 or sh == 0 then
       T.alloccount(2);  -- header + array or hash part
@@ -318,6 +318,31 @@ end
 local a = {}
 for i=1,lim do a[i] = true; foo(i, table.unpack(a)) end
 
+
+do   -- appends grow the array part to the next power of 2
+  local a = {}
+  for i = 1, 100 do
+    a[#a + 1] = i
+    check(a, mp2(i), 0)
+  end
+  a = {10, 20, 30}
+  table.insert(a, 40); check(a, 4, 0)
+  table.insert(a, 50); check(a, 8, 0)
+  a.x = true    -- a hash part without integer keys
+  for i = 6, 9 do a[i] = i * 10 end
+  check(a, 16, 1)
+  assert(#a == 9 and a[9] == 90)
+
+  -- a queue keeps a small array part, no matter how many pushes it gets
+  local q, first = {}, 1
+  for i = 1, 5000 do
+    q[i] = i
+    if i > 10 then q[first] = nil; first = first + 1 end
+  end
+  assert(not T or T.querytab(q) <= 64)
+  for i = first, 5000 do assert(q[i] == i) end
+end
+
 end  --]
 
 
@@ -363,6 +388,44 @@ local nofind = {}
 -- next uses always the same iteration function
 assert(next{} == next{})
 
+
+do   -- traversals interleaved with one another (cursor in 'next')
+  local t1, t2 = {}, {}
+  for i = 1, 100 do t1["k" .. i] = i; t2[i * 1.5] = i end
+  for i = 1, 10 do t1[i] = -i end
+  local n = 0
+  for k1, v1 in pairs(t1) do
+    assert(t1[k1] == v1)
+    local m = 0
+    for k2, v2 in pairs(t2) do   -- resets the cursor
+      assert(t2[k2] == v2); m = m + 1
+      t2[k2] = v2 * 2    -- assignment to existing field
+    end
+    assert(m == 100)
+    t1[k1] = undef   -- clearing a field during the traversal
+    n = n + 1
+  end
+  assert(n == 110 and next(t1) == nil)
+  -- keys out of order
+  local t = {a = 1, b = 2, c = 3, 10, 20}
+  local ks = {}
+  for k in pairs(t) do ks[#ks + 1] = k end
+  for i = #ks, 1, -1 do
+    assert(next(t, ks[i]) == ks[i + 1])
+  end
+  -- same key in another table
+  local u = {}
+  for k, v in pairs(t) do u[k] = v end
+  local us = {}
+  for k in pairs(u) do us[#us + 1] = k end
+  for i = 1, #ks do
+    local k = next(t, ks[i - 1])   -- set cursor in 't'
+    local j = 1
+    while us[j] ~= k do j = j + 1 end
+    assert(next(u, k) == us[j + 1])   -- cursor does not apply to 'u'
+  end
+end
+
 local function find (name)
   local n,v
   while 1 do
@@ -934,6 +997,73 @@ end
 assert(i == a.n)
 
 
+-- testing tables with the same string keys (which may share shapes)
+do
+  local function rec (i) return {x = i, y = 2 * i, name = "n" .. i} end
+  local t1, t2 = rec(1), rec(2)
+  assert(t1.x == 1 and t2.y == 4 and t2.name == "n2" and t1.z == nil)
+  assert(countentries(t1) == 3 and countentries(t2) == 3)
+  check(t1, 0, 4)
+
+  -- removing and adding back keys
+  t1.y = nil
+  assert(t1.y == nil and countentries(t1) == 2)
+  t1.y = 10
+  assert(t1.y == 10 and countentries(t1) == 3)
+  for k in pairs(t2) do t2[k] = nil end   -- clear during traversal
+  assert(next(t2) == nil and t2.x == nil)
+  t2.name = "new"; t2.z = 0
+  assert(countentries(t2) == 2 and t2.name == "new" and t2.z == 0)
+
+  -- keys that do not fit in a shape
+  local t = rec(3)
+  t[1] = 1; t[true] = 2; t[1.5] = 3; t[{}] = 4
+  assert(t.x == 3 and t.y == 6 and t.name == "n3" and t[1] == 1 and
+         t[true] == 2 and t[1.5] == 3 and countentries(t) == 7)
+  t = rec(4); t[1] = 10; t[2] = 20
+  assert(#t == 2 and t.x == 4 and countentries(t) == 5)
+
+  -- too many keys for a shape
+  t = {}
+  for i = 1, 100 do t["k" .. i] = i end
+  for i = 1, 100 do assert(t["k" .. i] == i) end
+  assert(countentries(t) == 100)
+
+  -- many tables extending the same keys in different ways
+  local ts = {}
+  for i = 1, 100 do ts[i] = {a = i}; ts[i]["b" .. i] = i end
+  for i = 1, 100 do
+    assert(ts[i].a == i and ts[i]["b" .. i] == i and countentries(ts[i]) == 2)
+  end
+
+  -- the same field access over tables with different layouts
+  local function getx (t) return t.x end
+  local objs = {{x = 1}, {y = 0, x = 2}, setmetatable({}, {__index = {x = 3}}),
+                {x = 4, [10] = 0}, rec(5)}
+  for _ = 1, 3 do
+    for i, o in ipairs(objs) do assert(getx(o) == i) end
+  end
+
+  -- weak tables
+  local w = setmetatable({}, {__mode = "v"})
+  w.a = {}; w.b = 1; w.c = "x"
+  collectgarbage()
+  assert(w.a == nil and w.b == 1 and w.c == "x" and countentries(w) == 2)
+  w = setmetatable({}, {__mode = "k"})
+  w.a = {}
+  collectgarbage()
+  assert(type(w.a) == "table")
+
+  -- a key can be collected and its memory reused by another string
+  local function newkey (c) return string.rep(c, 20) end
+  do local t = {}; t[newkey("a")] = 1 end
+  collectgarbage(); collectgarbage()
+  t = {}; t[newkey("b")] = 2
+  assert(t[newkey("b")] == 2 and t[newkey("a")] == nil)
+  assert(next(t) == newkey("b"))
+end
+
+
 -- testing yield inside __pairs
 do
   local t = setmetatable({10, 20, 30}, {__pairs = function (t)
@@ -0,0 +1,66 @@
+-- $Id: testes/strbench.lua $
+-- See Copyright Notice in file lua.h
+
+-- Benchmark for string hashing: interning of new short strings and
+-- lookup of tables with new long strings as keys (each one has to be
+-- hashed once). Not part of the test suite; run it with builds using
+-- different hashes (e.g., with and without -DLUA_USE_BYTEHASH) and
+-- compare the results.
+
+local clock = os.clock
+local N = tonumber(arg and arg[1]) or 1000000
+
+
+local function measure (name, n, f, ...)
+  local best = math.huge
+  for _ = 1, 5 do
+    collectgarbage()
+    local t0 = clock()
+    f(...)
+    best = math.min(best, clock() - t0)
+  end
+  print(string.format("%-28s %8.1f ns/op", name, best * 1e9 / n))
+end
+
+
+-- random text, to cut strings from it
+local buff = {}
+math.randomseed(42)
+for i = 1, N // 8 + 8 do
+  buff[i] = string.pack("<j", math.random(0)):sub(1, 8)
+end
+buff = table.concat(buff)
+
+
+-- interning: creates 'n' new strings with length 'len'
+local function intern (n, len)
+  local sub = string.sub
+  for i = 1, n do
+    local _ = sub(buff, i, i + len - 1)
+  end
+end
+
+-- lookup with long keys: each key is a new string (not yet hashed)
+local function longkeys (keys, t, len)
+  local sub = string.sub
+  local s = 0
+  for i = 1, #keys do
+    s = s + t[sub(keys[i], 1, len)]   -- a new copy of the key
+  end
+  assert(s == #keys * (#keys + 1) // 2)
+end
+
+
+for _, len in ipairs{8, 16, 32, 40} do
+  measure("intern (len " .. len .. ")", N, intern, N, len)
+end
+
+for _, len in ipairs{64, 256, 1024, 4096} do
+  local n = N // (len // 16)
+  local keys, t = {}, {}
+  for i = 1, n do
+    keys[i] = string.format("%08d", i):rep(len // 8)
+    t[keys[i]] = i
+  end
+  measure("long-key lookup (len " .. len .. ")", n, longkeys, keys, t, len)
+end
@@ -424,6 +424,102 @@ assert(table.concat(a, ",", 2) == "b,c")
 assert(table.concat(a, ",", 3) == "c")
 assert(table.concat(a, ",", 4) == "")
 
+
+do  print("testing repeated concatenation")
+  -- long strings built by appending share buffers; prefixes of
+  -- a buffer must keep their values
+  local s = ""
+  local all = {}
+  for i = 1, 300 do
+    s = s .. "x" .. i
+    all[i] = s
+  end
+  local t = {}
+  for i = 1, 300 do
+    t[i] = "x" .. i
+    assert(all[i] == table.concat(t))
+  end
+  local a = all[200] .. "A"    -- appends to a prefix of a buffer
+  local b = all[200] .. "B"
+  assert(#a == #all[200] + 1 and a:sub(-1) == "A" and b:sub(-1) == "B")
+  assert(all[200] < all[201] and not (all[201] < all[200]))
+  assert(all[200] .. "" == all[200] and all[200] <= a)
+  assert(string.find(all[250], "x250", 1, true) == #all[250] - 3)
+  assert(string.find(all[200], "x201", 1, true) == nil)
+  -- strings used by C must not change after a later append
+  local p = all[300]
+  local k = string.format("%s", p)
+  s = s .. "y"
+  assert(k == p and string.format("%s", p) == p)
+  -- prefixes as numbers (a second append makes a buffer with room)
+  local n = (string.rep("1", 44) .. "1") .. "2"
+  local n1 = n .. "3"   -- now 'n' is not followed by a '\0'
+  assert(tonumber(n) == tonumber(string.rep("1", 45) .. "2"))
+  assert(n + 0 == (string.rep("1", 45) .. "2") + 0)
+  assert(math.type(n * 1) == "float")
+  local sp = (string.rep(" ", 44) .. "1") .. "2"
+  local sp1 = sp .. "3"
+  assert(math.floor(sp) == 12 and math.floor(sp1) == 123)
+  -- prefixes as table keys
+  local t = {[n] = 1, [n1] = 2}
+  assert(t[string.rep("1", 45) .. "2"] == 1 and t[n .. "3"] == 2)
+  -- prefixes as weak modes and type names
+  local m = (string.rep("-", 50) .. "k") .. "k"
+  local m1 = m .. "v"
+  local w = setmetatable({}, {__mode = m})
+  w[1] = {}; collectgarbage()
+  assert(w[1])    -- values are not weak
+  local name = (string.rep("x", 45) .. "y") .. "y"
+  local name1 = name .. "z"
+  local u = setmetatable({}, {__name = name})
+  local st, msg = pcall(function () return u .. 1 end)
+  assert(not st and string.find(msg, name .. " value", 1, true))
+end
+
+
+do  print("testing substrings of long strings")
+  -- large substrings share memory with their source
+  local s = string.rep("0123456789", 100) .. "x"
+  local a = s:sub(11, 510)
+  assert(#a == 500 and a == string.rep("0123456789", 50))
+  local b = a:sub(2, 300)    -- substring of a substring
+  assert(b == string.rep("1234567890", 30):sub(1, 299))
+  assert(b:sub(1, 299) == b and a:sub(-300) == string.rep("0123456789", 30))
+  assert(s:sub(1) == s and s:sub(1, -2) .. "x" == s)
+  -- comparisons and keys (contents are not followed by a '\0')
+  local c = s:sub(1, 400)
+  local d = s:sub(1, 401)
+  assert(c < d and not (d < c) and c <= d and c ~= d)
+  local t = {[c] = 1, [d] = 2}
+  assert(t[string.rep("0123456789", 40)] == 1 and t[c .. "0"] == 2)
+  assert(string.format("%s", c) == c and #tostring(c) == 400)
+  assert(c .. d == string.rep("0123456789", 40) .. d)
+  -- as numbers
+  local n = string.rep(" ", 300) .. "12" .. string.rep(" ", 300) .. "3"
+  local nv = n:sub(1, 302)
+  assert(nv + 0 == 12 and math.floor(nv) == 12 and tonumber(nv) == 12)
+  -- numerals longer than 200 characters
+  n = "x" .. string.rep("0", 297) .. "123" .. "x" .. string.rep("1", 299) .. "x"
+  nv = n:sub(2, 301)    -- 300 digits followed by an 'x'
+  assert(#nv == 300 and math.floor(nv) == 123 and nv * 1 == 123)
+  assert(string.rep("a", nv) == string.rep("a", 123))
+  nv = n:sub(303, -2)    -- 299 digits, a float
+  local ns = string.rep("1", 299)
+  assert(nv == ns and nv + 0 == ns + 0 and math.type(nv + 0) == "float")
+  -- captures
+  local line = string.rep("a", 300) .. "=" .. string.rep("b", 300) .. "\n"
+  local k, v = string.match(line, "^(%w+)=(%w+)")
+  assert(k == string.rep("a", 300) and v == string.rep("b", 300))
+  assert(string.match(k .. v, "^a+(b+)$") == v)
+  local count = 0
+  for w in string.gmatch(line:rep(3), "%w+") do
+    count = count + 1
+    assert(w == k or w == v)
+  end
+  assert(count == 6)
+  assert(string.gsub(line, "%w+", function (w) return #w end) == "300=300\n")
+end
+
 if not _port then
 
   local locales = { "ptb", "pt_BR.iso88591", "ISO-8859-1" }
@@ -559,5 +655,64 @@ else
   assert(next(t) == nil)
 end
 
+
+if T then
+  print("testing distribution of strings in the string table")
+  local keep = {}   -- keep strings alive
+  local x, y = string.rep("x", 30), string.rep("y", 30)
+  for i = 1, 5000 do   -- families of similar strings
+    keep[#keep + 1] = "k" .. i
+    keep[#keep + 1] = x .. i
+    keep[#keep + 1] = i .. y
+    keep[#keep + 1] = string.pack("i4", i)
+  end
+  T.movestrtab()   -- finish a resize, if any
+  local size, nuse = T.querystr()
+  local empty, maxlen = 0, 0
+  for i = 1, size do
+    local len = select('#', T.querystr(i))
+    if len == 0 then empty = empty + 1 end
+    if len > maxlen then maxlen = len end
+  end
+  -- with random hashes, the fraction of empty buckets is ~e^(-load)
+  -- and the longest chain is small. (The default hash gets within 0.01
+  -- of that fraction; the byte-at-a-time hash, within 0.08.)
+  local load = nuse / size
+  assert(math.abs(empty / size - math.exp(-load)) < 0.08)
+  assert(maxlen <= 16)
+end
+
+
+if T then
+  print("testing incremental resizing of the string table")
+  collectgarbage(); collectgarbage("stop")
+  local size = T.querystr()
+  local t = {}
+  local i = 0
+  repeat   -- create new strings until the table grows
+    i = i + 1
+    t["s" .. i] = i
+  until T.querystr() > size
+  -- table is being resized now; keep creating and finding strings
+  for j = i + 1, i + 100 do
+    t["s" .. j] = j
+    for k = 1, j, 7 do assert(t["s" .. k] == k) end
+  end
+  -- strings are split between the old and the new arrays
+  local newsize, nuse, oldsize, moved = T.querystr()
+  assert(oldsize == size and moved < oldsize)
+  local n = 0
+  for b = 1, newsize do n = n + select('#', T.querystr(b)) end
+  for b = 1, oldsize do n = n + select('#', T.querystr(b, true)) end
+  assert(n == nuse)
+  T.movestrtab()   -- finish the resize
+  local size1, nuse1, oldsize1 = T.querystr()
+  assert(size1 == newsize and nuse1 == nuse and oldsize1 == 0)
+  t = nil
+  collectgarbage("restart")
+  collectgarbage(); collectgarbage()
+  assert(T.querystr() <= size)   -- table shrinks back
+end
+
 print('OK')
 
@@ -0,0 +1,89 @@
+-- $Id: testes/tabbench.lua $
+-- See Copyright Notice in file lua.h
+
+-- Benchmark for the hash part of tables: insertion, lookup, and
+-- traversal of tables with 10^2 up to 10^N keys (N given as argument,
+-- default 7). Not part of the test suite; run it with builds using
+-- different hash parts (e.g., with and without -DLUA_USE_SWISSHASH)
+-- and compare the results.
+
+local maxexp = tonumber(arg and arg[1]) or 7
+local clock = os.clock
+
+-- each measure does about this many operations
+local OPS = 10000000
+
+
+-- key generators: keys that go to the hash part
+local kinds = {
+  {"int", function (i) return i * 65599 end},
+  {"str", function (i) return "key" .. i end},
+}
+
+
+local function insert (keys, n)
+  local t = {}
+  for i = 1, n do t[keys[i]] = i end
+  return t
+end
+
+
+local function lookup (t, keys, n)
+  local s = 0
+  for i = 1, n do s = s + t[keys[i]] end
+  assert(s == n * (n + 1) // 2)
+end
+
+
+local function miss (t, keys, n)
+  for i = 1, n do assert(t[keys[i]] == nil) end
+end
+
+
+local function iterate (t, n)
+  local c = 0
+  for _ in pairs(t) do c = c + 1 end
+  assert(c == n)
+end
+
+
+local function measure (f, ...)
+  local t0 = clock()
+  f(...)
+  return clock() - t0
+end
+
+
+print(string.format("%-4s %9s %12s %12s %12s %12s", "kind", "keys",
+      "insert", "lookup", "miss", "iterate"))
+print(string.format("%-4s %9s %12s %12s %12s %12s", "", "",
+      "(ns/key)", "(ns/key)", "(ns/key)", "(ns/key)"))
+
+for _, kind in ipairs(kinds) do
+  local name, gen = kind[1], kind[2]
+  for e = 2, maxexp do
+    local n = math.tointeger(10^e)
+    local rep = math.max(1, OPS // n)
+    local keys, absent = {}, {}
+    for i = 1, n do keys[i] = gen(i); absent[i] = gen(-i) end
+    collectgarbage()
+    local tins, tlook, tmiss, titer = 0, 0, 0, 0
+    local t
+    for _ = 1, rep do
+      t = nil
+      local t0 = clock()
+      t = insert(keys, n)
+      tins = tins + (clock() - t0)
+    end
+    for _ = 1, rep do
+      tlook = tlook + measure(lookup, t, keys, n)
+      tmiss = tmiss + measure(miss, t, absent, n)
+      titer = titer + measure(iterate, t, n)
+    end
+    local f = 1e9 / (rep * n)
+    print(string.format("%-4s %9d %12.1f %12.1f %12.1f %12.1f", name, n,
+          tins * f, tlook * f, tmiss * f, titer * f))
+    t, keys, absent = nil
+    collectgarbage()
+  end
+end